@@ -5,21 +5,92 @@
 #include <vector>
 #include <map>
 #include <filesystem>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <sys/stat.h>
 #include "FileManager.hpp"
+#include "LruCache.hpp"
+#include "ThreadPool.hpp"
+#include "RefStore.hpp"
+#include "RecordFile.hpp"
 
 namespace fs = std::filesystem;
 
+// Each branch's file state is a base snapshot, state.json, plus a journal
+// of the changes made since, state.journal. A commit appends one record of
+// the paths it changed to the journal with a single flush; once the journal
+// passes the compaction threshold a background worker folds it into a new
+// snapshot, written to a temporary file and renamed into place. The
+// snapshot carries a generation and the journal records the generation it
+// extends, so a journal left behind by a crash during compaction is
+// ignored rather than applied twice. Writers in any process hold an flock
+// on the branch's state.lock while they read and rewrite its state.
+//   journal: 8-byte magic, u64 generation, then records of
+//   u32 payload length, u32 CRC-32, payload
+//   payload: u32 count, then (u32 path length, path, 32-byte digest) per
+//   change; a null digest removes the path
 class BranchManager {
 private:
+    // A parsed branch state and the stat data its files had when read; the
+    // entry is only used while both still match, so writes by other
+    // processes are noticed. journalEnd is where the journal's intact
+    // records end, or 0 when there is no journal for this generation.
+    // files is handed to readers as is; a commit changes it in place when no
+    // reader holds it, and changes a copy otherwise. bytes is its rough heap
+    // footprint, for the cache budget.
+    struct CachedState {
+        recordfile::FileStamp base;
+        recordfile::FileStamp journal;
+        uint64_t generation = 0;
+        uint64_t journalEnd = 0;
+        std::shared_ptr<std::map<std::string, ObjectId>> files = std::make_shared<std::map<std::string, ObjectId>>();
+        size_t bytes = 0;
+    };
+
     std::string vaultPath;
     const std::string BRANCHES_DIR;
     FileManager& fileManager;   
     std::string currentBranch;   
+    LruCache<std::string, CachedState> stateCache;
+    // Head commit of every branch; a branch exists if it has a ref
+    mutable RefStore refStore;
+    uint64_t compactionBytes;
+    // Held shared while a state is read and exclusively while one is
+    // written, so a compaction is never seen half done
+    std::shared_mutex stateMutex;
+    std::mutex compactionMutex;
+    std::set<std::string> compactionsPending;
+    // Started on first use. Declared last so queued compactions finish
+    // before the rest of the manager is destroyed.
+    std::unique_ptr<ThreadPool> compactor;
 
-    std::map<std::string, std::string> getBranchState(const std::string& branchName);
     bool updateBranchHead(const std::string& branchName, const std::string& commitId);
+    fs::path branchPath(const std::string& branchName) const;
+    static bool isValidBranchName(const std::string& branchName);
+    // Undoes a createBranch that failed before its ref was written
+    void removeBranchFiles(const std::string& branchName);
+    static void parseStateOnce(const fs::path& branchDir, bool strict, CachedState& state);
+    // Takes no lock, so it reads again if another process compacts the
+    // state meanwhile
+    static void parseState(const fs::path& branchDir, bool strict, CachedState& state);
+    // Callers hold stateMutex
+    std::shared_ptr<const CachedState> readState(const std::string& branchName);
+    void writeBaseState(const std::string& branchName, const std::map<std::string, ObjectId>& files,
+                        uint64_t generation);
+    // Counts state.bytes from its files
+    std::shared_ptr<const CachedState> cacheState(const std::string& branchName, CachedState state);
+    void scheduleCompaction(const std::string& branchName);
 
 public:
+    static constexpr size_t DEFAULT_STATE_CACHE_BYTES = 32 * 1024 * 1024;
+    static constexpr uint64_t DEFAULT_COMPACTION_BYTES = 1024 * 1024;
+    static constexpr const char* STATE_FILE = "state.json";
+    static constexpr const char* JOURNAL_FILE = "state.journal";
+    static constexpr const char* REFS_DIR = "refs";
+    static constexpr const char* PACKED_REFS_FILE = "packed-refs";
+
     BranchManager(const std::string& basePath, 
                  const std::string& branchesDir,
                  FileManager& fm) 
@@ -27,15 +98,44 @@ public:
         , BRANCHES_DIR(branchesDir)
         , fileManager(fm)        
         , currentBranch("master")
+        , stateCache(DEFAULT_STATE_CACHE_BYTES)
+        , refStore((fs::path(basePath) / REFS_DIR).string(), (fs::path(basePath) / PACKED_REFS_FILE).string())
+        , compactionBytes(DEFAULT_COMPACTION_BYTES)
     {}
 
+    // Names may contain '/'; empty parts, "." and ".." are refused
     bool createBranch(const std::string& branchName);
     bool switchBranch(const std::string& branchName, const std::string& commitId);
+    // Sorted by name
     std::vector<std::string> listBranches() const;
     std::string getCurrentBranch() const;
     bool branchExists(const std::string& branchName) const;
+    // Replaces the whole state with a new snapshot
     bool saveBranchState(const std::string& branchName, 
-                        const std::map<std::string, std::string>& fileStates);
+                        const std::map<std::string, ObjectId>& fileStates);
+    // Records changed paths in the journal; a null id removes the path.
+    // Costs in proportion to the number of changes.
+    bool updateBranchState(const std::string& branchName,
+                           const std::map<std::string, ObjectId>& changes);
+    // Shared with the cache, and never modified while the caller holds it;
+    // empty if it cannot be read
+    std::shared_ptr<const std::map<std::string, ObjectId>> getBranchState(const std::string& branchName);
+    // Folds the journal into the snapshot now rather than in the background
+    bool compactBranchState(const std::string& branchName);
+    void setCompactionThreshold(uint64_t bytes);
+    // Commit the branch points at; empty before its first commit
+    std::string getBranchHead(const std::string& branchName) const;
+    // Moves branches from before the ref store, which kept their head in
+    // a HEAD file in the branch directory, into it; returns how many
+    size_t importLegacyRefs();
+
+    // The state stored in a branch directory, for readers outside the
+    // manager. Throws if it cannot be read, or names something that is not
+    // an object.
+    static std::map<std::string, ObjectId> readStateFiles(const fs::path& branchDir);
+
+    CacheStats getStateCacheStats() const;
+    void setStateCacheCapacity(size_t bytes);
 };
 
 #endif 
\ No newline at end of file
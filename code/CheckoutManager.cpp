@@ -0,0 +1,284 @@
+#include "CheckoutManager.hpp"
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <sys/stat.h>
+
+std::string CheckoutManager::resolveCommit(const std::string& target) {
+    if (branchManager.branchExists(target)) {
+        std::string head = branchManager.getBranchHead(target);
+        if (head.empty()) {
+            throw std::runtime_error("Branch has no commits: " + target);
+        }
+        return head;
+    }
+    if (!commitLog.contains(target)) {
+        throw std::runtime_error("No branch or commit named " + target);
+    }
+    return target;
+}
+
+std::map<std::string, ObjectId> CheckoutManager::selectFiles(const CommitInfo& commit,
+                                                             const std::vector<std::string>& paths) {
+    // Filters are compared as normalised vault paths; "." or "" selects
+    // everything
+    std::set<std::string> filters;
+    for (const auto& path : paths) {
+        std::string filter = fs::path(path).lexically_normal().generic_string();
+        while (!filter.empty() && filter.back() == '/') {
+            filter.pop_back();
+        }
+        if (filter.empty() || filter == ".") {
+            filters.clear();
+            break;
+        }
+        filters.insert(filter);
+    }
+
+    // Commits from before snapshots only know the files they changed
+    if (commit.tree.isNull()) {
+        std::map<std::string, ObjectId> files;
+        for (const auto& [path, hash] : commit.fileHashes) {
+            bool selected = filters.empty();
+            for (const auto& filter : filters) {
+                if (path == filter || path.compare(0, filter.size() + 1, filter + "/") == 0) {
+                    selected = true;
+                    break;
+                }
+            }
+            if (selected) {
+                files[path] = hash;
+            }
+        }
+        return files;
+    }
+
+    if (filters.empty()) {
+        return treeManager.flatten(commit.tree);
+    }
+    std::map<std::string, ObjectId> files;
+    for (const auto& filter : filters) {
+        auto selected = treeManager.flatten(commit.tree, filter);
+        files.insert(selected.begin(), selected.end());
+    }
+    return files;
+}
+
+std::vector<std::string> CheckoutManager::workTreeHashes(const std::vector<std::string>& destPaths) {
+    // The cache holds object names, so it follows the content algorithm
+    workTreeCache.setAlgorithm(hashAlgorithmName(fileManager.getHashAlgorithm()));
+
+    std::vector<std::string> hashes(destPaths.size());
+    std::vector<size_t> toHash;
+    std::vector<struct stat> toHashInfo;
+
+    // One stat per file; only files the cache cannot vouch for are read
+    for (size_t i = 0; i < destPaths.size(); i++) {
+        struct stat info;
+        if (stat(destPaths[i].c_str(), &info) != 0 || !S_ISREG(info.st_mode)) {
+            continue;
+        }
+        if (!workTreeCache.lookup(destPaths[i], info, hashes[i])) {
+            toHash.push_back(i);
+            toHashInfo.push_back(info);
+        }
+    }
+
+    std::vector<std::string> hashPaths;
+    for (size_t i : toHash) {
+        hashPaths.push_back(destPaths[i]);
+    }
+    auto computed = fileManager.calculateFileHashes(hashPaths);
+    for (size_t i = 0; i < toHash.size(); i++) {
+        workTreeCache.store(destPaths[toHash[i]], toHashInfo[i], computed[i]);
+        hashes[toHash[i]] = computed[i];
+    }
+    return hashes;
+}
+
+void CheckoutManager::applyChanges(const std::vector<Target>& toWrite, const std::vector<std::string>& toDelete,
+                                   CheckoutStats& stats) {
+    std::mutex statsMutex;
+    ThreadPool pool(std::min(threads, std::max(toWrite.size(), toDelete.size())));
+
+    // Deletes go first, so a file can take the place of a directory that
+    // is going away and the other way round
+    pool.parallelFor(toDelete.size(), [&](size_t i) {
+        const std::string& destPath = toDelete[i];
+        std::error_code ec;
+        bool deleted = fs::remove(destPath, ec) || !ec;
+        workTreeCache.remove(destPath);
+
+        std::lock_guard<std::mutex> lock(statsMutex);
+        if (deleted) {
+            stats.filesDeleted++;
+        }
+        else {
+            stats.filesFailed++;
+            stats.problems.push_back("Failed to delete " + destPath);
+        }
+    });
+
+    // Directories emptied by the deletes go too, deepest first
+    std::set<fs::path, std::greater<fs::path>> emptied;
+    for (const auto& destPath : toDelete) {
+        for (fs::path directory = fs::path(destPath).parent_path();
+             directory != workTree && directory.has_relative_path(); directory = directory.parent_path()) {
+            emptied.insert(directory);
+        }
+    }
+    for (const auto& directory : emptied) {
+        std::error_code ec;
+        if (fs::is_directory(directory, ec) && fs::is_empty(directory, ec)) {
+            fs::remove(directory, ec);
+        }
+    }
+
+    // Directories are created up front so workers never race to make the
+    // same one
+    std::set<fs::path> directories;
+    for (const auto& file : toWrite) {
+        directories.insert(fs::path(file.destPath).parent_path());
+    }
+    for (const auto& directory : directories) {
+        if (!directory.empty()) {
+            fs::create_directories(directory);
+        }
+    }
+
+    pool.parallelFor(toWrite.size(), [&](size_t i) {
+        const Target& file = toWrite[i];
+        struct stat info;
+        bool written = fileManager.copyFileFromObjects(file.hash, file.destPath) &&
+                       stat(file.destPath.c_str(), &info) == 0;
+        if (written) {
+            workTreeCache.store(file.destPath, info, file.hash.toHex());
+        }
+
+        std::lock_guard<std::mutex> lock(statsMutex);
+        if (written) {
+            stats.filesWritten++;
+            stats.bytesWritten += info.st_size;
+        }
+        else {
+            stats.filesFailed++;
+            stats.problems.push_back("Failed to check out " + file.destPath);
+        }
+    });
+}
+
+CheckoutStats CheckoutManager::checkout(const std::string& target, const std::vector<std::string>& paths) {
+    CheckoutStats stats;
+    auto start = std::chrono::steady_clock::now();
+
+    std::string commitId = resolveCommit(target);
+    auto commit = commitLog.read(commitId);
+    if (!commit) {
+        throw std::runtime_error("Commit does not exist: " + commitId);
+    }
+    std::map<std::string, ObjectId> files = selectFiles(*commit, paths);
+    stats.filesSelected = files.size();
+
+    std::vector<Target> targets;
+    std::vector<std::string> destPaths;
+    for (const auto& [path, hash] : files) {
+        targets.push_back({(workTree / path).string(), hash});
+        destPaths.push_back(targets.back().destPath);
+    }
+
+    std::vector<std::string> current = workTreeHashes(destPaths);
+    std::vector<Target> toWrite;
+    for (size_t i = 0; i < targets.size(); i++) {
+        ObjectId currentId;
+        if (ObjectId::parse(current[i], currentId) && currentId == targets[i].hash) {
+            stats.filesUnchanged++;
+        }
+        else {
+            toWrite.push_back(targets[i]);
+        }
+    }
+
+    applyChanges(toWrite, {}, stats);
+    workTreeCache.save();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+CheckoutStats CheckoutManager::planUpdate(const std::vector<FileChange>& changes, std::vector<Target>& toWrite,
+                                          std::vector<std::string>& toDelete) {
+    CheckoutStats stats;
+    std::vector<std::string> destPaths;
+    for (const auto& change : changes) {
+        destPaths.push_back((workTree / change.path).string());
+        if (!change.to.isNull()) {
+            stats.filesSelected++;
+        }
+    }
+    std::vector<std::string> current = workTreeHashes(destPaths);
+
+    for (size_t i = 0; i < changes.size(); i++) {
+        const FileChange& change = changes[i];
+        ObjectId currentId;
+        bool present = ObjectId::parse(current[i], currentId);
+        if (present ? currentId == change.to : change.to.isNull()) {
+            if (!change.to.isNull()) {
+                stats.filesUnchanged++;
+            }
+        }
+        else if (present && currentId != change.from) {
+            // Neither side's version: local work the update would lose
+            stats.filesModified++;
+            stats.problems.push_back("Local changes to " + destPaths[i] + " would be overwritten");
+        }
+        else if (change.to.isNull()) {
+            toDelete.push_back(destPaths[i]);
+        }
+        else {
+            toWrite.push_back({destPaths[i], change.to});
+        }
+    }
+    return stats;
+}
+
+CheckoutStats CheckoutManager::updateWorkTree(const std::vector<FileChange>& changes) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Target> toWrite;
+    std::vector<std::string> toDelete;
+    CheckoutStats stats = planUpdate(changes, toWrite, toDelete);
+    if (stats.filesModified == 0) {
+        applyChanges(toWrite, toDelete, stats);
+    }
+    workTreeCache.save();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+CheckoutStats CheckoutManager::checkWorkTree(const std::vector<FileChange>& changes) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Target> toWrite;
+    std::vector<std::string> toDelete;
+    CheckoutStats stats = planUpdate(changes, toWrite, toDelete);
+    // Keeps the hashes just read, so the update does not read them again
+    workTreeCache.save();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+CheckoutStats CheckoutManager::switchBranch(const std::string& fromBranch, const std::string& toBranch) {
+    if (!branchManager.branchExists(toBranch)) {
+        throw std::runtime_error("Branch does not exist: " + toBranch);
+    }
+    auto to = branchManager.getBranchState(toBranch);
+    std::vector<FileChange> changes = TreeManager::diff(*branchManager.getBranchState(fromBranch), *to);
+
+    // Files the branches share are not looked at at all
+    CheckoutStats stats = updateWorkTree(changes);
+    stats.filesUnchanged += to->size() - stats.filesSelected;
+    stats.filesSelected = to->size();
+    return stats;
+}
+
+void CheckoutManager::setThreads(size_t threadCount) {
+    threads = threadCount == 0 ? 1 : threadCount;
+}
@@ -0,0 +1,101 @@
+#ifndef CHECKOUT_MANAGER_HPP
+#define CHECKOUT_MANAGER_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <filesystem>
+#include "FileManager.hpp"
+#include "BranchManager.hpp"
+#include "CommitLog.hpp"
+#include "TreeManager.hpp"
+#include "StatCache.hpp"
+
+namespace fs = std::filesystem;
+
+struct CheckoutStats {
+    // Files of the snapshot selected by the path filters
+    size_t filesSelected = 0;
+    size_t filesUnchanged = 0;
+    size_t filesWritten = 0;
+    size_t filesDeleted = 0;
+    // Work tree files changed since they were checked out, which stop a
+    // branch switch
+    size_t filesModified = 0;
+    size_t filesFailed = 0;
+    uint64_t bytesWritten = 0;
+    double seconds = 0;
+    // One line per file that could not be written or was modified
+    std::vector<std::string> problems;
+};
+
+// Restores a commit's snapshot, or part of it, into the work tree. The
+// snapshot is read once; files whose stat data matches what the work tree
+// cache recorded for the same content are skipped without being read, the
+// rest are hashed in one batch and only those that differ are written, on
+// a thread pool. Files not in the snapshot are left alone.
+class CheckoutManager {
+private:
+    struct Target {
+        std::string destPath;
+        ObjectId hash;
+    };
+
+    fs::path workTree;
+    CommitLog& commitLog;
+    BranchManager& branchManager;
+    TreeManager& treeManager;
+    FileManager& fileManager;
+    // Content hash of each work tree file as last written or checked
+    StatCache& workTreeCache;
+    size_t threads;
+
+    std::map<std::string, ObjectId> selectFiles(const CommitInfo& commit,
+                                                const std::vector<std::string>& paths);
+    // Content hash of each work tree file, empty for files that are not
+    // there; only files the cache cannot vouch for are read
+    std::vector<std::string> workTreeHashes(const std::vector<std::string>& destPaths);
+    // Sorts changes into the files to write and delete, counting the rest
+    // in the returned stats; nothing is changed
+    CheckoutStats planUpdate(const std::vector<FileChange>& changes, std::vector<Target>& toWrite,
+                             std::vector<std::string>& toDelete);
+    // Writes and deletes on the pool, counting the outcome in stats
+    void applyChanges(const std::vector<Target>& toWrite, const std::vector<std::string>& toDelete,
+                      CheckoutStats& stats);
+
+public:
+    CheckoutManager(const std::string& workTreePath,
+                    CommitLog& log,
+                    BranchManager& bm,
+                    TreeManager& tm,
+                    FileManager& fm,
+                    StatCache& cache)
+        : workTree(workTreePath)
+        , commitLog(log)
+        , branchManager(bm)
+        , treeManager(tm)
+        , fileManager(fm)
+        , workTreeCache(cache)
+        , threads(ThreadPool::defaultThreadCount())
+    {}
+
+    // target is a branch name or a commit id; paths, relative to the work
+    // tree, limit the checkout to those files and directories. Throws if
+    // the target cannot be read; files that fail to write are counted.
+    CheckoutStats checkout(const std::string& target, const std::vector<std::string>& paths);
+    // Brings the work tree from each change's from side to its to side,
+    // leaving files that already match. If any file is at neither version
+    // nothing is changed and filesModified says how many.
+    CheckoutStats updateWorkTree(const std::vector<FileChange>& changes);
+    // The checks of updateWorkTree without the update, so a caller can
+    // record the changes before making them
+    CheckoutStats checkWorkTree(const std::vector<FileChange>& changes);
+    // Moves the work tree from one branch's files to another's; only paths
+    // whose object differs between the two branch states are looked at
+    CheckoutStats switchBranch(const std::string& fromBranch, const std::string& toBranch);
+    // The commit a branch name or commit id stands for; throws if neither
+    std::string resolveCommit(const std::string& target);
+    void setThreads(size_t threadCount);
+};
+
+#endif // CHECKOUT_MANAGER_HPP
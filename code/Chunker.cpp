@@ -0,0 +1,62 @@
+#include "Chunker.hpp"
+#include <algorithm>
+
+namespace {
+
+// Normalized chunking: a stricter mask before the average size and a looser
+// one after it pulls chunk sizes towards the average
+constexpr uint64_t MASK_SMALL = ((uint64_t(1) << 20) - 1) << 44;
+constexpr uint64_t MASK_LARGE = ((uint64_t(1) << 16) - 1) << 48;
+
+// The gear table decides every chunk boundary ever written, so it is derived
+// from a fixed seed and must never change
+struct GearTable {
+    uint64_t values[256];
+
+    GearTable() {
+        uint64_t state = 0x5661756c74434443ULL;
+        for (auto& value : values) {
+            // splitmix64
+            state += 0x9e3779b97f4a7c15ULL;
+            uint64_t z = state;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            value = z ^ (z >> 31);
+        }
+    }
+};
+
+const GearTable& gearTable() {
+    static const GearTable table;
+    return table;
+}
+
+} // namespace
+
+Chunker::Chunker() : gear(gearTable().values) {}
+
+size_t Chunker::nextChunk(const unsigned char* data, size_t length, bool endOfInput) const {
+    if (length <= MIN_SIZE) {
+        return endOfInput ? length : 0;
+    }
+
+    size_t limit = std::min(length, MAX_SIZE);
+    size_t normal = std::min(limit, AVG_SIZE);
+    uint64_t fingerprint = 0;
+    size_t i = MIN_SIZE;
+
+    for (; i < normal; i++) {
+        fingerprint = (fingerprint << 1) + gear[data[i]];
+        if (!(fingerprint & MASK_SMALL)) {
+            return i + 1;
+        }
+    }
+    for (; i < limit; i++) {
+        fingerprint = (fingerprint << 1) + gear[data[i]];
+        if (!(fingerprint & MASK_LARGE)) {
+            return i + 1;
+        }
+    }
+
+    return limit;
+}
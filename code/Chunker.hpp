@@ -0,0 +1,26 @@
+#ifndef CHUNKER_HPP
+#define CHUNKER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// FastCDC-style content-defined chunking: boundaries depend only on the
+// bytes around them, so an insertion or edit only changes the chunks it
+// touches and everything else deduplicates against earlier versions.
+class Chunker {
+public:
+    static constexpr size_t MIN_SIZE = 64 * 1024;
+    static constexpr size_t AVG_SIZE = 256 * 1024;
+    static constexpr size_t MAX_SIZE = 1024 * 1024;
+
+    Chunker();
+
+    // Length of the chunk starting at data. Unless endOfInput is set the
+    // caller must supply at least MAX_SIZE bytes.
+    size_t nextChunk(const unsigned char* data, size_t length, bool endOfInput) const;
+
+private:
+    const uint64_t* gear;
+};
+
+#endif // CHUNKER_HPP
@@ -0,0 +1,339 @@
+#include "CommitGraph.hpp"
+#include "ObjectFormat.hpp"
+#include "RecordFile.hpp"
+#include <algorithm>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <unordered_set>
+#include <unistd.h>
+
+namespace {
+
+// Graph file: 8-byte magic/version, then one record per commit in log
+// order: u32 payload length, u32 CRC-32, payload of (u32 id length, id,
+// u32 generation, u32 parent count, u32 parent positions, filter words)
+const char GRAPH_MAGIC[8] = {'V', 'A', 'U', 'L', 'T', 'C', 'G', 1};
+constexpr size_t RECORD_HEADER_SIZE = 8;
+
+// Bits a commit id sets in a reachability filter
+constexpr int FILTER_HASHES = 3;
+constexpr size_t FILTER_BITS = CommitGraph::FILTER_WORDS * 64;
+
+CommitGraph::Filter filterBits(const std::string& commitId) {
+    // FNV-1a; the filter is stored, so the hash must not change between
+    // builds the way std::hash may
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c : commitId) {
+        hash = (hash ^ c) * 0x100000001b3ULL;
+    }
+    uint64_t step = (hash >> 32) | 1;
+
+    CommitGraph::Filter bits{};
+    for (int i = 0; i < FILTER_HASHES; i++) {
+        size_t bit = (hash + i * step) % FILTER_BITS;
+        bits[bit / 64] |= 1ULL << (bit % 64);
+    }
+    return bits;
+}
+
+bool filterContains(const CommitGraph::Filter& filter, const CommitGraph::Filter& bits) {
+    for (size_t i = 0; i < CommitGraph::FILTER_WORDS; i++) {
+        if ((filter[i] & bits[i]) != bits[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+CommitGraph::CommitGraph(const std::string& path, CommitLog& log)
+    : graphPath(path), commitLog(log), graphFd(-1), validEnd(recordfile::RECORD_MAGIC_SIZE) {}
+
+CommitGraph::~CommitGraph() {
+    if (graphFd >= 0) ::close(graphFd);
+}
+
+void CommitGraph::open() {
+    if (graphFd < 0) {
+        graphFd = recordfile::openRecordFile(graphPath, GRAPH_MAGIC);
+    }
+}
+
+void CommitGraph::addNode(Node node) {
+    positions.emplace(node.commitId, static_cast<uint32_t>(nodes.size()));
+    nodes.push_back(std::move(node));
+}
+
+void CommitGraph::readNewRecords() {
+    uint64_t size = recordfile::fileSize(graphFd, graphPath);
+    if (size <= validEnd) {
+        return;
+    }
+
+    std::string data(size - validEnd, '\0');
+    if (pread(graphFd, &data[0], data.size(), validEnd) != static_cast<ssize_t>(data.size())) {
+        throw std::runtime_error("Failed to read commit graph: " + graphPath);
+    }
+
+    // Stop at the first record that is cut short or fails its checksum;
+    // the next writer cuts it off
+    size_t position = 0;
+    while (data.size() - position >= RECORD_HEADER_SIZE) {
+        const char* record = data.data() + position;
+        uint32_t length = getUint32(record);
+        if (length > data.size() - position - RECORD_HEADER_SIZE ||
+            getUint32(record + 4) != recordfile::recordChecksum(record + RECORD_HEADER_SIZE, length) || length < 4) {
+            break;
+        }
+
+        const char* payload = record + RECORD_HEADER_SIZE;
+        uint32_t idLength = getUint32(payload);
+        if (length < 4 + static_cast<uint64_t>(idLength) + 8) break;
+        Node node;
+        node.commitId.assign(payload + 4, idLength);
+        node.generation = getUint32(payload + 4 + idLength);
+        uint32_t parentCount = getUint32(payload + 8 + idLength);
+        if (length != 12 + idLength + 4 * static_cast<uint64_t>(parentCount) + 8 * FILTER_WORDS) break;
+
+        const char* field = payload + 12 + idLength;
+        for (uint32_t i = 0; i < parentCount; i++, field += 4) {
+            node.parents.push_back(getUint32(field));
+        }
+        for (size_t i = 0; i < FILTER_WORDS; i++, field += 8) {
+            node.reachable[i] = getUint64(field);
+        }
+        addNode(std::move(node));
+        position += RECORD_HEADER_SIZE + length;
+    }
+    validEnd += position;
+}
+
+void CommitGraph::update() {
+    std::unique_lock<std::shared_mutex> lock(graphMutex);
+    open();
+
+    // Cheap check first: usually the graph is already up to date
+    readNewRecords();
+    if (commitLog.listCommits(nodes.size()).empty()) {
+        return;
+    }
+
+    recordfile::FileLock fileLock(graphFd);
+    readNewRecords();
+    std::vector<std::string> missing = commitLog.listCommits(nodes.size());
+    if (missing.empty()) {
+        return;
+    }
+
+    if (recordfile::fileSize(graphFd, graphPath) > validEnd && ftruncate(graphFd, validEnd) != 0) {
+        throw std::runtime_error("Failed to truncate commit graph: " + graphPath);
+    }
+
+    // Parents always precede their children in the log, so every parent
+    // is already a node by the time its child is added
+    std::string records;
+    for (const auto& commitId : missing) {
+        auto commit = commitLog.read(commitId);
+        if (!commit) {
+            throw std::runtime_error("Commit vanished from the log: " + commitId);
+        }
+
+        Node node;
+        node.commitId = commitId;
+        node.generation = 1;
+        node.reachable = filterBits(commitId);
+        for (const auto& parentId : commit->parents) {
+            auto parent = positions.find(parentId);
+            if (parent == positions.end()) continue;
+            const Node& parentNode = nodes[parent->second];
+            node.parents.push_back(parent->second);
+            node.generation = std::max(node.generation, parentNode.generation + 1);
+            for (size_t i = 0; i < FILTER_WORDS; i++) {
+                node.reachable[i] |= parentNode.reachable[i];
+            }
+        }
+
+        std::string payload;
+        char number[8];
+        putUint32(number, static_cast<uint32_t>(commitId.size()));
+        payload.append(number, 4);
+        payload.append(commitId);
+        putUint32(number, node.generation);
+        payload.append(number, 4);
+        putUint32(number, static_cast<uint32_t>(node.parents.size()));
+        payload.append(number, 4);
+        for (uint32_t parent : node.parents) {
+            putUint32(number, parent);
+            payload.append(number, 4);
+        }
+        for (uint64_t word : node.reachable) {
+            putUint64(number, word);
+            payload.append(number, 8);
+        }
+
+        char header[RECORD_HEADER_SIZE];
+        putUint32(header, static_cast<uint32_t>(payload.size()));
+        putUint32(header + 4, recordfile::recordChecksum(payload.data(), payload.size()));
+        records.append(header, sizeof(header));
+        records.append(payload);
+        addNode(std::move(node));
+    }
+
+    recordfile::writeAt(graphFd, records, validEnd, graphPath);
+    validEnd += records.size();
+}
+
+uint32_t CommitGraph::position(const std::string& commitId) const {
+    auto found = positions.find(commitId);
+    if (found == positions.end()) {
+        throw std::runtime_error("Unknown commit: " + commitId);
+    }
+    return found->second;
+}
+
+uint32_t CommitGraph::getGeneration(const std::string& commitId) {
+    update();
+    std::shared_lock<std::shared_mutex> lock(graphMutex);
+    return nodes[position(commitId)].generation;
+}
+
+std::vector<std::string> CommitGraph::getParents(const std::string& commitId) {
+    update();
+    std::shared_lock<std::shared_mutex> lock(graphMutex);
+    std::vector<std::string> parents;
+    for (uint32_t parent : nodes[position(commitId)].parents) {
+        parents.push_back(nodes[parent].commitId);
+    }
+    return parents;
+}
+
+bool CommitGraph::isAncestor(const std::string& ancestor, const std::string& descendant) {
+    update();
+    std::shared_lock<std::shared_mutex> lock(graphMutex);
+    uint32_t target = position(ancestor);
+    uint32_t start = position(descendant);
+    if (target == start) {
+        return true;
+    }
+
+    const Node& targetNode = nodes[target];
+    if (targetNode.generation >= nodes[start].generation ||
+        !filterContains(nodes[start].reachable, filterBits(ancestor))) {
+        return false;
+    }
+
+    // Only commits above the target's generation can lead down to it
+    std::vector<uint32_t> pending{start};
+    std::unordered_set<uint32_t> seen{start};
+    while (!pending.empty()) {
+        uint32_t current = pending.back();
+        pending.pop_back();
+        for (uint32_t parent : nodes[current].parents) {
+            if (parent == target) {
+                return true;
+            }
+            const Node& parentNode = nodes[parent];
+            if (parentNode.generation > targetNode.generation &&
+                filterContains(parentNode.reachable, filterBits(ancestor)) && seen.insert(parent).second) {
+                pending.push_back(parent);
+            }
+        }
+    }
+    return false;
+}
+
+std::string CommitGraph::mergeBase(const std::string& first, const std::string& second) {
+    update();
+    std::shared_lock<std::shared_mutex> lock(graphMutex);
+
+    // Walk down from both sides highest generation first. A commit's flags
+    // are final once it is popped, since everything above it that could
+    // reach it has been visited, so the first commit reached from both
+    // sides is the best common ancestor.
+    constexpr uint8_t FROM_FIRST = 1;
+    constexpr uint8_t FROM_SECOND = 2;
+    std::unordered_map<uint32_t, uint8_t> flags;
+    std::priority_queue<std::pair<uint32_t, uint32_t>> queue;
+
+    auto reach = [&](uint32_t node, uint8_t side) {
+        uint8_t& flag = flags[node];
+        if ((flag & side) == 0) {
+            flag |= side;
+            queue.push({nodes[node].generation, node});
+        }
+    };
+    reach(position(first), FROM_FIRST);
+    reach(position(second), FROM_SECOND);
+
+    while (!queue.empty()) {
+        uint32_t node = queue.top().second;
+        queue.pop();
+        uint8_t flag = flags[node];
+        if (flag == (FROM_FIRST | FROM_SECOND)) {
+            return nodes[node].commitId;
+        }
+        for (uint32_t parent : nodes[node].parents) {
+            reach(parent, flag);
+        }
+    }
+    return "";
+}
+
+std::vector<std::string> CommitGraph::commitsSince(const std::string& since, const std::string& head) {
+    update();
+    std::shared_lock<std::shared_mutex> lock(graphMutex);
+
+    // Commits reachable from since are excluded. Walking highest
+    // generation first means a commit is known to be excluded, or not,
+    // by the time it is popped; the walk ends once only excluded commits
+    // are left to visit.
+    constexpr uint8_t WANTED = 1;
+    constexpr uint8_t EXCLUDED = 2;
+    std::unordered_map<uint32_t, uint8_t> flags;
+    std::unordered_set<uint32_t> done;
+    std::priority_queue<std::pair<uint32_t, uint32_t>> queue;
+    size_t wantedPending = 0;
+
+    auto want = [&](uint32_t node) {
+        if (flags[node] == 0) {
+            flags[node] = WANTED;
+            queue.push({nodes[node].generation, node});
+            wantedPending++;
+        }
+    };
+    auto exclude = [&](uint32_t node) {
+        uint8_t& flag = flags[node];
+        if (flag & EXCLUDED) return;
+        if (flag == 0) {
+            queue.push({nodes[node].generation, node});
+        }
+        else if (!done.count(node)) {
+            wantedPending--;
+        }
+        flag |= EXCLUDED;
+    };
+
+    want(position(head));
+    if (!since.empty()) {
+        exclude(position(since));
+    }
+
+    std::vector<std::string> result;
+    while (!queue.empty() && wantedPending > 0) {
+        uint32_t node = queue.top().second;
+        queue.pop();
+        if (!done.insert(node).second) continue;
+
+        if (flags[node] & EXCLUDED) {
+            for (uint32_t parent : nodes[node].parents) exclude(parent);
+        }
+        else {
+            wantedPending--;
+            result.push_back(nodes[node].commitId);
+            for (uint32_t parent : nodes[node].parents) want(parent);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,74 @@
+#ifndef COMMIT_GRAPH_HPP
+#define COMMIT_GRAPH_HPP
+
+#include <string>
+#include <vector>
+#include <array>
+#include <unordered_map>
+#include <shared_mutex>
+#include <cstdint>
+#include "CommitLog.hpp"
+
+// Parent links of every commit, precomputed so ancestry queries never
+// decode commit records. Each commit also gets
+//  - a generation number: 1 for a commit without parents, otherwise one
+//    more than its highest parent. An ancestor always has a lower
+//    generation, so walks stop as soon as they pass the target's.
+//  - a reachability filter: a small bloom filter holding the commit and all
+//    of its ancestors. A commit missing from it is certainly not an
+//    ancestor; on long histories it fills up and the generation cut-off
+//    does the work instead.
+// The graph is kept in an append-only file next to the commit log, in log
+// order, and extended from the log whenever it falls behind.
+class CommitGraph {
+public:
+    static constexpr size_t FILTER_WORDS = 8;
+    using Filter = std::array<uint64_t, FILTER_WORDS>;
+
+private:
+    struct Node {
+        std::string commitId;
+        uint32_t generation;
+        std::vector<uint32_t> parents;
+        Filter reachable;
+    };
+
+    std::string graphPath;
+    CommitLog& commitLog;
+    int graphFd;
+    // End of the last intact record in the graph file
+    uint64_t validEnd;
+    std::vector<Node> nodes;
+    std::unordered_map<std::string, uint32_t> positions;
+    mutable std::shared_mutex graphMutex;
+
+    void open();
+    void readNewRecords();
+    void addNode(Node node);
+    uint32_t position(const std::string& commitId) const;
+
+public:
+    CommitGraph(const std::string& path, CommitLog& log);
+    ~CommitGraph();
+
+    CommitGraph(const CommitGraph&) = delete;
+    CommitGraph& operator=(const CommitGraph&) = delete;
+
+    // Adds commits appended to the log since the last update, by this or
+    // any other process; throws on failure
+    void update();
+
+    // Queries throw if a commit id is unknown
+    uint32_t getGeneration(const std::string& commitId);
+    std::vector<std::string> getParents(const std::string& commitId);
+    // True if ancestor is descendant or one of its ancestors
+    bool isAncestor(const std::string& ancestor, const std::string& descendant);
+    // The common ancestor with the highest generation; empty if the two
+    // histories never meet
+    std::string mergeBase(const std::string& first, const std::string& second);
+    // Commits reachable from head but not from since, newest first; since
+    // may be empty to list all of head's history
+    std::vector<std::string> commitsSince(const std::string& since, const std::string& head);
+};
+
+#endif // COMMIT_GRAPH_HPP
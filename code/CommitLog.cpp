@@ -0,0 +1,435 @@
+#include "CommitLog.hpp"
+#include "ObjectFormat.hpp"
+#include "RecordFile.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <jsoncpp/json/json.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Both files start with an 8-byte magic/version. Index entries are
+// (u32 id length, id, u64 record offset), in log order.
+const char LOG_MAGIC[8] = {'V', 'A', 'U', 'L', 'T', 'C', 'L', 1};
+const char INDEX_MAGIC[8] = {'V', 'A', 'U', 'L', 'T', 'C', 'X', 1};
+constexpr size_t RECORD_HEADER_SIZE = 8;
+
+// Record payload: u8 version, id, message, u64 timestamp, u32 parent count,
+// parent ids, u8 tree flag and, if set, the 32-byte root tree digest, then
+// u32 file count and (path, 32-byte digest) per file; strings are u32
+// length + bytes. Version 1 records have no parents, version 2 no tree.
+constexpr uint8_t RECORD_VERSION = 3;
+
+void appendString(std::string& out, const std::string& value) {
+    char length[4];
+    putUint32(length, static_cast<uint32_t>(value.size()));
+    out.append(length, sizeof(length));
+    out.append(value);
+}
+
+void appendDigest(std::string& out, const ObjectId& id) {
+    out.append(reinterpret_cast<const char*>(id.data()), ObjectId::SIZE);
+}
+
+// Bounds-checked reader over one record's payload
+class Reader {
+private:
+    const char* data;
+    size_t length;
+    size_t offset;
+
+    void need(size_t count) {
+        if (length - offset < count) {
+            throw std::runtime_error("Commit record is truncated");
+        }
+    }
+
+public:
+    Reader(const char* buffer, size_t size) : data(buffer), length(size), offset(0) {}
+
+    uint8_t readUint8() {
+        need(1);
+        return static_cast<uint8_t>(data[offset++]);
+    }
+
+    uint32_t readUint32() {
+        need(4);
+        uint32_t value = getUint32(data + offset);
+        offset += 4;
+        return value;
+    }
+
+    uint64_t readUint64() {
+        need(8);
+        uint64_t value = getUint64(data + offset);
+        offset += 8;
+        return value;
+    }
+
+    std::string readString() {
+        uint32_t count = readUint32();
+        need(count);
+        std::string value(data + offset, count);
+        offset += count;
+        return value;
+    }
+
+    ObjectId readDigest() {
+        need(ObjectId::SIZE);
+        ObjectId id(reinterpret_cast<const unsigned char*>(data + offset));
+        offset += ObjectId::SIZE;
+        return id;
+    }
+};
+
+std::string encodeRecord(const CommitInfo& commit) {
+    std::string payload(1, static_cast<char>(RECORD_VERSION));
+    appendString(payload, commit.commitId);
+    appendString(payload, commit.message);
+    char number[8];
+    putUint64(number, static_cast<uint64_t>(commit.timestamp));
+    payload.append(number, 8);
+    putUint32(number, static_cast<uint32_t>(commit.parents.size()));
+    payload.append(number, 4);
+    for (const auto& parent : commit.parents) {
+        appendString(payload, parent);
+    }
+    payload.push_back(commit.tree.isNull() ? 0 : 1);
+    if (!commit.tree.isNull()) {
+        appendDigest(payload, commit.tree);
+    }
+    putUint32(number, static_cast<uint32_t>(commit.fileHashes.size()));
+    payload.append(number, 4);
+
+    for (const auto& [path, hash] : commit.fileHashes) {
+        appendString(payload, path);
+        appendDigest(payload, hash);
+    }
+
+    char header[RECORD_HEADER_SIZE];
+    putUint32(header, static_cast<uint32_t>(payload.size()));
+    putUint32(header + 4, recordfile::recordChecksum(payload.data(), payload.size()));
+    return std::string(header, sizeof(header)) + payload;
+}
+
+// Rough heap footprint of a decoded commit, for the cache budget
+size_t estimateSize(const CommitInfo& commit) {
+    constexpr size_t NODE_OVERHEAD = 64;
+    size_t bytes = sizeof(CommitInfo) + commit.commitId.size() + commit.message.size();
+    for (const auto& parent : commit.parents) {
+        bytes += sizeof(std::string) + parent.size();
+    }
+    for (const auto& [path, hash] : commit.fileHashes) {
+        bytes += NODE_OVERHEAD + path.size() + sizeof(hash);
+    }
+    return bytes;
+}
+
+} // namespace
+
+CommitLog::CommitLog(const std::string& commitsDirectory)
+    : commitsPath(commitsDirectory),
+      logPath((fs::path(commitsDirectory) / "log").string()),
+      indexPath((fs::path(commitsDirectory) / "log.idx").string()),
+      logFd(-1), indexFd(-1), mapped(nullptr), mappedSize(0),
+      validEnd(recordfile::RECORD_MAGIC_SIZE), indexedEnd(recordfile::RECORD_MAGIC_SIZE),
+      indexSize(recordfile::RECORD_MAGIC_SIZE),
+      commitCache(DEFAULT_CACHE_BYTES) {}
+
+CommitLog::~CommitLog() {
+    if (mapped) munmap(const_cast<char*>(mapped), mappedSize);
+    if (logFd >= 0) ::close(logFd);
+    if (indexFd >= 0) ::close(indexFd);
+}
+
+void CommitLog::open() {
+    if (logFd >= 0) {
+        return;
+    }
+
+    int log = recordfile::openRecordFile(logPath, LOG_MAGIC);
+    try {
+        indexFd = recordfile::openRecordFile(indexPath, INDEX_MAGIC);
+    }
+    catch (...) {
+        ::close(log);
+        throw;
+    }
+    logFd = log;
+}
+
+void CommitLog::remap(size_t size) {
+    if (mapped) {
+        munmap(const_cast<char*>(mapped), mappedSize);
+        mapped = nullptr;
+        mappedSize = 0;
+    }
+    void* region = mmap(nullptr, size, PROT_READ, MAP_SHARED, logFd, 0);
+    if (region == MAP_FAILED) {
+        throw std::runtime_error("Cannot map commit log: " + logPath);
+    }
+    mapped = static_cast<const char*>(region);
+    mappedSize = size;
+}
+
+bool CommitLog::recordEnd(uint64_t offset, bool checked, uint64_t& end) const {
+    if (offset < recordfile::RECORD_MAGIC_SIZE || offset > mappedSize || mappedSize - offset < RECORD_HEADER_SIZE) {
+        return false;
+    }
+    uint32_t length = getUint32(mapped + offset);
+    if (length > mappedSize - offset - RECORD_HEADER_SIZE) {
+        return false;
+    }
+    if (checked && getUint32(mapped + offset + 4) != recordfile::recordChecksum(mapped + offset + RECORD_HEADER_SIZE, length)) {
+        return false;
+    }
+    end = offset + RECORD_HEADER_SIZE + length;
+    return true;
+}
+
+void CommitLog::addRecord(const std::string& commitId, uint64_t offset, uint64_t end) {
+    if (offsets.emplace(commitId, offset).second) {
+        records.emplace_back(commitId, offset);
+    }
+    validEnd = std::max(validEnd, end);
+}
+
+void CommitLog::refresh() {
+    uint64_t logSize = recordfile::fileSize(logFd, logPath);
+    if (logSize != mappedSize) {
+        remap(logSize);
+    }
+
+    // Index entries appended since the last refresh, by any process; a
+    // partly written entry is left for the next append to cut off
+    uint64_t indexFileSize = recordfile::fileSize(indexFd, indexPath);
+    if (indexFileSize > indexSize) {
+        std::string data(indexFileSize - indexSize, '\0');
+        if (pread(indexFd, &data[0], data.size(), indexSize) != static_cast<ssize_t>(data.size())) {
+            throw std::runtime_error("Failed to read commit index: " + indexPath);
+        }
+
+        size_t position = 0;
+        while (data.size() - position >= 4) {
+            uint32_t idLength = getUint32(data.data() + position);
+            if (data.size() - position - 4 < static_cast<uint64_t>(idLength) + 8) break;
+            std::string commitId = data.substr(position + 4, idLength);
+            uint64_t offset = getUint64(data.data() + position + 4 + idLength);
+            uint64_t end;
+            if (!recordEnd(offset, false, end)) break;
+
+            addRecord(commitId, offset, end);
+            indexedEnd = std::max(indexedEnd, end);
+            position += 4 + idLength + 8;
+        }
+        indexSize += position;
+    }
+
+    // Records past the last indexed one were appended by a process that
+    // stopped before updating the index; only checksummed ones count
+    uint64_t end;
+    while (recordEnd(validEnd, true, end)) {
+        Reader reader(mapped + validEnd + RECORD_HEADER_SIZE, end - validEnd - RECORD_HEADER_SIZE);
+        uint8_t version = reader.readUint8();
+        if (version == 0 || version > RECORD_VERSION) break;
+        addRecord(reader.readString(), validEnd, end);
+    }
+}
+
+void CommitLog::decode(uint64_t offset, CommitInfo& commit) const {
+    uint64_t end;
+    if (!recordEnd(offset, true, end)) {
+        throw std::runtime_error("Corrupt commit record at offset " + std::to_string(offset) + " of " + logPath);
+    }
+
+    Reader reader(mapped + offset + RECORD_HEADER_SIZE, end - offset - RECORD_HEADER_SIZE);
+    uint8_t version = reader.readUint8();
+    if (version == 0 || version > RECORD_VERSION) {
+        throw std::runtime_error("Unsupported commit record version in " + logPath);
+    }
+    commit.commitId = reader.readString();
+    commit.message = reader.readString();
+    commit.timestamp = static_cast<std::time_t>(reader.readUint64());
+    commit.parents.clear();
+    if (version >= 2) {
+        uint32_t parentCount = reader.readUint32();
+        for (uint32_t i = 0; i < parentCount; i++) {
+            commit.parents.push_back(reader.readString());
+        }
+    }
+    commit.tree = ObjectId();
+    if (version >= 3 && reader.readUint8() != 0) {
+        commit.tree = reader.readDigest();
+    }
+    commit.fileHashes.clear();
+    uint32_t count = reader.readUint32();
+    for (uint32_t i = 0; i < count; i++) {
+        std::string path = reader.readString();
+        commit.fileHashes[path] = reader.readDigest();
+    }
+}
+
+void CommitLog::append(const CommitInfo& commit) {
+    std::string record = encodeRecord(commit);
+
+    std::unique_lock<std::shared_mutex> lock(logMutex);
+    open();
+    recordfile::FileLock fileLock(logFd);
+    refresh();
+
+    if (offsets.count(commit.commitId)) {
+        throw std::runtime_error("Commit already exists: " + commit.commitId);
+    }
+
+    // Anything past the last intact record is a torn write from a crash
+    if (mappedSize > validEnd && ftruncate(logFd, validEnd) != 0) {
+        throw std::runtime_error("Failed to truncate commit log: " + logPath);
+    }
+    uint64_t offset = validEnd;
+    recordfile::writeAt(logFd, record, offset, logPath);
+    remap(offset + record.size());
+    addRecord(commit.commitId, offset, offset + record.size());
+    // A new commit is usually read back straight away by the graph
+    commitCache.put(commit.commitId, std::make_shared<CommitInfo>(commit), estimateSize(commit));
+
+    // Index every record it is missing, which includes this one and any a
+    // crashed process left unindexed
+    if (recordfile::fileSize(indexFd, indexPath) > indexSize && ftruncate(indexFd, indexSize) != 0) {
+        throw std::runtime_error("Failed to truncate commit index: " + indexPath);
+    }
+    auto first = records.end();
+    while (first != records.begin() && std::prev(first)->second >= indexedEnd) {
+        --first;
+    }
+    std::string entries;
+    for (auto it = first; it != records.end(); ++it) {
+        appendString(entries, it->first);
+        char position[8];
+        putUint64(position, it->second);
+        entries.append(position, sizeof(position));
+    }
+    recordfile::writeAt(indexFd, entries, indexSize, indexPath);
+    indexSize += entries.size();
+    indexedEnd = validEnd;
+}
+
+std::shared_ptr<const CommitInfo> CommitLog::readRecord(const std::string& commitId, uint64_t offset) const {
+    // Records never change once written, so a cached copy cannot go stale
+    if (auto cached = commitCache.get(commitId)) {
+        return cached;
+    }
+    auto decoded = std::make_shared<CommitInfo>();
+    decode(offset, *decoded);
+    commitCache.put(commitId, decoded, estimateSize(*decoded));
+    return decoded;
+}
+
+std::shared_ptr<const CommitInfo> CommitLog::read(const std::string& commitId) {
+    {
+        std::shared_lock<std::shared_mutex> lock(logMutex);
+        auto found = offsets.find(commitId);
+        if (found != offsets.end()) {
+            return readRecord(commitId, found->second);
+        }
+    }
+
+    // A miss is only final once commits appended by others are picked up
+    std::unique_lock<std::shared_mutex> lock(logMutex);
+    open();
+    refresh();
+    auto found = offsets.find(commitId);
+    if (found == offsets.end()) {
+        return nullptr;
+    }
+    return readRecord(commitId, found->second);
+}
+
+bool CommitLog::contains(const std::string& commitId) {
+    std::unique_lock<std::shared_mutex> lock(logMutex);
+    open();
+    refresh();
+    return offsets.count(commitId) > 0;
+}
+
+std::vector<std::string> CommitLog::listCommits(size_t first) {
+    std::unique_lock<std::shared_mutex> lock(logMutex);
+    open();
+    refresh();
+    std::vector<std::string> ids;
+    for (size_t i = first; i < records.size(); i++) {
+        ids.push_back(records[i].first);
+    }
+    return ids;
+}
+
+size_t CommitLog::countCommits() {
+    {
+        std::shared_lock<std::shared_mutex> lock(logMutex);
+        if (logFd >= 0 && recordfile::fileSize(logFd, logPath) == mappedSize) {
+            return records.size();
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> lock(logMutex);
+    open();
+    refresh();
+    return records.size();
+}
+
+CacheStats CommitLog::getCacheStats() const {
+    return commitCache.getStats();
+}
+
+void CommitLog::setCacheCapacity(size_t bytes) {
+    commitCache.setCapacity(bytes);
+}
+
+size_t CommitLog::importLegacyCommits() {
+    std::vector<std::pair<CommitInfo, fs::path>> legacy;
+    for (const auto& entry : fs::directory_iterator(commitsPath)) {
+        fs::path metadataPath = entry.path() / "metadata.json";
+        if (!entry.is_directory() || !fs::exists(metadataPath)) continue;
+
+        std::ifstream metaFile(metadataPath);
+        Json::Value root;
+        Json::CharReaderBuilder reader;
+        JSONCPP_STRING errs;
+        if (!Json::parseFromStream(reader, metaFile, &root, &errs)) {
+            throw std::runtime_error("Failed to parse commit metadata: " + metadataPath.string());
+        }
+
+        CommitInfo commit;
+        commit.commitId = root["commit_id"].asString();
+        commit.message = root["message"].asString();
+        commit.timestamp = static_cast<std::time_t>(root["timestamp"].asInt64());
+        const Json::Value& files = root["files"];
+        for (const auto& name : files.getMemberNames()) {
+            commit.fileHashes[name] = ObjectId::fromHex(files[name].asString());
+        }
+        legacy.emplace_back(std::move(commit), entry.path());
+    }
+
+    std::sort(legacy.begin(), legacy.end(), [](const auto& a, const auto& b) {
+        return a.first.timestamp != b.first.timestamp ? a.first.timestamp < b.first.timestamp
+                                                      : a.first.commitId < b.first.commitId;
+    });
+
+    // The directory only goes once its commit is safely in the log, so an
+    // interrupted import simply resumes
+    size_t imported = 0;
+    for (const auto& [commit, directory] : legacy) {
+        if (!contains(commit.commitId)) {
+            append(commit);
+            imported++;
+        }
+        fs::remove_all(directory);
+    }
+    return imported;
+}
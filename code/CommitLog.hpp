@@ -0,0 +1,97 @@
+#ifndef COMMIT_LOG_HPP
+#define COMMIT_LOG_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <shared_mutex>
+#include <ctime>
+#include <cstdint>
+#include "LruCache.hpp"
+#include "ObjectId.hpp"
+
+struct CommitInfo {
+    std::string commitId;
+    std::string message;
+    std::time_t timestamp;
+    // Files this commit changed, keyed by vault-relative path
+    std::map<std::string, ObjectId> fileHashes;
+    // Commits this one follows on from; empty for the first commit of a
+    // branch and for commits made before parents were recorded
+    std::vector<std::string> parents;
+    // Root tree of the full snapshot; null for commits made before trees
+    ObjectId tree;
+};
+
+// Every commit, stored as one record appended to a single log file:
+//   u32 payload length, u32 CRC-32 of the payload, payload
+// A side index maps each commit id to its record's offset, so a lookup is
+// a hash-table probe plus a decode of that one record from the memory-mapped
+// log. A record cut short by a crash fails its length or checksum check and
+// is cut off by the next append; records the index missed are recovered by
+// scanning the log past the last indexed one.
+class CommitLog {
+private:
+    std::string commitsPath;
+    std::string logPath;
+    std::string indexPath;
+    int logFd;
+    int indexFd;
+    const char* mapped;
+    size_t mappedSize;
+    // End of the last intact record, and of the last one the index covers
+    uint64_t validEnd;
+    uint64_t indexedEnd;
+    // Bytes of the index file holding complete entries
+    uint64_t indexSize;
+    std::unordered_map<std::string, uint64_t> offsets;
+    // Ids and offsets in the order the commits were appended
+    std::vector<std::pair<std::string, uint64_t>> records;
+    mutable std::shared_mutex logMutex;
+    // Decoded records, shared by lookups that come back to the same commits
+    mutable LruCache<std::string, CommitInfo> commitCache;
+
+    void open();
+    void refresh();
+    void remap(size_t size);
+    void addRecord(const std::string& commitId, uint64_t offset, uint64_t end);
+    // Finds where the record at offset ends; false if it runs past the end
+    // of the log or, when checked, fails its checksum
+    bool recordEnd(uint64_t offset, bool checked, uint64_t& end) const;
+    void decode(uint64_t offset, CommitInfo& commit) const;
+    std::shared_ptr<const CommitInfo> readRecord(const std::string& commitId, uint64_t offset) const;
+
+public:
+    static constexpr size_t DEFAULT_CACHE_BYTES = 8 * 1024 * 1024;
+
+    explicit CommitLog(const std::string& commitsDirectory);
+    ~CommitLog();
+
+    CommitLog(const CommitLog&) = delete;
+    CommitLog& operator=(const CommitLog&) = delete;
+
+    // Appends the commit and flushes it to disk; throws on failure or if a
+    // commit with the same id exists
+    void append(const CommitInfo& commit);
+    // The commit, or null if the log does not hold it; throws if its record
+    // is damaged. Records never change, so the cached copy is shared.
+    std::shared_ptr<const CommitInfo> read(const std::string& commitId);
+    bool contains(const std::string& commitId);
+    // Commit ids, oldest first, skipping the first `first` of them
+    std::vector<std::string> listCommits(size_t first = 0);
+    // Number of commits in the log; only takes the shared lock when the log
+    // has not grown since it was last read
+    size_t countCommits();
+
+    CacheStats getCacheStats() const;
+    void setCacheCapacity(size_t bytes);
+
+    // Moves commits written by older versions as <id>/metadata.json
+    // directories into the log, oldest first, and returns how many moved;
+    // throws on failure
+    size_t importLegacyCommits();
+};
+
+#endif // COMMIT_LOG_HPP
@@ -3,10 +3,38 @@
 #include <iomanip>
 #include <iostream>
 #include <algorithm>
-#include <jsoncpp/json/json.h>
 #include <filesystem>
 #include <chrono>
 #include <random>
+#include <set>
+
+CommitManager::CommitManager(CommitLog& log,
+                             HistoryIndex& history,
+                             FileManager& fm,
+                             BranchManager& bm,
+                             TreeManager& tm,
+                             StagingIndex& index,
+                             const std::string& workTreePath)
+    : commitLog(log),
+      historyIndex(history),
+      fileManager(fm),
+      branchManager(bm),
+      treeManager(tm),
+      workTree(fs::absolute(workTreePath).lexically_normal()),
+      stagingIndex(index),
+      ingestThreads(ThreadPool::defaultThreadCount()) {
+    if (!workTree.has_filename()) {
+        workTree = workTree.parent_path();
+    }
+}
+
+std::string CommitManager::toVaultPath(const std::string& filePath) const {
+    fs::path relative = fs::absolute(filePath).lexically_normal().lexically_relative(workTree);
+    if (relative.empty() || *relative.begin() == "..") {
+        return fs::path(filePath).filename().string();
+    }
+    return relative.generic_string();
+}
 
 std::string CommitManager::createCommitId() {
     auto now = std::chrono::system_clock::now();
@@ -23,135 +51,200 @@ std::string CommitManager::createCommitId() {
 
 bool CommitManager::saveCommitInfo(const CommitInfo& commit) {
     try {
+        commitLog.append(commit);
+        return true;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error saving commit info: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+std::vector<ObjectId> CommitManager::findDeltaBases(const std::vector<std::string>& paths) {
+    std::string currentBranch = branchManager.getCurrentBranch();
+    std::string parent = branchManager.getBranchHead(currentBranch);
+    std::shared_ptr<const CommitInfo> parentCommit;
+    if (!parent.empty() && (parentCommit = commitLog.read(parent)) && !parentCommit->tree.isNull()) {
+        return treeManager.lookup(parentCommit->tree, paths);
+    }
 
-        fs::path commitPath = fs::path(vaultPath) / COMMITS_DIR / commit.commitId;
-        fs::create_directories(commitPath);
-
-        Json::Value root;
-        root["commit_id"] = commit.commitId;
-        root["message"] = commit.message;
-        root["timestamp"] = Json::Value::Int64(commit.timestamp);
-        
-        Json::Value files;
-        for (const auto& [file, hash] : commit.fileHashes) {
-            files[file] = hash;
+    // Commits from before snapshots have no tree; the branch state is the
+    // closest record of what they held
+    auto branchState = branchManager.getBranchState(currentBranch);
+    std::vector<ObjectId> bases(paths.size());
+    for (size_t i = 0; i < paths.size(); i++) {
+        auto previous = branchState->find(paths[i]);
+        if (previous != branchState->end()) {
+            bases[i] = previous->second;
         }
-        root["files"] = files;
+    }
+    return bases;
+}
 
-        std::ofstream metaFile(commitPath / "metadata.json");
-        if (!metaFile.is_open()) {
+bool CommitManager::stageFile(const std::string& filePath) {
+    return stageFiles({filePath});
+}
+
+bool CommitManager::stageFiles(const std::vector<std::string>& filePaths) {
+    for (const auto& filePath : filePaths) {
+        if (!fileManager.fileExists(filePath)) {
+            std::cerr << "File does not exist: " << filePath << std::endl;
             return false;
         }
+    }
 
-        Json::StreamWriterBuilder writer;
-        std::string jsonString = Json::writeString(writer, root);
-        metaFile << jsonString;
+    try {
+        // A file listed more than once only needs to be ingested once
+        std::vector<StagedFile> staged;
+        std::set<std::string> seen;
+        for (const auto& filePath : filePaths) {
+            std::string path = toVaultPath(filePath);
+            if (seen.insert(path).second) {
+                staged.push_back({path, filePath, ObjectId()});
+            }
+        }
+
+        std::vector<std::string> paths;
+        for (const auto& file : staged) {
+            paths.push_back(file.path);
+        }
+        std::vector<ObjectId> bases = findDeltaBases(paths);
+
+        // Hash and store concurrently; each worker writes only its own slot
+        // so no locking is needed around the results
+        ThreadPool pool(std::min(ingestThreads, staged.size()));
+        pool.parallelFor(staged.size(), [&](size_t i) {
+            staged[i].hash = fileManager.ingestFile(staged[i].sourcePath, bases[i]);
+        });
+
+        stagingIndex.stage(staged);
+        for (const auto& file : staged) {
+            std::cout << "File staged for commit: " << file.sourcePath << std::endl;
+        }
         return true;
     }
     catch (const std::exception& e) {
-        std::cerr << "Error saving commit info: " << e.what() << std::endl;
+        std::cerr << "Error staging file: " << e.what() << std::endl;
         return false;
     }
 }
 
-bool CommitManager::stageFile(const std::string& filePath) {
-    if (!fileManager.fileExists(filePath)) {
-        std::cerr << "File does not exist: " << filePath << std::endl;
-        return false;
+std::string CommitManager::writeCommit(const std::string& message, const std::vector<std::string>& extraParents,
+                                       const std::map<std::string, ObjectId>& changes) {
+    CommitInfo commit;
+    commit.commitId = createCommitId();
+    commit.message = message;
+    commit.timestamp = std::time(nullptr);
+
+    std::string currentBranch = branchManager.getCurrentBranch();
+    std::string parent = branchManager.getBranchHead(currentBranch);
+    if (!parent.empty()) {
+        commit.parents.push_back(parent);
     }
-    
-    stagedFiles.push_back(filePath);
-    std::cout << "File staged for commit: " << filePath << std::endl;
-    return true;
+    commit.parents.insert(commit.parents.end(), extraParents.begin(), extraParents.end());
+
+    for (const auto& [path, hash] : changes) {
+        if (!hash.isNull()) {
+            commit.fileHashes[path] = hash;
+        }
+    }
+
+    // The new snapshot is the parent's with the changed paths replaced
+    ObjectId baseTree;
+    if (!parent.empty()) {
+        if (auto parentCommit = commitLog.read(parent)) {
+            baseTree = parentCommit->tree;
+        }
+    }
+
+    // Only the trees along the changed paths are written. Commits from
+    // before snapshots have no tree; the branch state is the closest
+    // record of what they held.
+    std::map<std::string, ObjectId> treeChanges;
+    if (baseTree.isNull()) {
+        treeChanges = *branchManager.getBranchState(currentBranch);
+    }
+    for (const auto& [path, hash] : changes) {
+        treeChanges[path] = hash;
+    }
+    commit.tree = treeManager.writeTree(baseTree, treeChanges);
+
+    // Save commit information
+    if (!saveCommitInfo(commit)) {
+        throw std::runtime_error("Failed to save commit information");
+    }
+
+    // Only the changed paths are added to the branch state
+    if (!branchManager.updateBranchState(currentBranch, changes)) {
+        throw std::runtime_error("Failed to update branch state");
+    }
+
+    if (!branchManager.switchBranch(currentBranch, commit.commitId)) {
+        throw std::runtime_error("Failed to update branch HEAD");
+    }
+
+    std::cout << "Created commit " << commit.commitId << " on branch " << currentBranch << std::endl;
+    return commit.commitId;
 }
 
 bool CommitManager::commit(const std::string& message) {
     try {
-        if (stagedFiles.empty()) {
+        // Staged files were stored when staged, so nothing is read again
+        std::vector<StagedFile> staged = stagingIndex.list();
+        if (staged.empty()) {
             std::cerr << "No files staged for commit" << std::endl;
             return false;
         }
 
-        // Create commit info
-        CommitInfo commit;
-        commit.commitId = createCommitId();
-        commit.message = message;
-        commit.timestamp = std::time(nullptr);
-
-        // Process each staged file
-        for (const auto& file : stagedFiles) {
-            std::string hash = fileManager.calculateFileHash(file);
-            if (!fileManager.storeFileContent(file, hash)) {
-                throw std::runtime_error("Failed to store file content: " + file);
-            }
-            
-            // Store relative path in commit
-            fs::path filePath(file);
-            std::string relativePath = filePath.filename().string();
-            commit.fileHashes[relativePath] = hash;
+        std::map<std::string, ObjectId> changes;
+        for (const auto& file : staged) {
+            changes[file.path] = file.hash;
         }
+        writeCommit(message, {}, changes);
 
-        // Save commit information
-        if (!saveCommitInfo(commit)) {
-            throw std::runtime_error("Failed to save commit information");
-        }
-
-        // Update branch state and HEAD
-        std::string currentBranch = branchManager.getCurrentBranch();
-        
-        // Update the branch state with relative paths
-        if (!branchManager.saveBranchState(currentBranch, commit.fileHashes)) {
-            throw std::runtime_error("Failed to update branch state");
-        }
+        // Files restaged while this commit was being written stay staged
+        stagingIndex.unstage(staged);
+        return true;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Commit failed: " << e.what() << std::endl;
+        return false;
+    }
+}
 
-        if (!branchManager.switchBranch(currentBranch, commit.commitId)) {
-            throw std::runtime_error("Failed to update branch HEAD");
+bool CommitManager::commitMerge(const std::string& mergedCommit, const std::vector<FileChange>& changes,
+                                const std::string& message) {
+    try {
+        std::map<std::string, ObjectId> changeMap;
+        for (const auto& change : changes) {
+            changeMap[change.path] = change.to;
         }
-
-        std::cout << "Created commit " << commit.commitId << " on branch " << currentBranch << std::endl;
-
-        // Clear staged files after successful commit
-        stagedFiles.clear();
+        writeCommit(message, {mergedCommit}, changeMap);
         return true;
     }
     catch (const std::exception& e) {
-        std::cerr << "Commit failed: " << e.what() << std::endl;
+        std::cerr << "Merge commit failed: " << e.what() << std::endl;
         return false;
     }
 }
+
 std::vector<FileVersion> CommitManager::getFileHistory(const std::string& filePath) {
+    return getFileHistory(filePath, 0, SIZE_MAX);
+}
+
+std::vector<FileVersion> CommitManager::getFileHistory(const std::string& filePath, size_t skip, size_t limit) {
     std::vector<FileVersion> history;
-    fs::path commitsDir = fs::path(vaultPath) / COMMITS_DIR;
     
     try {
-
-        for (const auto& entry : fs::directory_iterator(commitsDir)) {
-            if (!entry.is_directory()) continue;
-            
-            fs::path metadataPath = entry.path() / "metadata.json";
-            if (!fs::exists(metadataPath)) continue;
-
-            std::ifstream metaFile(metadataPath);
-            Json::Value root;
-            Json::CharReaderBuilder reader;
-            JSONCPP_STRING errs;
-            
-            if (Json::parseFromStream(reader, metaFile, &root, &errs)) {
-                const Json::Value& files = root["files"];
-                if (files.isMember(filePath)) {
-                    FileVersion version;
-                    version.hash = files[filePath].asString();
-                    version.timestamp = root["timestamp"].asString();
-                    version.message = root["message"].asString();
-                    history.push_back(version);
-                }
-            }
-        }
-        
-        std::sort(history.begin(), history.end(), 
-                 [](const FileVersion& a, const FileVersion& b) {
-                     return std::stoll(a.timestamp) > std::stoll(b.timestamp);
-                 });
+        historyIndex.forEachVersion(filePath, [&](const HistoryEntry& entry) {
+            FileVersion version;
+            version.hash = entry.hash.toHex();
+            version.timestamp = std::to_string(entry.timestamp);
+            version.message = entry.message;
+            version.commitId = entry.commitId;
+            history.push_back(version);
+            return true;
+        }, skip, limit);
     }
     catch (const std::exception& e) {
         std::cerr << "Error getting file history: " << e.what() << std::endl;
@@ -160,29 +253,34 @@ std::vector<FileVersion> CommitManager::getFileHistory(const std::string& filePa
     return history;
 }
 
+bool CommitManager::hasFileHistory(const std::string& filePath) {
+    try {
+        return historyIndex.countVersions(filePath) > 0;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error getting file history: " << e.what() << std::endl;
+        return false;
+    }
+}
+
 bool CommitManager::checkoutFile(const std::string& filePath, const std::string& commitId) {
     try {
-        fs::path commitPath = fs::path(vaultPath) / COMMITS_DIR / commitId / "metadata.json";
-        if (!fs::exists(commitPath)) {
+        auto commit = commitLog.read(commitId);
+        if (!commit) {
             throw std::runtime_error("Commit does not exist: " + commitId);
         }
 
-        std::ifstream metaFile(commitPath);
-        Json::Value root;
-        Json::CharReaderBuilder reader;
-        JSONCPP_STRING errs;
-        
-        if (!Json::parseFromStream(reader, metaFile, &root, &errs)) {
-            throw std::runtime_error("Failed to parse commit metadata: " + errs);
-        }
-
-        const Json::Value& files = root["files"];
-        if (!files.isMember(filePath)) {
-            throw std::runtime_error("File not found in commit: " + filePath);
+        // The snapshot also holds files the commit did not change
+        ObjectId hash;
+        if (commit->tree.isNull() || !treeManager.lookup(commit->tree, filePath, hash)) {
+            auto file = commit->fileHashes.find(filePath);
+            if (file == commit->fileHashes.end()) {
+                throw std::runtime_error("File not found in commit: " + filePath);
+            }
+            hash = file->second;
         }
 
-        std::string fileHash = files[filePath].asString();
-        if (!fileManager.copyFileFromObjects(fileHash, filePath)) {
+        if (!fileManager.copyFileFromObjects(hash, filePath)) {
             throw std::runtime_error("Failed to restore file from objects");
         }
 
@@ -195,5 +293,18 @@ bool CommitManager::checkoutFile(const std::string& filePath, const std::string&
 }
 
 std::vector<std::string> CommitManager::getStagedFiles() const {
-    return stagedFiles;
+    std::vector<std::string> files;
+    try {
+        for (const auto& file : stagingIndex.list()) {
+            files.push_back(file.sourcePath);
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error reading staging index: " << e.what() << std::endl;
+    }
+    return files;
+}
+
+void CommitManager::setIngestThreads(size_t threadCount) {
+    ingestThreads = threadCount == 0 ? 1 : threadCount;
 }
\ No newline at end of file
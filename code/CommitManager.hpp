@@ -7,46 +7,73 @@
 #include <ctime>
 #include "FileManager.hpp"
 #include "BranchManager.hpp"
-
-struct CommitInfo {
-    std::string commitId;
-    std::string message;
-    std::time_t timestamp;
-    std::map<std::string, std::string> fileHashes;
-};
+#include "ThreadPool.hpp"
+#include "CommitLog.hpp"
+#include "HistoryIndex.hpp"
+#include "TreeManager.hpp"
+#include "StagingIndex.hpp"
 
 struct FileVersion {
     std::string hash;
     std::string timestamp;
     std::string message;
+    std::string commitId;
 };
 
 class CommitManager {
 private:
-    std::string vaultPath;
-    const std::string COMMITS_DIR;
+    CommitLog& commitLog;
+    HistoryIndex& historyIndex;
     FileManager& fileManager;
     BranchManager& branchManager;
-    std::vector<std::string> stagedFiles;
+    TreeManager& treeManager;
+    // Absolute, normalised root that commit paths are relative to
+    fs::path workTree;
+    // Files are stored when staged; commit reads their objects from here
+    StagingIndex& stagingIndex;
+    size_t ingestThreads;
 
     std::string createCommitId();
+    // Records a commit on the current branch whose snapshot is the branch
+    // head's with changes applied (a null id removes the path), and moves
+    // the branch to it; returns its id. Throws on failure.
+    std::string writeCommit(const std::string& message, const std::vector<std::string>& extraParents,
+                            const std::map<std::string, ObjectId>& changes);
+    // The object each path holds in the current branch head, which a new
+    // version can be stored as a delta against; null for new paths
+    std::vector<ObjectId> findDeltaBases(const std::vector<std::string>& paths);
     bool saveCommitInfo(const CommitInfo& commit);
 
 public:
-    CommitManager(const std::string& basePath, 
-                 const std::string& commitsDir,
+    CommitManager(CommitLog& log,
+                 HistoryIndex& history,
                  FileManager& fm,
-                 BranchManager& bm)
-        : vaultPath(basePath), 
-          COMMITS_DIR(commitsDir),
-          fileManager(fm),
-          branchManager(bm) {}
+                 BranchManager& bm,
+                 TreeManager& tm,
+                 StagingIndex& index,
+                 const std::string& workTreePath);
 
+    // Hashes and stores the files now, so commit does not read them again.
+    // Safe to call from several threads at once.
     bool stageFile(const std::string& filePath);
+    bool stageFiles(const std::vector<std::string>& filePaths);
     bool commit(const std::string& message);
+    // Commits the result of merging mergedCommit into the current branch:
+    // changes take the branch head to the merged snapshot, and both are
+    // recorded as parents
+    bool commitMerge(const std::string& mergedCommit, const std::vector<FileChange>& changes,
+                     const std::string& message);
+    // Versions of filePath, newest first; the second form returns one page
     std::vector<FileVersion> getFileHistory(const std::string& filePath);
+    std::vector<FileVersion> getFileHistory(const std::string& filePath, size_t skip, size_t limit);
+    bool hasFileHistory(const std::string& filePath);
     bool checkoutFile(const std::string& filePath, const std::string& commitId);
+    // The path commits record for filePath: relative to the work tree with
+    // '/' separators, or just the file name for files outside it
+    std::string toVaultPath(const std::string& filePath) const;
+    // Paths the staged files were staged from, sorted by vault path
     std::vector<std::string> getStagedFiles() const;
+    void setIngestThreads(size_t threadCount);
 };
 
 #endif // COMMIT_MANAGER_HPP
\ No newline at end of file
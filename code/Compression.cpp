@@ -0,0 +1,286 @@
+#include "Compression.hpp"
+#include <stdexcept>
+#include <algorithm>
+#include <zlib.h>
+#ifdef VAULT_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+
+constexpr size_t OUTPUT_BUFFER_SIZE = 256 * 1024;
+
+// Objects that shrink by less than this are stored uncompressed; the CPU
+// spent decompressing them on every checkout would buy almost nothing
+constexpr double MAX_COMPRESSED_RATIO = 0.9;
+
+class ZlibCompressor : public Compressor {
+private:
+    z_stream stream;
+    std::vector<char> output;
+
+    void run(int flush, const ObjectSink& sink) {
+        do {
+            stream.next_out = reinterpret_cast<Bytef*>(output.data());
+            stream.avail_out = static_cast<uInt>(output.size());
+            int result = deflate(&stream, flush);
+            if (result == Z_STREAM_ERROR) {
+                throw std::runtime_error("zlib compression failed");
+            }
+            size_t produced = output.size() - stream.avail_out;
+            if (produced > 0) {
+                sink(output.data(), produced);
+            }
+        } while (stream.avail_out == 0);
+    }
+
+public:
+    explicit ZlibCompressor(int level) : stream(), output(OUTPUT_BUFFER_SIZE) {
+        if (deflateInit(&stream, level == 0 ? Z_DEFAULT_COMPRESSION : level) != Z_OK) {
+            throw std::runtime_error("Failed to initialize zlib compression");
+        }
+    }
+
+    ~ZlibCompressor() override {
+        deflateEnd(&stream);
+    }
+
+    void update(const char* data, size_t length, const ObjectSink& sink) override {
+        // avail_in is 32-bit, so very large buffers are fed in slices
+        while (length > 0) {
+            uInt slice = static_cast<uInt>(std::min<size_t>(length, 1u << 30));
+            stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+            stream.avail_in = slice;
+            run(Z_NO_FLUSH, sink);
+            data += slice;
+            length -= slice;
+        }
+    }
+
+    void finish(const ObjectSink& sink) override {
+        stream.next_in = nullptr;
+        stream.avail_in = 0;
+        run(Z_FINISH, sink);
+    }
+};
+
+class ZlibDecompressor : public Decompressor {
+private:
+    z_stream stream;
+    std::vector<char> output;
+    bool ended;
+
+public:
+    ZlibDecompressor() : stream(), output(OUTPUT_BUFFER_SIZE), ended(false) {
+        if (inflateInit(&stream) != Z_OK) {
+            throw std::runtime_error("Failed to initialize zlib decompression");
+        }
+    }
+
+    ~ZlibDecompressor() override {
+        inflateEnd(&stream);
+    }
+
+    void update(const char* data, size_t length, const ObjectSink& sink) override {
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        stream.avail_in = static_cast<uInt>(length);
+
+        while (true) {
+            if (ended) {
+                if (stream.avail_in > 0) {
+                    throw std::runtime_error("Trailing data after compressed stream");
+                }
+                return;
+            }
+
+            stream.next_out = reinterpret_cast<Bytef*>(output.data());
+            stream.avail_out = static_cast<uInt>(output.size());
+            int result = inflate(&stream, Z_NO_FLUSH);
+            if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+                throw std::runtime_error("Corrupt zlib stream");
+            }
+            size_t produced = output.size() - stream.avail_out;
+            if (produced > 0) {
+                sink(output.data(), produced);
+            }
+
+            if (result == Z_STREAM_END) {
+                ended = true;
+            }
+            else if (stream.avail_in == 0 && stream.avail_out > 0) {
+                // All input consumed and nothing left buffered
+                return;
+            }
+        }
+    }
+
+    void finish() override {
+        if (!ended) {
+            throw std::runtime_error("Truncated zlib stream");
+        }
+    }
+};
+
+#ifdef VAULT_HAVE_ZSTD
+class ZstdCompressor : public Compressor {
+private:
+    ZSTD_CCtx* ctx;
+    std::vector<char> output;
+
+    void run(const char* data, size_t length, ZSTD_EndDirective mode, const ObjectSink& sink) {
+        ZSTD_inBuffer input = {data, length, 0};
+        bool done = false;
+        while (!done) {
+            ZSTD_outBuffer out = {output.data(), output.size(), 0};
+            size_t remaining = ZSTD_compressStream2(ctx, &out, &input, mode);
+            if (ZSTD_isError(remaining)) {
+                throw std::runtime_error(std::string("zstd compression failed: ") + ZSTD_getErrorName(remaining));
+            }
+            if (out.pos > 0) {
+                sink(output.data(), out.pos);
+            }
+            done = mode == ZSTD_e_end ? remaining == 0 : input.pos == input.size;
+        }
+    }
+
+public:
+    explicit ZstdCompressor(int level) : ctx(ZSTD_createCCtx()), output(ZSTD_CStreamOutSize()) {
+        if (!ctx) {
+            throw std::runtime_error("Failed to initialize zstd compression");
+        }
+        ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel, level == 0 ? ZSTD_CLEVEL_DEFAULT : level);
+        ZSTD_CCtx_setParameter(ctx, ZSTD_c_checksumFlag, 1);
+    }
+
+    ~ZstdCompressor() override {
+        ZSTD_freeCCtx(ctx);
+    }
+
+    void update(const char* data, size_t length, const ObjectSink& sink) override {
+        run(data, length, ZSTD_e_continue, sink);
+    }
+
+    void finish(const ObjectSink& sink) override {
+        run(nullptr, 0, ZSTD_e_end, sink);
+    }
+};
+
+class ZstdDecompressor : public Decompressor {
+private:
+    ZSTD_DCtx* ctx;
+    std::vector<char> output;
+    size_t lastResult;
+
+public:
+    ZstdDecompressor() : ctx(ZSTD_createDCtx()), output(ZSTD_DStreamOutSize()), lastResult(1) {
+        if (!ctx) {
+            throw std::runtime_error("Failed to initialize zstd decompression");
+        }
+    }
+
+    ~ZstdDecompressor() override {
+        ZSTD_freeDCtx(ctx);
+    }
+
+    void update(const char* data, size_t length, const ObjectSink& sink) override {
+        ZSTD_inBuffer input = {data, length, 0};
+        // A full output buffer may mean the decoder still holds output
+        bool outputFull = true;
+        while (input.pos < input.size || outputFull) {
+            ZSTD_outBuffer out = {output.data(), output.size(), 0};
+            lastResult = ZSTD_decompressStream(ctx, &out, &input);
+            if (ZSTD_isError(lastResult)) {
+                throw std::runtime_error(std::string("Corrupt zstd stream: ") + ZSTD_getErrorName(lastResult));
+            }
+            if (out.pos > 0) {
+                sink(output.data(), out.pos);
+            }
+            outputFull = out.pos == out.size;
+        }
+    }
+
+    void finish() override {
+        // A non-zero hint means the decoder still expects more input
+        if (lastResult != 0) {
+            throw std::runtime_error("Truncated zstd stream");
+        }
+    }
+};
+#endif
+
+} // namespace
+
+std::string compressionCodecName(CompressionCodec codec) {
+    switch (codec) {
+        case CompressionCodec::None: return "none";
+        case CompressionCodec::Zlib: return "zlib";
+        case CompressionCodec::Zstd: return "zstd";
+    }
+    return "unknown";
+}
+
+bool parseCompressionCodec(const std::string& name, CompressionCodec& codec) {
+    for (CompressionCodec candidate : {CompressionCodec::None, CompressionCodec::Zlib, CompressionCodec::Zstd}) {
+        if (compressionCodecName(candidate) == name) {
+            codec = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool isCompressionCodecAvailable(CompressionCodec codec) {
+    switch (codec) {
+        case CompressionCodec::None:
+        case CompressionCodec::Zlib:
+            return true;
+        case CompressionCodec::Zstd:
+#ifdef VAULT_HAVE_ZSTD
+            return true;
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+std::unique_ptr<Compressor> Compressor::create(CompressionCodec codec, int level) {
+    switch (codec) {
+        case CompressionCodec::Zlib:
+            return std::make_unique<ZlibCompressor>(level);
+#ifdef VAULT_HAVE_ZSTD
+        case CompressionCodec::Zstd:
+            return std::make_unique<ZstdCompressor>(level);
+#endif
+        default:
+            throw std::runtime_error("Compression codec not available: " + compressionCodecName(codec));
+    }
+}
+
+std::unique_ptr<Decompressor> Decompressor::create(CompressionCodec codec) {
+    switch (codec) {
+        case CompressionCodec::Zlib:
+            return std::make_unique<ZlibDecompressor>();
+#ifdef VAULT_HAVE_ZSTD
+        case CompressionCodec::Zstd:
+            return std::make_unique<ZstdDecompressor>();
+#endif
+        default:
+            throw std::runtime_error("Compression codec not available: " + compressionCodecName(codec));
+    }
+}
+
+bool isWorthCompressing(CompressionCodec codec, int level, const char* data, size_t length) {
+    if (codec == CompressionCodec::None || length == 0) {
+        return false;
+    }
+
+    size_t sampleLength = std::min(length, COMPRESSION_SAMPLE_SIZE);
+    size_t compressedLength = 0;
+    auto compressor = Compressor::create(codec, level);
+    auto count = [&](const char*, size_t produced) { compressedLength += produced; };
+    compressor->update(data, sampleLength, count);
+    compressor->finish(count);
+
+    return compressedLength + ObjectHeader::ENCODED_SIZE < sampleLength * MAX_COMPRESSED_RATIO;
+}
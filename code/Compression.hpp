@@ -0,0 +1,50 @@
+#ifndef COMPRESSION_HPP
+#define COMPRESSION_HPP
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include "ObjectFormat.hpp"
+
+// Codec identifiers are stored in object headers and must never be reused
+enum class CompressionCodec : uint8_t {
+    None = 0,
+    Zlib = 1,
+    Zstd = 2
+};
+
+std::string compressionCodecName(CompressionCodec codec);
+bool parseCompressionCodec(const std::string& name, CompressionCodec& codec);
+bool isCompressionCodecAvailable(CompressionCodec codec);
+
+// Streaming compressor; output is handed to the sink as it is produced
+class Compressor {
+public:
+    virtual ~Compressor() = default;
+    virtual void update(const char* data, size_t length, const ObjectSink& sink) = 0;
+    virtual void finish(const ObjectSink& sink) = 0;
+
+    // level 0 selects the codec's default
+    static std::unique_ptr<Compressor> create(CompressionCodec codec, int level);
+};
+
+class Decompressor {
+public:
+    virtual ~Decompressor() = default;
+    virtual void update(const char* data, size_t length, const ObjectSink& sink) = 0;
+    // Throws if the compressed stream ended early
+    virtual void finish() = 0;
+
+    static std::unique_ptr<Decompressor> create(CompressionCodec codec);
+};
+
+// Only this much of the data is test-compressed when deciding whether to
+// compress an object at all
+constexpr size_t COMPRESSION_SAMPLE_SIZE = 64 * 1024;
+
+// Compresses a leading sample of the data and reports whether the result is
+// small enough to be worth storing compressed
+bool isWorthCompressing(CompressionCodec codec, int level, const char* data, size_t length);
+
+#endif // COMPRESSION_HPP
@@ -0,0 +1,139 @@
+#include "Delta.hpp"
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+const char OP_INSERT = 0x00;
+const char OP_COPY = 0x01;
+
+// Hash of the MIN_MATCH bytes at data; only used to find candidate matches,
+// which are always confirmed with memcmp
+uint64_t blockHash(const char* data) {
+    uint64_t a, b;
+    std::memcpy(&a, data, 8);
+    std::memcpy(&b, data + 8, 8);
+    uint64_t h = a * 0x9e3779b97f4a7c15ULL ^ b * 0xc2b2ae3d27d4eb4fULL;
+    return h ^ (h >> 29);
+}
+
+void putVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+uint64_t getVarint(const char* data, size_t length, size_t& offset) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (offset >= length) {
+            throw std::runtime_error("Corrupt delta: truncated instruction");
+        }
+        unsigned char byte = static_cast<unsigned char>(data[offset++]);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+    throw std::runtime_error("Corrupt delta: oversized varint");
+}
+
+void emitInsert(std::string& out, const char* data, size_t length) {
+    if (length == 0) {
+        return;
+    }
+    out.push_back(OP_INSERT);
+    putVarint(out, length);
+    out.append(data, length);
+}
+
+} // namespace
+
+std::string Delta::create(const char* base, size_t baseLength,
+                          const char* target, size_t targetLength) {
+    std::string delta;
+    if (baseLength < MIN_MATCH || targetLength < MIN_MATCH || baseLength >= UINT32_MAX) {
+        emitInsert(delta, target, targetLength);
+        return delta;
+    }
+
+    // Index the base at block boundaries; the target is scanned at every
+    // offset, so any match at least two blocks long is found
+    size_t blocks = baseLength / MIN_MATCH;
+    size_t tableSize = 1;
+    while (tableSize < blocks * 2) tableSize <<= 1;
+    std::vector<uint32_t> table(tableSize, 0);
+    for (size_t i = 0; i + MIN_MATCH <= baseLength; i += MIN_MATCH) {
+        uint32_t& slot = table[blockHash(base + i) & (tableSize - 1)];
+        if (slot == 0) {
+            slot = static_cast<uint32_t>(i + 1);
+        }
+    }
+
+    size_t position = 0;
+    size_t literalStart = 0;
+    while (position + MIN_MATCH <= targetLength) {
+        uint32_t slot = table[blockHash(target + position) & (tableSize - 1)];
+        if (slot == 0 || std::memcmp(base + slot - 1, target + position, MIN_MATCH) != 0) {
+            position++;
+            continue;
+        }
+
+        size_t matchBase = slot - 1;
+        size_t matchTarget = position;
+
+        // Grow the match backwards over pending literals, then forwards
+        while (matchTarget > literalStart && matchBase > 0 &&
+               base[matchBase - 1] == target[matchTarget - 1]) {
+            matchBase--;
+            matchTarget--;
+        }
+        size_t length = position - matchTarget + MIN_MATCH;
+        while (matchTarget + length < targetLength && matchBase + length < baseLength &&
+               base[matchBase + length] == target[matchTarget + length]) {
+            length++;
+        }
+
+        emitInsert(delta, target + literalStart, matchTarget - literalStart);
+        delta.push_back(OP_COPY);
+        putVarint(delta, matchBase);
+        putVarint(delta, length);
+
+        position = matchTarget + length;
+        literalStart = position;
+    }
+
+    emitInsert(delta, target + literalStart, targetLength - literalStart);
+    return delta;
+}
+
+void Delta::apply(const char* base, size_t baseLength,
+                  const char* delta, size_t deltaLength, const ObjectSink& sink) {
+    size_t offset = 0;
+    while (offset < deltaLength) {
+        char op = delta[offset++];
+        if (op == OP_INSERT) {
+            uint64_t length = getVarint(delta, deltaLength, offset);
+            if (length > deltaLength - offset) {
+                throw std::runtime_error("Corrupt delta: insert past end");
+            }
+            sink(delta + offset, length);
+            offset += length;
+        }
+        else if (op == OP_COPY) {
+            uint64_t start = getVarint(delta, deltaLength, offset);
+            uint64_t length = getVarint(delta, deltaLength, offset);
+            if (start > baseLength || length > baseLength - start) {
+                throw std::runtime_error("Corrupt delta: copy outside base");
+            }
+            sink(base + start, length);
+        }
+        else {
+            throw std::runtime_error("Corrupt delta: unknown instruction");
+        }
+    }
+}
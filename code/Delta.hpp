@@ -0,0 +1,27 @@
+#ifndef DELTA_HPP
+#define DELTA_HPP
+
+#include <string>
+#include <cstddef>
+#include "ObjectFormat.hpp"
+
+// Binary delta between two versions of a file, in the spirit of VCDIFF: a
+// sequence of instructions that either copy a range of the base or insert
+// literal bytes. Instructions are an opcode followed by LEB128 varints:
+//   0x00 length bytes...   insert the next length bytes
+//   0x01 offset length     copy length bytes of the base starting at offset
+class Delta {
+public:
+    // Shortest run of matching bytes worth encoding as a copy
+    static constexpr size_t MIN_MATCH = 16;
+
+    static std::string create(const char* base, size_t baseLength,
+                              const char* target, size_t targetLength);
+
+    // Streams the reconstructed target; throws if the delta is malformed or
+    // refers outside the base
+    static void apply(const char* base, size_t baseLength,
+                      const char* delta, size_t deltaLength, const ObjectSink& sink);
+};
+
+#endif // DELTA_HPP
@@ -1,88 +1,1209 @@
 #include "FileManager.hpp"
+#include "Chunker.hpp"
+#include "FileTransfer.hpp"
+#include "Delta.hpp"
 #include <sstream>
-#include <iomanip>
 #include <iostream>
+#include <random>
+#include <thread>
+#include <algorithm>
+#include <memory>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef VAULT_HAVE_BLAKE3
+#include <blake3.h>
+#endif
+#ifdef VAULT_HAVE_XXHASH
+#include <xxhash.h>
+#endif
+
+// Streaming digest for one of the supported algorithms. Each thread keeps
+// one instance per algorithm and resets it for every hash instead of
+// creating and freeing a context on every call.
+class Digest {
+public:
+    static constexpr size_t MAX_SIZE = 64;
+
+    virtual ~Digest() = default;
+    virtual void reset() = 0;
+    virtual void update(const char* data, size_t length) = 0;
+    // Writes the digest to out, which holds MAX_SIZE bytes, and returns its
+    // length
+    virtual size_t finish(unsigned char* out) = 0;
+
+    std::string finalHex() {
+        unsigned char digest[MAX_SIZE];
+        size_t length = finish(digest);
+        return bytesToHex(digest, length);
+    }
+
+    // Only content digests name objects, and all of those are 32 bytes
+    ObjectId finalId() {
+        unsigned char digest[MAX_SIZE];
+        if (finish(digest) != ObjectId::SIZE) {
+            throw std::runtime_error("Unexpected object digest size");
+        }
+        return ObjectId(digest);
+    }
+};
+
+namespace {
+
+// Large enough to keep per-syscall overhead negligible, aligned so the
+// kernel can copy into it page by page. Plain reads are used rather than
+// mmap because a file truncated while being hashed would raise SIGBUS.
+constexpr size_t IO_BUFFER_SIZE = 1 << 20;
+constexpr size_t IO_BUFFER_ALIGNMENT = 4096;
+
+// A chunk manifest is a list of (digest, length) pairs in file order
+constexpr size_t CHUNK_DIGEST_SIZE = 32;
+constexpr size_t CHUNK_ENTRY_SIZE = CHUNK_DIGEST_SIZE + 8;
+
+// A delta payload starts with the base digest and the chain depth, followed
+// by the delta instructions
+constexpr size_t DELTA_DIGEST_SIZE = 32;
+constexpr size_t DELTA_PREFIX_SIZE = DELTA_DIGEST_SIZE + 8;
+
+char* threadIoBuffer() {
+    struct Buffer {
+        char* data;
+        Buffer() : data(static_cast<char*>(std::aligned_alloc(IO_BUFFER_ALIGNMENT, IO_BUFFER_SIZE))) {
+            if (!data) {
+                throw std::bad_alloc();
+            }
+        }
+        ~Buffer() { std::free(data); }
+    };
+    thread_local Buffer buffer;
+    return buffer.data;
+}
+
+class EvpDigest : public Digest {
+private:
+    EVP_MD_CTX* ctx;
+    EVP_MD* md;
+
+public:
+    explicit EvpDigest(const char* name) : ctx(EVP_MD_CTX_new()), md(EVP_MD_fetch(nullptr, name, nullptr)) {
+        if (!ctx || !md) {
+            EVP_MD_CTX_free(ctx);
+            EVP_MD_free(md);
+            throw std::runtime_error("Failed to create hash context");
+        }
+    }
+
+    ~EvpDigest() override {
+        EVP_MD_CTX_free(ctx);
+        EVP_MD_free(md);
+    }
+
+    EvpDigest(const EvpDigest&) = delete;
+    EvpDigest& operator=(const EvpDigest&) = delete;
+
+    void reset() override {
+        if (!EVP_DigestInit_ex(ctx, md, nullptr)) {
+            throw std::runtime_error("Failed to initialize hash context");
+        }
+    }
+
+    void update(const char* data, size_t length) override {
+        if (!EVP_DigestUpdate(ctx, data, length)) {
+            throw std::runtime_error("Failed to update hash");
+        }
+    }
+
+    size_t finish(unsigned char* out) override {
+        unsigned int length;
+        if (!EVP_DigestFinal_ex(ctx, out, &length)) {
+            throw std::runtime_error("Failed to finalize hash");
+        }
+        return length;
+    }
+};
+
+#ifdef VAULT_HAVE_BLAKE3
+// BLAKE3 picks the widest SIMD implementation the CPU supports at runtime
+class Blake3Digest : public Digest {
+private:
+    blake3_hasher hasher;
+
+public:
+    void reset() override {
+        blake3_hasher_init(&hasher);
+    }
+
+    void update(const char* data, size_t length) override {
+        blake3_hasher_update(&hasher, data, length);
+    }
+
+    size_t finish(unsigned char* out) override {
+        blake3_hasher_finalize(&hasher, out, BLAKE3_OUT_LEN);
+        return BLAKE3_OUT_LEN;
+    }
+};
+#endif
+
+#ifdef VAULT_HAVE_XXHASH
+// Non-cryptographic; only ever used to tell whether two files differ
+class Xxh3Digest : public Digest {
+private:
+    XXH3_state_t* state;
+
+public:
+    Xxh3Digest() : state(XXH3_createState()) {
+        if (!state) {
+            throw std::runtime_error("Failed to create hash context");
+        }
+    }
+
+    ~Xxh3Digest() override {
+        XXH3_freeState(state);
+    }
+
+    Xxh3Digest(const Xxh3Digest&) = delete;
+    Xxh3Digest& operator=(const Xxh3Digest&) = delete;
+
+    void reset() override {
+        XXH3_128bits_reset(state);
+    }
+
+    void update(const char* data, size_t length) override {
+        XXH3_128bits_update(state, data, length);
+    }
+
+    size_t finish(unsigned char* out) override {
+        XXH128_canonical_t canonical;
+        XXH128_canonicalFromHash(&canonical, XXH3_128bits_digest(state));
+        std::memcpy(out, canonical.digest, sizeof(canonical.digest));
+        return sizeof(canonical.digest);
+    }
+};
+#endif
+
+std::unique_ptr<Digest> createDigest(HashAlgorithm algorithm) {
+    switch (algorithm) {
+        case HashAlgorithm::Sha256:
+            return std::make_unique<EvpDigest>("SHA256");
+        case HashAlgorithm::Sha512_256:
+            return std::make_unique<EvpDigest>("SHA2-512/256");
+#ifdef VAULT_HAVE_BLAKE3
+        case HashAlgorithm::Blake3:
+            return std::make_unique<Blake3Digest>();
+#endif
+#ifdef VAULT_HAVE_XXHASH
+        case HashAlgorithm::Xxh3:
+            return std::make_unique<Xxh3Digest>();
+#endif
+        default:
+            throw std::runtime_error("Hash algorithm not available: " + hashAlgorithmName(algorithm));
+    }
+}
+
+// Independent digests a single thread may need at the same time, e.g. the
+// whole-file hash and the current chunk's hash during chunked ingest
+constexpr size_t DIGEST_SLOTS = 2;
+constexpr size_t HASH_ALGORITHM_COUNT = 4;
+
+Digest& beginDigest(HashAlgorithm algorithm, size_t slot = 0) {
+    thread_local std::unique_ptr<Digest> digests[HASH_ALGORITHM_COUNT][DIGEST_SLOTS];
+    auto& digest = digests[static_cast<size_t>(algorithm)][slot];
+    if (!digest) {
+        digest = createDigest(algorithm);
+    }
+    digest->reset();
+    return *digest;
+}
+
+int openForSequentialRead(const std::string& filePath) {
+    int fd = ::open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open file: " + filePath);
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return fd;
+}
+
+size_t readFully(int fd, char* buffer, size_t size, const std::string& filePath) {
+    size_t total = 0;
+    while (total < size) {
+        ssize_t count = ::read(fd, buffer + total, size - total);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Failed to read file: " + filePath + ": " + std::strerror(errno));
+        }
+        if (count == 0) break;
+        total += static_cast<size_t>(count);
+    }
+    return total;
+}
+
+// The stored bytes of one object: either a whole loose file or a range of a
+// pack data file
+class ObjectSource {
+private:
+    recordfile::FileDescriptor looseFd;
+    PackedObject packed;
+    int fd;
+    uint64_t position;
+    uint64_t remaining;
+    ObjectId hash;
+
+public:
+    ObjectSource(const std::string& objectPath, PackManager& packs, const ObjectId& objectHash)
+        : looseFd(::open(objectPath.c_str(), O_RDONLY | O_CLOEXEC)), packed(),
+          fd(-1), position(0), remaining(0), hash(objectHash) {
+        struct stat info;
+        if (looseFd.get() >= 0 && fstat(looseFd.get(), &info) == 0) {
+            fd = looseFd.get();
+            remaining = static_cast<uint64_t>(info.st_size);
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+        else if (packs.find(hash, packed)) {
+            fd = packed.pack->getDataFd();
+            position = packed.offset;
+            remaining = packed.length;
+        }
+        else {
+            throw std::runtime_error("Object file not found: " + hash.toHex());
+        }
+    }
+
+    size_t read(char* buffer, size_t size) {
+        size_t wanted = static_cast<size_t>(std::min<uint64_t>(size, remaining));
+        size_t total = 0;
+        while (total < wanted) {
+            ssize_t count = pread(fd, buffer + total, wanted - total, position + total);
+            if (count < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error("Failed to read object: " + hash.toHex() + ": " + std::strerror(errno));
+            }
+            if (count == 0) {
+                throw std::runtime_error("Object is truncated: " + hash.toHex());
+            }
+            total += static_cast<size_t>(count);
+        }
+        position += total;
+        remaining -= total;
+        return total;
+    }
+
+    // Reads from the current position without consuming anything
+    size_t peek(char* buffer, size_t size) {
+        uint64_t savedPosition = position;
+        uint64_t savedRemaining = remaining;
+        size_t count = read(buffer, size);
+        position = savedPosition;
+        remaining = savedRemaining;
+        return count;
+    }
+
+    bool atEnd() const { return remaining == 0; }
+    bool isLoose() const { return fd == looseFd.get(); }
+    int descriptor() const { return fd; }
+    uint64_t getPosition() const { return position; }
+    uint64_t getRemaining() const { return remaining; }
+};
+
+} // namespace
+
+std::string hashAlgorithmName(HashAlgorithm algorithm) {
+    switch (algorithm) {
+        case HashAlgorithm::Sha256: return "sha256";
+        case HashAlgorithm::Sha512_256: return "sha512-256";
+        case HashAlgorithm::Blake3: return "blake3";
+        case HashAlgorithm::Xxh3: return "xxh3";
+    }
+    return "unknown";
+}
+
+bool parseHashAlgorithm(const std::string& name, HashAlgorithm& algorithm) {
+    for (HashAlgorithm candidate : {HashAlgorithm::Sha256, HashAlgorithm::Sha512_256,
+                                    HashAlgorithm::Blake3, HashAlgorithm::Xxh3}) {
+        if (hashAlgorithmName(candidate) == name) {
+            algorithm = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool isHashAlgorithmAvailable(HashAlgorithm algorithm) {
+    switch (algorithm) {
+        case HashAlgorithm::Sha256:
+        case HashAlgorithm::Sha512_256:
+            return true;
+        case HashAlgorithm::Blake3:
+#ifdef VAULT_HAVE_BLAKE3
+            return true;
+#else
+            return false;
+#endif
+        case HashAlgorithm::Xxh3:
+#ifdef VAULT_HAVE_XXHASH
+            return true;
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+bool FileManager::setHashAlgorithm(HashAlgorithm algorithm) {
+    // Object names must stay collision resistant, which rules out XXH3
+    if (algorithm == HashAlgorithm::Xxh3) {
+        std::cerr << "Hash algorithm cannot be used for content addressing: "
+                  << hashAlgorithmName(algorithm) << std::endl;
+        return false;
+    }
+    if (!isHashAlgorithmAvailable(algorithm)) {
+        std::cerr << "Hash algorithm not available in this build: "
+                  << hashAlgorithmName(algorithm) << std::endl;
+        return false;
+    }
+    contentAlgorithm = algorithm;
+    return true;
+}
+
+bool FileManager::setChangeDetectionAlgorithm(HashAlgorithm algorithm) {
+    if (!isHashAlgorithmAvailable(algorithm)) {
+        std::cerr << "Hash algorithm not available in this build: "
+                  << hashAlgorithmName(algorithm) << std::endl;
+        return false;
+    }
+    changeAlgorithm = algorithm;
+    return true;
+}
+
+HashAlgorithm FileManager::getHashAlgorithm() const {
+    return contentAlgorithm;
+}
+
+HashAlgorithm FileManager::getChangeDetectionAlgorithm() const {
+    return changeAlgorithm;
+}
 
 bool FileManager::fileExists(const std::string& filePath) const {
     return fs::exists(filePath);
 }
 
-std::string FileManager::getObjectPath(const std::string& hash) const {
-    return (fs::path(vaultPath) / OBJECTS_DIR / hash).string();
+std::string FileManager::getObjectPath(const ObjectId& hash) const {
+    return (fs::path(vaultPath) / OBJECTS_DIR / hash.toHex()).string();
+}
+
+std::string FileManager::createTempObjectPath() const {
+    thread_local std::mt19937_64 gen(std::random_device{}() ^
+                                     std::hash<std::thread::id>()(std::this_thread::get_id()));
+    std::stringstream ss;
+    ss << "tmp-" << std::hex << gen();
+    return (fs::path(vaultPath) / OBJECTS_DIR / ss.str()).string();
+}
+
+bool FileManager::publishObject(const std::string& tempPath, const ObjectId& hash) {
+    std::string objectPath = getObjectPath(hash);
+
+    // Another writer may have published the same content first; the bytes
+    // are identical so keeping either copy is fine
+    if (freshenObject(hash)) {
+        fs::remove(tempPath);
+        return true;
+    }
+
+    fs::rename(tempPath, objectPath);
+    return true;
+}
+
+std::string FileManager::hashFile(const std::string& filePath, HashAlgorithm algorithm) {
+    recordfile::FileDescriptor fd(openForSequentialRead(filePath));
+    Digest& digest = beginDigest(algorithm);
+
+    // A short read means end of file, so a small file costs one read call
+    // rather than a read followed by one that returns nothing
+    char* buffer = threadIoBuffer();
+    size_t count;
+    do {
+        count = readFully(fd.get(), buffer, IO_BUFFER_SIZE, filePath);
+        digest.update(buffer, count);
+    } while (count == IO_BUFFER_SIZE);
+
+    return digest.finalHex();
+}
+
+std::vector<std::string> FileManager::hashFiles(const std::vector<std::string>& filePaths,
+                                                HashAlgorithm algorithm) {
+    std::vector<std::string> hashes(filePaths.size());
+    if (filePaths.empty()) {
+        return hashes;
+    }
+
+    // Every worker keeps its own digest and buffer for the whole batch, so
+    // the per-file cost is just open, read and finalize
+    ThreadPool pool(std::min(hashThreads, filePaths.size()));
+    pool.parallelFor(filePaths.size(), [&](size_t i) {
+        hashes[i] = hashFile(filePaths[i], algorithm);
+    });
+    return hashes;
 }
 
 std::string FileManager::calculateFileHash(const std::string& filePath) {
-    std::ifstream file(filePath, std::ios::binary);
-    if (!file) {
-        throw std::runtime_error("Cannot open file: " + filePath);
+    return hashFile(filePath, contentAlgorithm);
+}
+
+std::string FileManager::calculateChangeHash(const std::string& filePath) {
+    return hashFile(filePath, changeAlgorithm);
+}
+
+std::vector<std::string> FileManager::calculateFileHashes(const std::vector<std::string>& filePaths) {
+    return hashFiles(filePaths, contentAlgorithm);
+}
+
+std::vector<std::string> FileManager::calculateChangeHashes(const std::vector<std::string>& filePaths) {
+    return hashFiles(filePaths, changeAlgorithm);
+}
+
+void FileManager::setHashThreads(size_t threadCount) {
+    hashThreads = threadCount == 0 ? 1 : threadCount;
+}
+
+uint64_t FileManager::copyToObject(int sourceFd, const std::string& sourcePath,
+                                   int objectFd, const std::string& objectPath,
+                                   Digest* digest) {
+    char* buffer = threadIoBuffer();
+    char header[ObjectHeader::ENCODED_SIZE];
+    ObjectHeader objectHeader(ObjectType::Blob, 0);
+    bool encoded = false;
+    std::unique_ptr<Compressor> compressor;
+    uint64_t total = 0;
+    bool first = true;
+    size_t count;
+
+    auto write = [&](const char* data, size_t length) {
+        recordfile::writeFully(objectFd, data, length, objectPath);
+    };
+
+    do {
+        count = readFully(sourceFd, buffer, IO_BUFFER_SIZE, sourcePath);
+
+        if (first) {
+            first = false;
+            // Whether to compress is decided from a sample of the first
+            // buffer; raw content that looks like an encoded object is
+            // stored as an explicit blob so readers cannot mistake it for
+            // a header
+            if (isWorthCompressing(compressionCodec, compressionLevel, buffer, count)) {
+                compressor = Compressor::create(compressionCodec, compressionLevel);
+                objectHeader.codec = static_cast<uint8_t>(compressionCodec);
+                encoded = true;
+            }
+            else if (ObjectHeader::hasMagic(buffer, count)) {
+                encoded = true;
+            }
+
+            if (encoded) {
+                objectHeader.encode(header);
+                write(header, sizeof(header));
+            }
+        }
+
+        if (digest) {
+            digest->update(buffer, count);
+        }
+        if (compressor) {
+            compressor->update(buffer, count, write);
+        }
+        else {
+            write(buffer, count);
+        }
+        total += count;
+    } while (count == IO_BUFFER_SIZE);
+
+    if (compressor) {
+        compressor->finish(write);
     }
 
-    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
-    if (!ctx) {
-        throw std::runtime_error("Failed to create hash context");
+    if (encoded) {
+        // The size is only known once the whole file has been read
+        objectHeader.originalSize = total;
+        objectHeader.encode(header);
+        if (pwrite(objectFd, header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))) {
+            throw std::runtime_error("Failed to write object header: " + objectPath);
+        }
     }
 
-    if (!EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr)) {
-        EVP_MD_CTX_free(ctx);
-        throw std::runtime_error("Failed to initialize hash context");
+    return total;
+}
+
+void FileManager::writeObjectFile(const ObjectId& hash, const char* header, size_t headerLength,
+                                  const char* data, size_t length) {
+    if (freshenObject(hash)) {
+        return;
     }
 
-    char buffer[4096];
-    while (file.read(buffer, sizeof(buffer)).gcount() > 0) {
-        if (!EVP_DigestUpdate(ctx, buffer, file.gcount())) {
-            EVP_MD_CTX_free(ctx);
-            throw std::runtime_error("Failed to update hash");
+    std::string tempPath = createTempObjectPath();
+    recordfile::FileDescriptor object(::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644));
+    if (object.get() < 0) {
+        throw std::runtime_error("Cannot create object file: " + tempPath);
+    }
+
+    try {
+        recordfile::writeFully(object.get(), header, headerLength, tempPath);
+        recordfile::writeFully(object.get(), data, length, tempPath);
+        if (::close(object.release()) != 0) {
+            throw std::runtime_error("Failed to write object file: " + tempPath);
         }
+        publishObject(tempPath, hash);
+    }
+    catch (...) {
+        std::error_code ec;
+        fs::remove(tempPath, ec);
+        throw;
     }
+}
 
-    unsigned char hash[EVP_MAX_MD_SIZE];
-    unsigned int hashLen;
-    if (!EVP_DigestFinal_ex(ctx, hash, &hashLen)) {
-        EVP_MD_CTX_free(ctx);
-        throw std::runtime_error("Failed to finalize hash");
+ObjectId FileManager::storeBuffer(const char* data, size_t length, size_t digestSlot) {
+    Digest& digest = beginDigest(contentAlgorithm, digestSlot);
+    digest.update(data, length);
+    ObjectId hash = digest.finalId();
+    storeBlob(hash, data, length);
+    return hash;
+}
+
+void FileManager::storeBlob(const ObjectId& hash, const char* data, size_t length) {
+    if (freshenObject(hash)) {
+        return;
     }
 
-    EVP_MD_CTX_free(ctx);
+    char header[ObjectHeader::ENCODED_SIZE];
+    ObjectHeader objectHeader(ObjectType::Blob, length);
 
-    std::stringstream ss;
-    for(unsigned int i = 0; i < hashLen; i++) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
+    if (isWorthCompressing(compressionCodec, compressionLevel, data, length)) {
+        std::string compressed;
+        auto compressor = Compressor::create(compressionCodec, compressionLevel);
+        auto append = [&](const char* output, size_t produced) { compressed.append(output, produced); };
+        compressor->update(data, length, append);
+        compressor->finish(append);
+
+        objectHeader.codec = static_cast<uint8_t>(compressionCodec);
+        objectHeader.encode(header);
+        writeObjectFile(hash, header, sizeof(header), compressed.data(), compressed.size());
+        return;
+    }
+
+    size_t headerLength = 0;
+    if (ObjectHeader::hasMagic(data, length)) {
+        objectHeader.encode(header);
+        headerLength = sizeof(header);
     }
 
-    return ss.str();
+    writeObjectFile(hash, header, headerLength, data, length);
 }
 
-bool FileManager::storeFileContent(const std::string& filePath, const std::string& hash) {
+ObjectId FileManager::ingestChunked(int sourceFd, const std::string& filePath) {
+    Digest& fileDigest = beginDigest(contentAlgorithm, 0);
+    Chunker chunker;
+
+    // Keep at least one maximum-size chunk of lookahead so every boundary
+    // the chunker picks is final
+    std::vector<char> window(2 * Chunker::MAX_SIZE);
+    size_t start = 0;
+    size_t filled = 0;
+    bool endOfInput = false;
+
+    std::string manifest;
+    uint64_t total = 0;
+
+    while (true) {
+        if (!endOfInput && filled - start < Chunker::MAX_SIZE) {
+            std::memmove(window.data(), window.data() + start, filled - start);
+            filled -= start;
+            start = 0;
+
+            size_t count = readFully(sourceFd, window.data() + filled, window.size() - filled, filePath);
+            fileDigest.update(window.data() + filled, count);
+            filled += count;
+            endOfInput = filled < window.size();
+        }
+
+        if (start == filled) {
+            break;
+        }
+
+        size_t length = chunker.nextChunk(reinterpret_cast<const unsigned char*>(window.data() + start),
+                                          filled - start, endOfInput);
+
+        // Chunks already in the store from earlier versions are not rewritten
+        ObjectId chunkHash = storeBuffer(window.data() + start, length, 1);
+
+        char entry[CHUNK_ENTRY_SIZE];
+        std::memcpy(entry, chunkHash.data(), CHUNK_DIGEST_SIZE);
+        putUint64(entry + CHUNK_DIGEST_SIZE, length);
+        manifest.append(entry, sizeof(entry));
+
+        start += length;
+        total += length;
+    }
+
+    ObjectId hash = fileDigest.finalId();
+    char header[ObjectHeader::ENCODED_SIZE];
+    ObjectHeader(ObjectType::ChunkManifest, total).encode(header);
+    writeObjectFile(hash, header, sizeof(header), manifest.data(), manifest.size());
+    return hash;
+}
+
+bool FileManager::getDeltaBaseInfo(const ObjectId& hash, uint64_t& size, uint32_t& depth) {
+    if (!hasObject(hash)) {
+        return false;
+    }
+
+    ObjectSource source(getObjectPath(hash), packManager, hash);
+    char prefix[ObjectHeader::ENCODED_SIZE + DELTA_PREFIX_SIZE];
+    size_t count = source.peek(prefix, sizeof(prefix));
+
+    ObjectHeader header;
+    if (!ObjectHeader::decode(prefix, count, header)) {
+        size = source.getRemaining();
+        depth = 0;
+        return true;
+    }
+
+    size = header.originalSize;
+    if (header.type == ObjectType::Blob) {
+        depth = 0;
+        return true;
+    }
+    if (header.type == ObjectType::Delta && count == sizeof(prefix)) {
+        depth = getUint32(prefix + ObjectHeader::ENCODED_SIZE + DELTA_DIGEST_SIZE);
+        return true;
+    }
+
+    // Chunked files deduplicate through their chunks instead
+    return false;
+}
+
+ObjectId FileManager::ingestDelta(int sourceFd, const std::string& filePath, const ObjectId& baseHash) {
+    // Small enough to hold in memory, which the delta search needs anyway
+    std::string content;
+    char* buffer = threadIoBuffer();
+    size_t count;
+    do {
+        count = readFully(sourceFd, buffer, IO_BUFFER_SIZE, filePath);
+        content.append(buffer, count);
+    } while (count == IO_BUFFER_SIZE);
+
+    Digest& digest = beginDigest(contentAlgorithm);
+    digest.update(content.data(), content.size());
+    ObjectId hash = digest.finalId();
+
+    if (freshenObject(hash)) {
+        return hash;
+    }
+
+    uint64_t baseSize;
+    uint32_t baseDepth;
+    if (content.size() <= DELTA_MAX_SIZE && getDeltaBaseInfo(baseHash, baseSize, baseDepth) &&
+        baseDepth < MAX_DELTA_DEPTH && baseSize <= DELTA_MAX_SIZE) {
+        std::string base;
+        base.reserve(baseSize);
+        readObject(baseHash, [&](const char* data, size_t length) { base.append(data, length); });
+
+        std::string instructions = Delta::create(base.data(), base.size(), content.data(), content.size());
+
+        // Only worth it when the delta is a small fraction of the file;
+        // otherwise every read would pay for reconstruction for little gain
+        if (DELTA_PREFIX_SIZE + instructions.size() < content.size() / 2) {
+            std::string payload(DELTA_PREFIX_SIZE, '\0');
+            std::memcpy(&payload[0], baseHash.data(), DELTA_DIGEST_SIZE);
+            putUint32(&payload[DELTA_DIGEST_SIZE], baseDepth + 1);
+            payload += instructions;
+
+            char header[ObjectHeader::ENCODED_SIZE];
+            ObjectHeader(ObjectType::Delta, content.size()).encode(header);
+            writeObjectFile(hash, header, sizeof(header), payload.data(), payload.size());
+            return hash;
+        }
+    }
+
+    storeBlob(hash, content.data(), content.size());
+    return hash;
+}
+
+ObjectId FileManager::ingestFile(const std::string& filePath, const ObjectId& baseHash) {
+    recordfile::FileDescriptor source(openForSequentialRead(filePath));
+
+    struct stat info;
+    bool haveInfo = fstat(source.get(), &info) == 0;
+    if (chunkingEnabled && haveInfo && static_cast<uint64_t>(info.st_size) >= chunkingThreshold) {
+        return ingestChunked(source.get(), filePath);
+    }
+    if (deltaEnabled && !baseHash.isNull() && haveInfo &&
+        static_cast<uint64_t>(info.st_size) <= DELTA_MAX_SIZE) {
+        return ingestDelta(source.get(), filePath, baseHash);
+    }
+
+    std::string tempPath = createTempObjectPath();
+    recordfile::FileDescriptor object(::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644));
+    if (object.get() < 0) {
+        throw std::runtime_error("Cannot create object file: " + tempPath);
+    }
+
     try {
-        std::string objectPath = getObjectPath(hash);
+        // Hash and write from the same buffer so the source is read once
+        Digest& digest = beginDigest(contentAlgorithm);
+        copyToObject(source.get(), filePath, object.get(), tempPath, &digest);
 
-        if (fileExists(objectPath)) {
+        if (::close(object.release()) != 0) {
+            throw std::runtime_error("Failed to write object file: " + tempPath);
+        }
+
+        ObjectId hash = digest.finalId();
+        publishObject(tempPath, hash);
+        return hash;
+    }
+    catch (...) {
+        std::error_code ec;
+        fs::remove(tempPath, ec);
+        throw;
+    }
+}
+
+bool FileManager::storeFileContent(const std::string& filePath, const ObjectId& hash) {
+    std::string tempPath;
+    try {
+        if (freshenObject(hash)) {
             return true;
         }
 
-        fs::copy_file(filePath, objectPath, fs::copy_options::overwrite_existing);
-        return true;
+        // Copy under a temporary name so a concurrent reader never sees a
+        // partially written object
+        recordfile::FileDescriptor source(openForSequentialRead(filePath));
+        tempPath = createTempObjectPath();
+        recordfile::FileDescriptor object(::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644));
+        if (object.get() < 0) {
+            throw std::runtime_error("Cannot create object file: " + tempPath);
+        }
+
+        // Content that will be stored raw needs no encoding pass, so the
+        // kernel can copy or reflink it; the sample makes the same decision
+        // copyToObject would
+        char* sample = threadIoBuffer();
+        ssize_t sampled = pread(source.get(), sample, COMPRESSION_SAMPLE_SIZE, 0);
+        struct stat info;
+        if (sampled >= 0 && fstat(source.get(), &info) == 0 &&
+            !isWorthCompressing(compressionCodec, compressionLevel, sample, sampled) &&
+            !ObjectHeader::hasMagic(sample, sampled)) {
+            FileTransfer::copyWholeFile(source.get(), object.get(), static_cast<uint64_t>(info.st_size), tempPath);
+        }
+        else {
+            copyToObject(source.get(), filePath, object.get(), tempPath, nullptr);
+        }
+        if (::close(object.release()) != 0) {
+            throw std::runtime_error("Failed to write object file: " + tempPath);
+        }
+        return publishObject(tempPath, hash);
     }
     catch (const std::exception& e) {
+        if (!tempPath.empty()) {
+            std::error_code ec;
+            fs::remove(tempPath, ec);
+        }
         std::cerr << "Error storing file content: " << e.what() << std::endl;
         return false;
     }
 }
 
-bool FileManager::copyFileFromObjects(const std::string& hash, const std::string& destPath) {
+bool FileManager::readDeltaPayload(const ObjectId& hash, uint64_t& size, std::string& payload) {
+    ObjectSource source(getObjectPath(hash), packManager, hash);
+    char* buffer = threadIoBuffer();
+    size_t count = source.read(buffer, IO_BUFFER_SIZE);
+
+    ObjectHeader header;
+    if (!ObjectHeader::decode(buffer, count, header) || header.type != ObjectType::Delta) {
+        return false;
+    }
+    size = header.originalSize;
+    payload.assign(buffer + ObjectHeader::ENCODED_SIZE, count - ObjectHeader::ENCODED_SIZE);
+    while (!source.atEnd()) {
+        count = source.read(buffer, IO_BUFFER_SIZE);
+        payload.append(buffer, count);
+    }
+    if (payload.size() < DELTA_PREFIX_SIZE) {
+        throw std::runtime_error("Corrupt delta object: " + hash.toHex());
+    }
+    return true;
+}
+
+void FileManager::readDeltaChain(const ObjectId& hash, const ObjectSink& sink) {
+    // Walk down to the first object that is not a delta, keeping only the
+    // names of the deltas on the way
+    std::vector<ObjectId> chain{hash};
+    ObjectId baseHash;
+    uint64_t size;
+    std::string payload;
+    while (true) {
+        if (!readDeltaPayload(chain.back(), size, payload)) {
+            baseHash = chain.back();
+            chain.pop_back();
+            break;
+        }
+        if (chain.size() > MAX_DELTA_DEPTH + 1) {
+            throw std::runtime_error("Delta chain too deep: " + hash.toHex());
+        }
+        chain.emplace_back(reinterpret_cast<const unsigned char*>(payload.data()));
+    }
+
+    // Then rebuild upwards between two buffers, so memory is two versions
+    // and one delta whatever the depth; the top delta streams to the sink
+    std::string current;
+    readObject(baseHash, [&](const char* data, size_t length) { current.append(data, length); });
+    std::string next;
+    for (size_t i = chain.size(); i-- > 0;) {
+        readDeltaPayload(chain[i], size, payload);
+        uint64_t produced = 0;
+        auto apply = [&](const ObjectSink& out) {
+            Delta::apply(current.data(), current.size(), payload.data() + DELTA_PREFIX_SIZE,
+                         payload.size() - DELTA_PREFIX_SIZE, [&](const char* data, size_t length) {
+                             produced += length;
+                             out(data, length);
+                         });
+        };
+        if (i == 0) {
+            apply(sink);
+        }
+        else {
+            next.clear();
+            next.reserve(size);
+            apply([&](const char* data, size_t length) { next.append(data, length); });
+            current.swap(next);
+        }
+        if (produced != size) {
+            throw std::runtime_error("Decoded size mismatch for object: " + chain[i].toHex());
+        }
+    }
+}
+
+void FileManager::readObject(const ObjectId& hash, const ObjectSink& sink) {
+    ObjectSource source(getObjectPath(hash), packManager, hash);
+
+    char* buffer = threadIoBuffer();
+    size_t count = source.read(buffer, IO_BUFFER_SIZE);
+
+    ObjectHeader header;
+    size_t offset = 0;
+    if (ObjectHeader::decode(buffer, count, header)) {
+        offset = ObjectHeader::ENCODED_SIZE;
+
+        if (header.type == ObjectType::ChunkManifest) {
+            // Copy the manifest out first: reassembling the chunks reuses
+            // this thread's I/O buffer
+            std::string manifest(buffer + offset, count - offset);
+            while (!source.atEnd()) {
+                count = source.read(buffer, IO_BUFFER_SIZE);
+                manifest.append(buffer, count);
+            }
+            if (manifest.size() % CHUNK_ENTRY_SIZE != 0) {
+                throw std::runtime_error("Corrupt chunk manifest: " + hash.toHex());
+            }
+
+            for (size_t i = 0; i < manifest.size(); i += CHUNK_ENTRY_SIZE) {
+                readObject(ObjectId(reinterpret_cast<const unsigned char*>(manifest.data() + i)), sink);
+            }
+            return;
+        }
+
+        if (header.type == ObjectType::Delta) {
+            readDeltaChain(hash, sink);
+            return;
+        }
+
+        if (header.type != ObjectType::Blob && header.type != ObjectType::Tree) {
+            throw std::runtime_error("Unsupported object type: " + hash.toHex());
+        }
+
+        if (header.codec != static_cast<uint8_t>(CompressionCodec::None)) {
+            // Decompress while streaming and check the decoded size so a
+            // truncated or damaged object cannot pass silently
+            auto decompressor = Decompressor::create(static_cast<CompressionCodec>(header.codec));
+            uint64_t produced = 0;
+            auto counted = [&](const char* data, size_t length) {
+                produced += length;
+                sink(data, length);
+            };
+
+            decompressor->update(buffer + offset, count - offset, counted);
+            while (!source.atEnd()) {
+                count = source.read(buffer, IO_BUFFER_SIZE);
+                decompressor->update(buffer, count, counted);
+            }
+            decompressor->finish();
+
+            if (produced != header.originalSize) {
+                throw std::runtime_error("Decoded size mismatch for object: " + hash.toHex());
+            }
+            return;
+        }
+    }
+
+    sink(buffer + offset, count - offset);
+    while (!source.atEnd()) {
+        count = source.read(buffer, IO_BUFFER_SIZE);
+        sink(buffer, count);
+    }
+}
+
+ObjectId FileManager::storeTree(const std::vector<TreeEntry>& entries) {
+    std::string payload = encodeTree(entries);
+    Digest& digest = beginDigest(contentAlgorithm);
+    digest.update(payload.data(), payload.size());
+    ObjectId hash = digest.finalId();
+
+    // Trees are small and read on every lookup, so they stay uncompressed
+    char header[ObjectHeader::ENCODED_SIZE];
+    ObjectHeader(ObjectType::Tree, payload.size()).encode(header);
+    writeObjectFile(hash, header, sizeof(header), payload.data(), payload.size());
+    return hash;
+}
+
+std::vector<TreeEntry> FileManager::readTree(const ObjectId& hash) {
+    ObjectSource source(getObjectPath(hash), packManager, hash);
+
+    char header[ObjectHeader::ENCODED_SIZE];
+    ObjectHeader decoded;
+    if (!ObjectHeader::decode(header, source.read(header, sizeof(header)), decoded) ||
+        decoded.type != ObjectType::Tree) {
+        throw std::runtime_error("Object is not a tree: " + hash.toHex());
+    }
+
+    std::string payload(source.getRemaining(), '\0');
+    source.read(&payload[0], payload.size());
+    return decodeTree(payload.data(), payload.size());
+}
+
+bool FileManager::freshenObject(const ObjectId& hash) {
+    // Reusing an object refreshes its timestamp, so a concurrent gc's grace
+    // period protects it until the commit that reuses it is recorded
+    if (utimensat(AT_FDCWD, getObjectPath(hash).c_str(), nullptr, 0) == 0 || errno != ENOENT) {
+        return true;
+    }
+    return packManager.freshen(hash);
+}
+
+bool FileManager::hasObject(const ObjectId& hash) {
+    return fileExists(getObjectPath(hash)) || packManager.contains(hash);
+}
+
+uint64_t FileManager::verifyObject(const ObjectId& hash) {
+    ObjectSource source(getObjectPath(hash), packManager, hash);
+
+    char header[ObjectHeader::ENCODED_SIZE];
+    ObjectHeader decoded;
+    if (ObjectHeader::decode(header, source.peek(header, sizeof(header)), decoded) &&
+        decoded.type == ObjectType::ChunkManifest) {
+        // Reassembling the file would read every chunk a second time
+        source.read(header, sizeof(header));
+        std::string manifest(source.getRemaining(), '\0');
+        if (source.read(&manifest[0], manifest.size()) != manifest.size() ||
+            manifest.size() % CHUNK_ENTRY_SIZE != 0) {
+            throw std::runtime_error("Corrupt chunk manifest: " + hash.toHex());
+        }
+
+        uint64_t total = 0;
+        for (size_t i = 0; i < manifest.size(); i += CHUNK_ENTRY_SIZE) {
+            ObjectId chunkHash(reinterpret_cast<const unsigned char*>(manifest.data() + i));
+            if (!hasObject(chunkHash)) {
+                throw std::runtime_error("Chunk " + chunkHash.toHex() + " of " + hash.toHex() + " is missing");
+            }
+            total += getUint64(manifest.data() + i + CHUNK_DIGEST_SIZE);
+        }
+        if (total != decoded.originalSize) {
+            throw std::runtime_error("Chunk lengths do not add up for object: " + hash.toHex());
+        }
+        return ObjectHeader::ENCODED_SIZE + manifest.size();
+    }
+
+    // readObject never touches this thread's digests, so the content can be
+    // hashed as it is decoded
+    Digest& digest = beginDigest(contentAlgorithm);
+    uint64_t length = 0;
+    readObject(hash, [&](const char* data, size_t count) {
+        digest.update(data, count);
+        length += count;
+    });
+    if (digest.finalId() != hash) {
+        throw std::runtime_error("Content does not match object name: " + hash.toHex());
+    }
+
+    // Every file a tree names is also named by the commit that introduced
+    // it and checked there; subtrees are only reachable from here
+    if (decoded.type == ObjectType::Tree) {
+        for (const auto& entry : readTree(hash)) {
+            if (entry.kind == TreeEntryKind::Tree && !hasObject(entry.hash)) {
+                throw std::runtime_error("Subtree " + entry.name + " of tree " + hash.toHex() + " is missing");
+            }
+        }
+    }
+    return length;
+}
+
+std::vector<ObjectId> FileManager::getObjectReferences(const ObjectId& hash) {
+    std::vector<ObjectId> references;
+    ObjectSource source(getObjectPath(hash), packManager, hash);
+
+    char header[ObjectHeader::ENCODED_SIZE];
+    ObjectHeader decoded;
+    if (!ObjectHeader::decode(header, source.read(header, sizeof(header)), decoded)) {
+        return references;
+    }
+
+    if (decoded.type == ObjectType::ChunkManifest) {
+        std::string manifest(source.getRemaining(), '\0');
+        source.read(&manifest[0], manifest.size());
+        if (manifest.size() % CHUNK_ENTRY_SIZE != 0) {
+            throw std::runtime_error("Corrupt chunk manifest: " + hash.toHex());
+        }
+        for (size_t i = 0; i < manifest.size(); i += CHUNK_ENTRY_SIZE) {
+            references.emplace_back(reinterpret_cast<const unsigned char*>(manifest.data() + i));
+        }
+    }
+    else if (decoded.type == ObjectType::Tree) {
+        std::string payload(source.getRemaining(), '\0');
+        source.read(&payload[0], payload.size());
+        for (const auto& entry : decodeTree(payload.data(), payload.size())) {
+            references.push_back(entry.hash);
+        }
+    }
+    else if (decoded.type == ObjectType::Delta) {
+        unsigned char digest[DELTA_DIGEST_SIZE];
+        if (source.read(reinterpret_cast<char*>(digest), sizeof(digest)) != sizeof(digest)) {
+            throw std::runtime_error("Corrupt delta object: " + hash.toHex());
+        }
+        references.emplace_back(digest);
+    }
+
+    return references;
+}
+
+std::string FileManager::getObjectsPath() const {
+    return (fs::path(vaultPath) / OBJECTS_DIR).string();
+}
+
+PackManager& FileManager::getPackManager() {
+    return packManager;
+}
+
+bool FileManager::copyFileFromObjects(const ObjectId& hash, const std::string& destPath) {
     try {
-        std::string sourcePath = getObjectPath(hash);
-        if (!fileExists(sourcePath)) {
-            throw std::runtime_error("Object file not found: " + hash);
+        ObjectSource source(getObjectPath(hash), packManager, hash);
+
+        fs::path parent = fs::path(destPath).parent_path();
+        if (!parent.empty()) {
+            fs::create_directories(parent);
         }
 
-        fs::create_directories(fs::path(destPath).parent_path());
+        recordfile::FileDescriptor dest(::open(destPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+        if (dest.get() < 0) {
+            throw std::runtime_error("Cannot open file for writing: " + destPath);
+        }
 
-        fs::copy_file(sourcePath, destPath, fs::copy_options::overwrite_existing);
+        char header[ObjectHeader::ENCODED_SIZE];
+        ObjectHeader decoded;
+        size_t count = source.peek(header, sizeof(header));
+        if (!ObjectHeader::decode(header, count, decoded)) {
+            // Raw objects are a plain copy of the stored bytes, which the
+            // kernel can move or reflink without a trip through userspace
+            if (source.isLoose()) {
+                FileTransfer::copyWholeFile(source.descriptor(), dest.get(), source.getRemaining(), destPath);
+            }
+            else {
+                FileTransfer::copyRange(source.descriptor(), source.getPosition(), dest.get(),
+                                        source.getRemaining(), destPath);
+            }
+        }
+        else {
+            // Encoded objects are decoded straight into the destination
+            readObject(hash, [&](const char* data, size_t length) {
+                recordfile::writeFully(dest.get(), data, length, destPath);
+            });
+        }
+
+        if (::close(dest.release()) != 0) {
+            throw std::runtime_error("Failed to write file: " + destPath);
+        }
         return true;
     }
     catch (const std::exception& e) {
         std::cerr << "Error copying file from objects: " << e.what() << std::endl;
         return false;
     }
-}
\ No newline at end of file
+}
+
+size_t FileManager::repackObjects() {
+    // Only finished, small loose objects are packed; large ones gain little
+    // and would make every pack rewrite expensive
+    std::vector<PackInput> loose;
+    for (const auto& entry : fs::directory_iterator(fs::path(vaultPath) / OBJECTS_DIR)) {
+        std::string name = entry.path().filename().string();
+        ObjectId hash;
+        if (!entry.is_regular_file() || !isObjectName(name) || !ObjectId::parse(name, hash) ||
+            entry.file_size() > PACK_OBJECT_LIMIT) {
+            continue;
+        }
+        loose.push_back({hash, entry.path().string(), PackedObject()});
+    }
+
+    if (loose.size() < 2) {
+        return 0;
+    }
+
+    packManager.writePack(loose);
+
+    // Every object is now reachable through the pack, so the loose copies
+    // can go; readers that already opened one keep reading it
+    for (const auto& object : loose) {
+        std::error_code ec;
+        fs::remove(object.loosePath, ec);
+    }
+    return loose.size();
+}
+
+void FileManager::setChunking(bool enabled, uint64_t threshold) {
+    chunkingEnabled = enabled;
+    chunkingThreshold = threshold;
+}
+
+bool FileManager::setCompression(CompressionCodec codec, int level) {
+    if (!isCompressionCodecAvailable(codec)) {
+        std::cerr << "Compression codec not available in this build: "
+                  << compressionCodecName(codec) << std::endl;
+        return false;
+    }
+    compressionCodec = codec;
+    compressionLevel = level;
+    return true;
+}
+
+void FileManager::setDeltaStorage(bool enabled) {
+    deltaEnabled = enabled;
+}
+
+bool FileManager::isDeltaStorageEnabled() const {
+    return deltaEnabled;
+}
+
+CompressionCodec FileManager::getCompressionCodec() const {
+    return compressionCodec;
+}
+
+int FileManager::getCompressionLevel() const {
+    return compressionLevel;
+}
+
+bool FileManager::isChunkingEnabled() const {
+    return chunkingEnabled;
+}
+
+uint64_t FileManager::getChunkingThreshold() const {
+    return chunkingThreshold;
+}
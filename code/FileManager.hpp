@@ -5,25 +5,153 @@
 #include <filesystem>
 #include <fstream>
 #include <vector>
+#include <functional>
+#include <cstdint>
 #include <openssl/evp.h>
+#include "ThreadPool.hpp"
+#include "ObjectFormat.hpp"
+#include "Compression.hpp"
+#include "PackManager.hpp"
 
 namespace fs = std::filesystem;
 
+// Algorithms available for hashing file contents. Content addressing needs a
+// collision-resistant digest; XXH3 is only suitable for change detection.
+enum class HashAlgorithm {
+    Sha256,
+    Sha512_256,
+    Blake3,
+    Xxh3
+};
+
+std::string hashAlgorithmName(HashAlgorithm algorithm);
+bool parseHashAlgorithm(const std::string& name, HashAlgorithm& algorithm);
+bool isHashAlgorithmAvailable(HashAlgorithm algorithm);
+
+// Streaming digest of one of the algorithms above; defined in FileManager.cpp
+class Digest;
+
+
 class FileManager {
 private:
     std::string vaultPath;
     const std::string OBJECTS_DIR;
+    HashAlgorithm contentAlgorithm;
+    HashAlgorithm changeAlgorithm;
+    size_t hashThreads;
+    bool chunkingEnabled;
+    uint64_t chunkingThreshold;
+    CompressionCodec compressionCodec;
+    int compressionLevel;
+    bool deltaEnabled;
+    PackManager packManager;
+
+    std::string hashFile(const std::string& filePath, HashAlgorithm algorithm);
+    std::vector<std::string> hashFiles(const std::vector<std::string>& filePaths,
+                                       HashAlgorithm algorithm);
+
+    std::string createTempObjectPath() const;
+    bool publishObject(const std::string& tempPath, const ObjectId& hash);
+    uint64_t copyToObject(int sourceFd, const std::string& sourcePath,
+                          int objectFd, const std::string& objectPath, Digest* digest);
+    void writeObjectFile(const ObjectId& hash, const char* header, size_t headerLength,
+                         const char* data, size_t length);
+    ObjectId storeBuffer(const char* data, size_t length, size_t digestSlot);
+    void storeBlob(const ObjectId& hash, const char* data, size_t length);
+    ObjectId ingestChunked(int sourceFd, const std::string& filePath);
+    ObjectId ingestDelta(int sourceFd, const std::string& filePath, const ObjectId& baseHash);
+    bool getDeltaBaseInfo(const ObjectId& hash, uint64_t& size, uint32_t& depth);
+    // Reads a whole delta object's payload; false if hash is not a delta
+    bool readDeltaPayload(const ObjectId& hash, uint64_t& size, std::string& payload);
+    // Reconstructs a delta object from the bottom of its chain up
+    void readDeltaChain(const ObjectId& hash, const ObjectSink& sink);
+    // hasObject for writers: also marks an existing object as recently used
+    bool freshenObject(const ObjectId& hash);
 
 public:
     FileManager(const std::string& basePath, const std::string& objectsDir) 
-        : vaultPath(basePath), OBJECTS_DIR(objectsDir) {}
+        : vaultPath(basePath), OBJECTS_DIR(objectsDir),
+          contentAlgorithm(HashAlgorithm::Sha256),
+          changeAlgorithm(HashAlgorithm::Sha256),
+          hashThreads(ThreadPool::defaultThreadCount()),
+          chunkingEnabled(false),
+          chunkingThreshold(DEFAULT_CHUNKING_THRESHOLD),
+          compressionCodec(CompressionCodec::None),
+          compressionLevel(0),
+          deltaEnabled(true),
+          packManager((fs::path(basePath) / objectsDir / "pack").string()) {}
+
+    static constexpr uint64_t DEFAULT_CHUNKING_THRESHOLD = 8 * 1024 * 1024;
+    // Loose objects larger than this stay loose when repacking
+    static constexpr uint64_t PACK_OBJECT_LIMIT = 2 * 1024 * 1024;
+    // Versions up to this size may be stored as a delta against the
+    // previous version; reading a delta holds its base in memory
+    static constexpr uint64_t DELTA_MAX_SIZE = 16 * 1024 * 1024;
+    // Longest chain of deltas a read has to resolve
+    static constexpr uint32_t MAX_DELTA_DEPTH = 10;
+
+    // Hash configuration
+    bool setHashAlgorithm(HashAlgorithm algorithm);
+    bool setChangeDetectionAlgorithm(HashAlgorithm algorithm);
+    HashAlgorithm getHashAlgorithm() const;
+    HashAlgorithm getChangeDetectionAlgorithm() const;
+    void setHashThreads(size_t threadCount);
+
+    // Files at least threshold bytes long are stored as content-defined
+    // chunks plus a manifest when chunking is enabled
+    void setChunking(bool enabled, uint64_t threshold);
+    bool isChunkingEnabled() const;
+    uint64_t getChunkingThreshold() const;
+
+    // New objects are compressed with codec unless a sample shows the data
+    // does not compress; level 0 selects the codec's default
+    bool setCompression(CompressionCodec codec, int level);
+    CompressionCodec getCompressionCodec() const;
+    int getCompressionLevel() const;
+
+    // When enabled, a file ingested with a base hash is stored as a delta
+    // against that base if the delta is much smaller than the file
+    void setDeltaStorage(bool enabled);
+    bool isDeltaStorageEnabled() const;
 
     // Core file operations
     std::string calculateFileHash(const std::string& filePath);
-    bool storeFileContent(const std::string& filePath, const std::string& hash);
-    bool copyFileFromObjects(const std::string& hash, const std::string& destPath);
+    // Hash used only to decide whether two files differ; never names objects
+    std::string calculateChangeHash(const std::string& filePath);
+    // Batch variants; results are returned in the same order as filePaths
+    std::vector<std::string> calculateFileHashes(const std::vector<std::string>& filePaths);
+    std::vector<std::string> calculateChangeHashes(const std::vector<std::string>& filePaths);
+    // Reads the file once, hashing it while writing the object, and returns
+    // the hash it was stored under. baseHash names the previous version of
+    // the file, or is null, for delta storage.
+    ObjectId ingestFile(const std::string& filePath, const ObjectId& baseHash = ObjectId());
+    bool storeFileContent(const std::string& filePath, const ObjectId& hash);
+    bool copyFileFromObjects(const ObjectId& hash, const std::string& destPath);
+    // Streams the decoded content of an object; throws if it is missing or
+    // cannot be decoded
+    void readObject(const ObjectId& hash, const ObjectSink& sink);
+    // Directory snapshots; both throw on failure
+    ObjectId storeTree(const std::vector<TreeEntry>& entries);
+    std::vector<TreeEntry> readTree(const ObjectId& hash);
+    // True if the object is stored either loose or in a pack
+    bool hasObject(const ObjectId& hash);
+    // Rehashes the object's content and checks it matches hash, returning
+    // the number of bytes read; throws describing the problem otherwise.
+    // A chunk manifest is only checked against its chunks' lengths and
+    // presence, as each chunk is an object verified in its own right.
+    uint64_t verifyObject(const ObjectId& hash);
+    // Moves small loose objects into a new pack and returns how many were
+    // packed; throws on failure
+    size_t repackObjects();
+    // Objects this one needs in order to be read: chunks of a manifest,
+    // entries of a tree or the base of a delta
+    std::vector<ObjectId> getObjectReferences(const ObjectId& hash);
+    std::string getObjectsPath() const;
+    PackManager& getPackManager();
     bool fileExists(const std::string& filePath) const;
-    std::string getObjectPath(const std::string& hash) const;
+    // Path of the loose object file; packed objects have no path of their
+    // own and are read through readObject
+    std::string getObjectPath(const ObjectId& hash) const;
 };
 
 #endif 
\ No newline at end of file
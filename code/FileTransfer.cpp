@@ -0,0 +1,188 @@
+#include "FileTransfer.hpp"
+#include "RecordFile.hpp"
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+namespace {
+
+std::atomic<uint64_t> transferCounts[TRANSFER_STRATEGY_COUNT];
+std::atomic<uint64_t> transferBytes[TRANSFER_STRATEGY_COUNT];
+
+// Kernel copies are issued in slices so a huge file does not hold up a
+// signal for the whole copy
+constexpr size_t KERNEL_COPY_SLICE = 1 << 30;
+constexpr size_t BUFFER_SIZE = 1 << 20;
+
+void record(TransferStrategy strategy, uint64_t bytes) {
+    transferCounts[static_cast<size_t>(strategy)]++;
+    transferBytes[static_cast<size_t>(strategy)] += bytes;
+}
+
+// Errors that mean "this strategy does not work for these files" rather
+// than a real I/O failure
+bool isUnsupported(int error) {
+    return error == EXDEV || error == EINVAL || error == ENOSYS ||
+           error == EOPNOTSUPP || error == ENOTTY || error == EBADF;
+}
+
+} // namespace
+
+std::string transferStrategyName(TransferStrategy strategy) {
+    switch (strategy) {
+        case TransferStrategy::Reflink: return "reflink";
+        case TransferStrategy::CopyFileRange: return "copy_file_range";
+        case TransferStrategy::Sendfile: return "sendfile";
+        case TransferStrategy::BufferCopy: return "buffer";
+    }
+    return "unknown";
+}
+
+TransferStrategy FileTransfer::copyRange(int sourceFd, uint64_t sourceOffset, int destFd,
+                                         uint64_t length, const std::string& destPath) {
+    uint64_t total = length;
+    off_t offset = static_cast<off_t>(sourceOffset);
+
+    // Each strategy copies as much as it can; one that is not supported for
+    // these files hands the rest over to the next
+    bool useCopyFileRange = true;
+    while (useCopyFileRange && length > 0) {
+        ssize_t count = copy_file_range(sourceFd, &offset, destFd, nullptr,
+                                        std::min<uint64_t>(length, KERNEL_COPY_SLICE), 0);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            if (!isUnsupported(errno)) {
+                throw std::runtime_error("Failed to copy to " + destPath + ": " + std::strerror(errno));
+            }
+            useCopyFileRange = false;
+        }
+        else if (count == 0) {
+            throw std::runtime_error("Source ended early while copying to " + destPath);
+        }
+        else {
+            length -= static_cast<uint64_t>(count);
+        }
+    }
+    if (length == 0) {
+        record(TransferStrategy::CopyFileRange, total);
+        return TransferStrategy::CopyFileRange;
+    }
+
+    bool useSendfile = true;
+    while (useSendfile && length > 0) {
+        ssize_t count = sendfile(destFd, sourceFd, &offset, std::min<uint64_t>(length, KERNEL_COPY_SLICE));
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            if (!isUnsupported(errno)) {
+                throw std::runtime_error("Failed to copy to " + destPath + ": " + std::strerror(errno));
+            }
+            useSendfile = false;
+        }
+        else if (count == 0) {
+            throw std::runtime_error("Source ended early while copying to " + destPath);
+        }
+        else {
+            length -= static_cast<uint64_t>(count);
+        }
+    }
+    if (length == 0) {
+        record(TransferStrategy::Sendfile, total);
+        return TransferStrategy::Sendfile;
+    }
+
+    std::vector<char> buffer(std::min<uint64_t>(length, BUFFER_SIZE));
+    while (length > 0) {
+        ssize_t count = pread(sourceFd, buffer.data(), std::min<uint64_t>(length, buffer.size()), offset);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Failed to read while copying to " + destPath + ": " + std::strerror(errno));
+        }
+        if (count == 0) {
+            throw std::runtime_error("Source ended early while copying to " + destPath);
+        }
+        offset += count;
+        length -= static_cast<uint64_t>(count);
+
+        const char* data = buffer.data();
+        while (count > 0) {
+            ssize_t written = ::write(destFd, data, count);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error("Failed to write file: " + destPath + ": " + std::strerror(errno));
+            }
+            data += written;
+            count -= written;
+        }
+    }
+    record(TransferStrategy::BufferCopy, total);
+    return TransferStrategy::BufferCopy;
+}
+
+TransferStrategy FileTransfer::copyFile(const std::string& source, const std::string& dest) {
+    recordfile::FileDescriptor sourceFd(::open(source.c_str(), O_RDONLY | O_CLOEXEC));
+    struct stat info;
+    if (sourceFd.get() < 0 || fstat(sourceFd.get(), &info) != 0) {
+        throw std::runtime_error("Cannot open file: " + source);
+    }
+
+    // Truncating the destination would destroy a source that is the same file
+    struct stat destInfo;
+    if (stat(dest.c_str(), &destInfo) == 0 && destInfo.st_dev == info.st_dev && destInfo.st_ino == info.st_ino) {
+        throw std::runtime_error("Source and destination are the same file: " + dest);
+    }
+
+    recordfile::FileDescriptor destFd(
+        ::open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, info.st_mode & 07777));
+    if (destFd.get() < 0) {
+        throw std::runtime_error("Cannot open file for writing: " + dest);
+    }
+    // An existing destination keeps its inode but takes the source's mode
+    fchmod(destFd.get(), info.st_mode & 07777);
+
+    TransferStrategy strategy = copyWholeFile(sourceFd.get(), destFd.get(),
+                                              static_cast<uint64_t>(info.st_size), dest);
+    if (::close(destFd.release()) != 0) {
+        throw std::runtime_error("Failed to write file: " + dest);
+    }
+    return strategy;
+}
+
+TransferStrategy FileTransfer::copyWholeFile(int sourceFd, int destFd, uint64_t size,
+                                             const std::string& destPath) {
+#ifdef FICLONE
+    // A reflink shares the source's extents, so no data is copied at all.
+    // It clones the whole source, which is only right if size covers it.
+    struct stat info;
+    if (fstat(sourceFd, &info) == 0 && static_cast<uint64_t>(info.st_size) == size &&
+        ioctl(destFd, FICLONE, sourceFd) == 0) {
+        record(TransferStrategy::Reflink, size);
+        return TransferStrategy::Reflink;
+    }
+#endif
+    return copyRange(sourceFd, 0, destFd, size, destPath);
+}
+
+TransferStats FileTransfer::getStats() {
+    TransferStats stats;
+    for (size_t i = 0; i < TRANSFER_STRATEGY_COUNT; i++) {
+        stats.transfers[i] = transferCounts[i];
+        stats.bytes[i] = transferBytes[i];
+    }
+    return stats;
+}
+
+void FileTransfer::resetStats() {
+    for (size_t i = 0; i < TRANSFER_STRATEGY_COUNT; i++) {
+        transferCounts[i] = 0;
+        transferBytes[i] = 0;
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef FILE_TRANSFER_HPP
+#define FILE_TRANSFER_HPP
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Ways of moving bytes between files, cheapest first. Each is tried in turn
+// and the first one the filesystem supports does the copy.
+enum class TransferStrategy {
+    Reflink,        // FICLONE: the destination shares the source's extents
+    CopyFileRange,  // copy_file_range: copied inside the kernel
+    Sendfile,       // sendfile: copied inside the kernel, older kernels
+    BufferCopy      // read/write through a userspace buffer
+};
+
+constexpr size_t TRANSFER_STRATEGY_COUNT = 4;
+
+std::string transferStrategyName(TransferStrategy strategy);
+
+// Process-wide count of completed transfers and bytes per strategy
+struct TransferStats {
+    uint64_t transfers[TRANSFER_STRATEGY_COUNT] = {};
+    uint64_t bytes[TRANSFER_STRATEGY_COUNT] = {};
+};
+
+class FileTransfer {
+public:
+    // Replaces dest with a copy of source; throws on failure
+    static TransferStrategy copyFile(const std::string& source, const std::string& dest);
+
+    // Copies the first size bytes of sourceFd into the empty file destFd,
+    // sharing extents with a reflink when the filesystem allows it
+    static TransferStrategy copyWholeFile(int sourceFd, int destFd, uint64_t size,
+                                          const std::string& destPath);
+
+    // Copies length bytes starting at sourceOffset into destFd at its current
+    // position. Reflinks need whole files, so this starts at copy_file_range.
+    static TransferStrategy copyRange(int sourceFd, uint64_t sourceOffset, int destFd,
+                                      uint64_t length, const std::string& destPath);
+
+    static TransferStats getStats();
+    static void resetStats();
+};
+
+#endif // FILE_TRANSFER_HPP
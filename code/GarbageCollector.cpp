@@ -0,0 +1,158 @@
+#include "GarbageCollector.hpp"
+#include <iostream>
+#include <sys/stat.h>
+
+namespace {
+
+// Removes the file if it was last modified before the cutoff, adding the
+// bytes freed to reclaimed
+bool removeIfOlder(const std::string& path, std::time_t cutoff, uint64_t& reclaimed) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0 || info.st_mtime >= cutoff) {
+        return false;
+    }
+    std::error_code ec;
+    if (!fs::remove(path, ec)) {
+        return false;
+    }
+    reclaimed += static_cast<uint64_t>(info.st_size);
+    return true;
+}
+
+uint64_t fileSize(const std::string& path) {
+    std::error_code ec;
+    uint64_t size = fs::file_size(path, ec);
+    return ec ? 0 : size;
+}
+
+} // namespace
+
+std::unordered_set<ObjectId> GarbageCollector::markReachable(GcStats& stats) {
+    ThreadPool pool(markThreads);
+    std::vector<ObjectRoot> roots = readObjectRoots(commitLog, vaultPath, BRANCHES_DIR, STAGING_INDEX_FILE, pool);
+
+    std::unordered_set<ObjectId> reachable;
+    std::vector<ObjectId> frontier;
+    for (const auto& root : roots) {
+        if (!root.error.empty()) {
+            throw std::runtime_error(root.error + "; refusing to collect garbage");
+        }
+        for (const auto& hash : root.hashes) {
+            if (reachable.insert(hash).second) {
+                frontier.push_back(hash);
+            }
+        }
+    }
+
+    // Follow references one level at a time: reading the objects of a level
+    // runs in parallel, and merging into the set stays single-threaded
+    while (!frontier.empty()) {
+        std::vector<std::vector<ObjectId>> references(frontier.size());
+        std::vector<char> missing(frontier.size(), 0);
+        pool.parallelFor(frontier.size(), [&](size_t i) {
+            if (!fileManager.hasObject(frontier[i])) {
+                missing[i] = 1;
+                return;
+            }
+            references[i] = fileManager.getObjectReferences(frontier[i]);
+        });
+
+        std::vector<ObjectId> next;
+        for (size_t i = 0; i < frontier.size(); i++) {
+            if (missing[i]) {
+                std::cerr << "Referenced object is missing: " << frontier[i].toHex() << std::endl;
+                stats.missingObjects++;
+            }
+            for (const auto& hash : references[i]) {
+                if (reachable.insert(hash).second) {
+                    next.push_back(hash);
+                }
+            }
+        }
+        frontier.swap(next);
+    }
+
+    stats.reachableObjects = reachable.size() - stats.missingObjects;
+    return reachable;
+}
+
+void GarbageCollector::sweepLooseObjects(const std::unordered_set<ObjectId>& reachable,
+                                         std::time_t cutoff, GcStats& stats) {
+    std::string objectsPath = fileManager.getObjectsPath();
+    for (const auto& entry : fs::directory_iterator(objectsPath)) {
+        if (!entry.is_regular_file()) continue;
+        std::string name = entry.path().filename().string();
+
+        // Temporary files older than the grace period were left by an
+        // ingest that never finished
+        bool abandoned = name.rfind("tmp-", 0) == 0;
+        ObjectId id;
+        if (!abandoned && (!isObjectName(name) || !ObjectId::parse(name, id) || reachable.count(id))) continue;
+
+        if (removeIfOlder(entry.path().string(), cutoff, stats.reclaimedBytes) && !abandoned) {
+            stats.removedObjects++;
+        }
+    }
+}
+
+void GarbageCollector::sweepPacks(const std::unordered_set<ObjectId>& reachable,
+                                  std::time_t cutoff, GcStats& stats) {
+    PackManager& packs = fileManager.getPackManager();
+
+    for (const auto& pack : packs.getPacks()) {
+        std::vector<PackInput> live;
+        size_t dead = 0;
+        for (const auto& entry : pack->listEntries()) {
+            if (reachable.count(entry.hash)) {
+                live.push_back({entry.hash, "", PackedObject{pack, entry.offset, entry.length}});
+            }
+            else {
+                dead++;
+            }
+        }
+        if (dead == 0) continue;
+
+        // A pack that was written or reused recently may hold objects a
+        // commit in progress depends on
+        std::string dataPath = packs.getDataPath(pack->getName());
+        struct stat info;
+        if (stat(dataPath.c_str(), &info) != 0 || info.st_mtime >= cutoff) continue;
+
+        uint64_t oldSize = fileSize(dataPath) + fileSize(packs.getIndexPath(pack->getName()));
+        uint64_t newSize = 0;
+        if (!live.empty()) {
+            std::string name = packs.writePack(live);
+            newSize = fileSize(packs.getDataPath(name)) + fileSize(packs.getIndexPath(name));
+        }
+        packs.removePack(pack->getName());
+
+        stats.removedObjects += dead;
+        stats.rewrittenPacks++;
+        if (oldSize > newSize) stats.reclaimedBytes += oldSize - newSize;
+    }
+
+    fs::path packPath = fs::path(fileManager.getObjectsPath()) / "pack";
+    if (fs::exists(packPath)) {
+        for (const auto& entry : fs::directory_iterator(packPath)) {
+            if (entry.path().filename().string().rfind("tmp-", 0) == 0) {
+                removeIfOlder(entry.path().string(), cutoff, stats.reclaimedBytes);
+            }
+        }
+    }
+}
+
+GcStats GarbageCollector::collect(uint64_t graceSeconds) {
+    GcStats stats;
+    std::time_t cutoff = std::time(nullptr) - static_cast<std::time_t>(graceSeconds);
+
+    // Marking finishes before anything is deleted, so an unreadable root
+    // aborts the whole collection
+    auto reachable = markReachable(stats);
+    sweepLooseObjects(reachable, cutoff, stats);
+    sweepPacks(reachable, cutoff, stats);
+    return stats;
+}
+
+void GarbageCollector::setMarkThreads(size_t threadCount) {
+    markThreads = threadCount == 0 ? 1 : threadCount;
+}
@@ -0,0 +1,63 @@
+#ifndef GARBAGE_COLLECTOR_HPP
+#define GARBAGE_COLLECTOR_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <ctime>
+#include <filesystem>
+#include "FileManager.hpp"
+#include "ObjectRoots.hpp"
+
+namespace fs = std::filesystem;
+
+struct GcStats {
+    size_t reachableObjects = 0;
+    size_t missingObjects = 0;
+    size_t removedObjects = 0;
+    size_t rewrittenPacks = 0;
+    uint64_t reclaimedBytes = 0;
+};
+
+// Mark-and-sweep over the object store. Everything named by a commit, a
+// branch state or the staging index is live, along with the chunks and
+// delta bases those objects need; anything else older than the grace
+// period is deleted. The grace period protects objects written by a
+// commit that has not been recorded yet.
+class GarbageCollector {
+private:
+    std::string vaultPath;
+    CommitLog& commitLog;
+    const std::string BRANCHES_DIR;
+    const std::string STAGING_INDEX_FILE;
+    FileManager& fileManager;
+    size_t markThreads;
+
+    std::unordered_set<ObjectId> markReachable(GcStats& stats);
+    void sweepLooseObjects(const std::unordered_set<ObjectId>& reachable,
+                           std::time_t cutoff, GcStats& stats);
+    void sweepPacks(const std::unordered_set<ObjectId>& reachable,
+                    std::time_t cutoff, GcStats& stats);
+
+public:
+    static constexpr uint64_t DEFAULT_GRACE_SECONDS = 24 * 60 * 60;
+
+    GarbageCollector(const std::string& basePath,
+                     CommitLog& log,
+                     const std::string& branchesDir,
+                     const std::string& stagingIndexFile,
+                     FileManager& fm)
+        : vaultPath(basePath)
+        , commitLog(log)
+        , BRANCHES_DIR(branchesDir)
+        , STAGING_INDEX_FILE(stagingIndexFile)
+        , fileManager(fm)
+        , markThreads(ThreadPool::defaultThreadCount())
+    {}
+
+    // Throws without deleting anything if any root cannot be read
+    GcStats collect(uint64_t graceSeconds);
+    void setMarkThreads(size_t threadCount);
+};
+
+#endif // GARBAGE_COLLECTOR_HPP
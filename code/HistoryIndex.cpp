@@ -0,0 +1,206 @@
+#include "HistoryIndex.hpp"
+#include "ObjectFormat.hpp"
+#include "RecordFile.hpp"
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace {
+
+const char HISTORY_MAGIC[8] = {'V', 'A', 'U', 'L', 'T', 'H', 'I', 1};
+constexpr size_t RECORD_HEADER_SIZE = 8;
+
+void appendString(std::string& out, const std::string& value) {
+    char length[4];
+    putUint32(length, static_cast<uint32_t>(value.size()));
+    out.append(length, sizeof(length));
+    out.append(value);
+}
+
+std::string encodeRecord(const CommitInfo& commit) {
+    std::string payload;
+    appendString(payload, commit.commitId);
+    appendString(payload, commit.message);
+    char number[8];
+    putUint64(number, static_cast<uint64_t>(commit.timestamp));
+    payload.append(number, 8);
+    putUint32(number, static_cast<uint32_t>(commit.fileHashes.size()));
+    payload.append(number, 4);
+    for (const auto& [path, hash] : commit.fileHashes) {
+        appendString(payload, path);
+        payload.append(reinterpret_cast<const char*>(hash.data()), ObjectId::SIZE);
+    }
+
+    char header[RECORD_HEADER_SIZE];
+    putUint32(header, static_cast<uint32_t>(payload.size()));
+    putUint32(header + 4, recordfile::recordChecksum(payload.data(), payload.size()));
+    return std::string(header, sizeof(header)) + payload;
+}
+
+// False if the payload is cut short
+bool decodeRecord(const char* data, size_t length, CommitInfo& commit) {
+    size_t offset = 0;
+    auto readString = [&](std::string& value) {
+        if (length - offset < 4 || length - offset - 4 < getUint32(data + offset)) {
+            return false;
+        }
+        uint32_t count = getUint32(data + offset);
+        value.assign(data + offset + 4, count);
+        offset += 4 + count;
+        return true;
+    };
+
+    if (!readString(commit.commitId) || !readString(commit.message) || length - offset < 12) {
+        return false;
+    }
+    commit.timestamp = static_cast<std::time_t>(getUint64(data + offset));
+    uint32_t count = getUint32(data + offset + 8);
+    offset += 12;
+    for (uint32_t i = 0; i < count; i++) {
+        std::string path;
+        if (!readString(path) || length - offset < ObjectId::SIZE) {
+            return false;
+        }
+        commit.fileHashes[path] = ObjectId(reinterpret_cast<const unsigned char*>(data + offset));
+        offset += ObjectId::SIZE;
+    }
+    return offset == length;
+}
+
+} // namespace
+
+HistoryIndex::HistoryIndex(const std::string& path, CommitLog& log)
+    : indexPath(path), commitLog(log), indexFd(-1), validEnd(recordfile::RECORD_MAGIC_SIZE) {}
+
+HistoryIndex::~HistoryIndex() {
+    if (indexFd >= 0) ::close(indexFd);
+}
+
+void HistoryIndex::open() {
+    if (indexFd < 0) {
+        indexFd = recordfile::openRecordFile(indexPath, HISTORY_MAGIC);
+    }
+}
+
+void HistoryIndex::addCommit(const CommitInfo& commit) {
+    // New commits nearly always carry the latest timestamp, so the search
+    // from the back ends at once
+    for (const auto& [path, hash] : commit.fileHashes) {
+        auto& list = versions[path];
+        auto position = list.end();
+        while (position != list.begin() && std::prev(position)->timestamp > commit.timestamp) {
+            --position;
+        }
+        list.insert(position, {commits.size(), hash, commit.timestamp});
+    }
+    commits.push_back({commit.commitId, commit.message});
+}
+
+void HistoryIndex::readNewRecords() {
+    uint64_t size = recordfile::fileSize(indexFd, indexPath);
+    if (size <= validEnd) {
+        return;
+    }
+
+    std::string data(size - validEnd, '\0');
+    if (pread(indexFd, &data[0], data.size(), validEnd) != static_cast<ssize_t>(data.size())) {
+        throw std::runtime_error("Failed to read history index: " + indexPath);
+    }
+
+    // Stop at the first record that is cut short or fails its checksum;
+    // the next writer cuts it off
+    size_t position = 0;
+    while (data.size() - position >= RECORD_HEADER_SIZE) {
+        const char* record = data.data() + position;
+        uint32_t length = getUint32(record);
+        CommitInfo commit;
+        if (length > data.size() - position - RECORD_HEADER_SIZE ||
+            getUint32(record + 4) != recordfile::recordChecksum(record + RECORD_HEADER_SIZE, length) ||
+            !decodeRecord(record + RECORD_HEADER_SIZE, length, commit)) {
+            break;
+        }
+        addCommit(commit);
+        position += RECORD_HEADER_SIZE + length;
+    }
+    validEnd += position;
+}
+
+void HistoryIndex::update() {
+    // Cheap check first, under shared locks only: usually nothing was
+    // appended to the log since the last query
+    {
+        std::shared_lock<std::shared_mutex> lock(indexMutex);
+        if (indexFd >= 0 && commitLog.countCommits() == commits.size()) {
+            return;
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> lock(indexMutex);
+    open();
+    readNewRecords();
+    if (commitLog.countCommits() == commits.size()) {
+        return;
+    }
+
+    recordfile::FileLock fileLock(indexFd);
+    readNewRecords();
+    std::vector<std::string> missing = commitLog.listCommits(commits.size());
+    if (missing.empty()) {
+        return;
+    }
+
+    if (recordfile::fileSize(indexFd, indexPath) > validEnd && ftruncate(indexFd, validEnd) != 0) {
+        throw std::runtime_error("Failed to truncate history index: " + indexPath);
+    }
+
+    std::string records;
+    for (const auto& commitId : missing) {
+        auto commit = commitLog.read(commitId);
+        if (!commit) {
+            throw std::runtime_error("Commit vanished from the log: " + commitId);
+        }
+        records += encodeRecord(*commit);
+        addCommit(*commit);
+    }
+    recordfile::writeAt(indexFd, records, validEnd, indexPath);
+    validEnd += records.size();
+}
+
+size_t HistoryIndex::forEachVersion(const std::string& path,
+                                    const std::function<bool(const HistoryEntry&)>& visit,
+                                    size_t skip, size_t limit) {
+    update();
+
+    std::shared_lock<std::shared_mutex> lock(indexMutex);
+    auto found = versions.find(path);
+    if (found == versions.end()) {
+        return 0;
+    }
+
+    const auto& list = found->second;
+    size_t visited = 0;
+    for (auto it = list.rbegin() + std::min(skip, list.size()); it != list.rend() && visited < limit; ++it) {
+        const Commit& commit = commits[it->commit];
+        visited++;
+        if (!visit({commit.commitId, commit.message, it->hash, it->timestamp})) break;
+    }
+    return visited;
+}
+
+std::vector<HistoryEntry> HistoryIndex::getVersions(const std::string& path, size_t skip, size_t limit) {
+    std::vector<HistoryEntry> result;
+    forEachVersion(path, [&](const HistoryEntry& entry) {
+        result.push_back(entry);
+        return true;
+    }, skip, limit);
+    return result;
+}
+
+size_t HistoryIndex::countVersions(const std::string& path) {
+    update();
+
+    std::shared_lock<std::shared_mutex> lock(indexMutex);
+    auto found = versions.find(path);
+    return found == versions.end() ? 0 : found->second.size();
+}
@@ -0,0 +1,80 @@
+#ifndef HISTORY_INDEX_HPP
+#define HISTORY_INDEX_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <shared_mutex>
+#include <ctime>
+#include <cstdint>
+#include "CommitLog.hpp"
+#include "ObjectId.hpp"
+
+// One recorded version of a path
+struct HistoryEntry {
+    std::string commitId;
+    std::string message;
+    ObjectId hash;
+    std::time_t timestamp;
+};
+
+// Map from path to every version of it the commit log records, kept in
+// time order. It is derived from the log and kept in an append-only file
+// next to it, one record per commit in log order, so a process loads it
+// with one read and only decodes commits appended since it was last
+// extended, by this or any other process.
+//   record: u32 payload length, u32 CRC-32, payload
+//   payload: commit id, message, u64 timestamp, u32 count, then (path,
+//   32-byte digest) per file; strings are u32 length + bytes
+class HistoryIndex {
+private:
+    struct Commit {
+        std::string commitId;
+        std::string message;
+    };
+    struct Version {
+        size_t commit;
+        ObjectId hash;
+        std::time_t timestamp;
+    };
+
+    std::string indexPath;
+    CommitLog& commitLog;
+    int indexFd;
+    // End of the last intact record in the index file
+    uint64_t validEnd;
+    // Every indexed commit in log order; versions refer to them by position
+    std::vector<Commit> commits;
+    // Versions oldest first; equal timestamps keep log order
+    std::unordered_map<std::string, std::vector<Version>> versions;
+    mutable std::shared_mutex indexMutex;
+
+    void open();
+    void readNewRecords();
+    void addCommit(const CommitInfo& commit);
+
+public:
+    HistoryIndex(const std::string& path, CommitLog& log);
+    ~HistoryIndex();
+
+    HistoryIndex(const HistoryIndex&) = delete;
+    HistoryIndex& operator=(const HistoryIndex&) = delete;
+
+    // Adds commits appended to the log since the last update; throws if
+    // one cannot be read
+    void update();
+
+    // Calls visit with the versions of path, newest first, skipping the
+    // first `skip` and stopping after `limit` or when visit returns false.
+    // Returns how many were visited. visit must not call back into the
+    // index.
+    size_t forEachVersion(const std::string& path,
+                          const std::function<bool(const HistoryEntry&)>& visit,
+                          size_t skip = 0, size_t limit = SIZE_MAX);
+    std::vector<HistoryEntry> getVersions(const std::string& path,
+                                          size_t skip = 0, size_t limit = SIZE_MAX);
+    size_t countVersions(const std::string& path);
+};
+
+#endif // HISTORY_INDEX_HPP
@@ -0,0 +1,66 @@
+#ifndef INTEGRITY_CHECKER_HPP
+#define INTEGRITY_CHECKER_HPP
+
+#include <string>
+#include <vector>
+#include <filesystem>
+#include "FileManager.hpp"
+#include "ObjectRoots.hpp"
+
+namespace fs = std::filesystem;
+
+struct VerifyStats {
+    size_t rootsChecked = 0;
+    size_t objectsChecked = 0;
+    uint64_t bytesChecked = 0;
+    size_t corruptObjects = 0;
+    size_t missingObjects = 0;
+    size_t unreadableRoots = 0;
+    double seconds = 0;
+    // One line per problem found, in no particular order
+    std::vector<std::string> problems;
+
+    bool isClean() const { return problems.empty(); }
+    double megabytesPerSecond() const;
+    double objectsPerSecond() const;
+};
+
+// Checks every stored object against its name and every object named by a
+// commit or branch state for presence. Objects are rehashed on a thread
+// pool; each worker streams one object at a time, so memory stays bounded
+// by the thread count rather than the size of the vault.
+class IntegrityChecker {
+private:
+    std::string vaultPath;
+    CommitLog& commitLog;
+    const std::string BRANCHES_DIR;
+    const std::string STAGING_INDEX_FILE;
+    FileManager& fileManager;
+    size_t threads;
+
+    struct StoredObject {
+        ObjectId hash;
+        std::string pack;
+        uint64_t offset;
+    };
+    std::vector<StoredObject> listObjects();
+
+public:
+    IntegrityChecker(const std::string& basePath,
+                     CommitLog& log,
+                     const std::string& branchesDir,
+                     const std::string& stagingIndexFile,
+                     FileManager& fm)
+        : vaultPath(basePath)
+        , commitLog(log)
+        , BRANCHES_DIR(branchesDir)
+        , STAGING_INDEX_FILE(stagingIndexFile)
+        , fileManager(fm)
+        , threads(ThreadPool::defaultThreadCount())
+    {}
+
+    VerifyStats verify();
+    void setThreads(size_t threadCount);
+};
+
+#endif // INTEGRITY_CHECKER_HPP
@@ -0,0 +1,134 @@
+#ifndef LRU_CACHE_HPP
+#define LRU_CACHE_HPP
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+
+struct CacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t entries = 0;
+    // Estimated memory held by the cached values, and the limit on it
+    size_t bytes = 0;
+    size_t capacityBytes = 0;
+
+    double hitRate() const {
+        return hits + misses > 0 ? static_cast<double>(hits) / (hits + misses) : 0;
+    }
+};
+
+// Thread-safe least-recently-used cache bounded by the estimated size of
+// its values rather than their count, since one branch state can be a
+// thousand times larger than one commit. Values are shared immutably, so a
+// hit costs a reference count instead of a copy under the lock. A value
+// larger than the whole budget is simply not cached.
+template <typename Key, typename Value>
+class LruCache {
+public:
+    using ValuePtr = std::shared_ptr<const Value>;
+
+private:
+    struct Entry {
+        Key key;
+        ValuePtr value;
+        size_t bytes;
+    };
+
+    std::list<Entry> order;  // most recently used first
+    std::unordered_map<Key, typename std::list<Entry>::iterator> entries;
+    size_t capacityBytes;
+    size_t bytes;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    mutable std::mutex cacheMutex;
+
+    void evictTo(size_t limit) {
+        while (bytes > limit && !order.empty()) {
+            bytes -= order.back().bytes;
+            entries.erase(order.back().key);
+            order.pop_back();
+            evictions++;
+        }
+    }
+
+public:
+    explicit LruCache(size_t capacity)
+        : capacityBytes(capacity), bytes(0), hits(0), misses(0), evictions(0) {}
+
+    LruCache(const LruCache&) = delete;
+    LruCache& operator=(const LruCache&) = delete;
+
+    // Null on a miss
+    ValuePtr get(const Key& key) {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        auto found = entries.find(key);
+        if (found == entries.end()) {
+            misses++;
+            return nullptr;
+        }
+        hits++;
+        order.splice(order.begin(), order, found->second);
+        return found->second->value;
+    }
+
+    void put(const Key& key, ValuePtr value, size_t valueBytes) {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        auto found = entries.find(key);
+        if (found != entries.end()) {
+            bytes -= found->second->bytes;
+            order.erase(found->second);
+            entries.erase(found);
+        }
+        if (valueBytes > capacityBytes) {
+            return;
+        }
+
+        evictTo(capacityBytes - valueBytes);
+        order.push_front(Entry{key, std::move(value), valueBytes});
+        entries[key] = order.begin();
+        bytes += valueBytes;
+    }
+
+    void erase(const Key& key) {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        auto found = entries.find(key);
+        if (found != entries.end()) {
+            bytes -= found->second->bytes;
+            order.erase(found->second);
+            entries.erase(found);
+        }
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        order.clear();
+        entries.clear();
+        bytes = 0;
+    }
+
+    void setCapacity(size_t capacity) {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        capacityBytes = capacity;
+        evictTo(capacityBytes);
+    }
+
+    CacheStats getStats() const {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        CacheStats stats;
+        stats.hits = hits;
+        stats.misses = misses;
+        stats.evictions = evictions;
+        stats.entries = entries.size();
+        stats.bytes = bytes;
+        stats.capacityBytes = capacityBytes;
+        return stats;
+    }
+};
+
+#endif // LRU_CACHE_HPP
@@ -0,0 +1,95 @@
+#include "MergeManager.hpp"
+#include <stdexcept>
+#include <set>
+
+std::shared_ptr<const CommitInfo> MergeManager::readCommit(const std::string& commitId) {
+    if (commitId.empty()) {
+        return std::make_shared<const CommitInfo>();
+    }
+    auto commit = commitLog.read(commitId);
+    if (!commit) {
+        throw std::runtime_error("Commit does not exist: " + commitId);
+    }
+    return commit;
+}
+
+std::vector<FileChange> MergeManager::diff(const std::string& fromCommit, const std::string& toCommit) {
+    auto from = readCommit(fromCommit);
+    auto to = readCommit(toCommit);
+    // Commits from before snapshots only know the files they changed, so
+    // what else they held is unknown
+    for (const auto* commit : {from.get(), to.get()}) {
+        if (!commit->commitId.empty() && commit->tree.isNull()) {
+            throw std::runtime_error("Commit has no snapshot: " + commit->commitId);
+        }
+    }
+    return treeManager.diff(from->tree, to->tree);
+}
+
+MergeResult MergeManager::merge(const std::string& ours, const std::string& theirs) {
+    MergeResult result;
+    if (ours.empty()) {
+        result.fastForward = true;
+        result.changes = diff("", theirs);
+        return result;
+    }
+    if (commitGraph.isAncestor(theirs, ours)) {
+        result.base = theirs;
+        result.upToDate = true;
+        return result;
+    }
+
+    result.base = commitGraph.mergeBase(ours, theirs);
+    if (result.base == ours) {
+        result.fastForward = true;
+        result.changes = diff(ours, theirs);
+        return result;
+    }
+
+    // Both diffs are sorted by path, so one pass pairs them up. A change
+    // only theirs made applies as is: ours still has the base's version.
+    std::vector<FileChange> ourChanges = diff(result.base, ours);
+    std::vector<FileChange> theirChanges = diff(result.base, theirs);
+
+    // A path one side changed inside a directory whose name the other side
+    // changed as a file, or the other way round, cannot be taken alone
+    std::set<std::string> ourPaths;
+    for (const auto& change : ourChanges) {
+        ourPaths.insert(change.path);
+    }
+    auto crossesOurs = [&](const std::string& path) {
+        for (size_t slash = path.find('/'); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+            if (ourPaths.count(path.substr(0, slash)) > 0) {
+                return true;
+            }
+        }
+        std::string prefix = path + "/";
+        auto inside = ourPaths.lower_bound(prefix);
+        return inside != ourPaths.end() && inside->compare(0, prefix.size(), prefix) == 0;
+    };
+
+    size_t i = 0;
+    size_t j = 0;
+    while (j < theirChanges.size()) {
+        if (i < ourChanges.size() && ourChanges[i].path < theirChanges[j].path) {
+            i++;
+        }
+        else if (i == ourChanges.size() || theirChanges[j].path < ourChanges[i].path) {
+            if (crossesOurs(theirChanges[j].path)) {
+                result.conflicts.push_back(theirChanges[j].path);
+            }
+            else {
+                result.changes.push_back(theirChanges[j]);
+            }
+            j++;
+        }
+        else {
+            if (ourChanges[i].to != theirChanges[j].to) {
+                result.conflicts.push_back(theirChanges[j].path);
+            }
+            i++;
+            j++;
+        }
+    }
+    return result;
+}
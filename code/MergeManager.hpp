@@ -0,0 +1,55 @@
+#ifndef MERGE_MANAGER_HPP
+#define MERGE_MANAGER_HPP
+
+#include <string>
+#include <vector>
+#include "CommitLog.hpp"
+#include "CommitGraph.hpp"
+#include "TreeManager.hpp"
+
+struct MergeResult {
+    // Best common ancestor; empty if the histories never meet
+    std::string base;
+    // The other commit is already in the branch's history
+    bool upToDate = false;
+    // The branch is in the other commit's history and can simply move to it
+    bool fastForward = false;
+    // Takes the branch head to the merged snapshot, sorted by path
+    std::vector<FileChange> changes;
+    // Paths both sides changed differently since the base, and paths one
+    // side changed inside a directory the other changed as a file
+    std::vector<std::string> conflicts;
+};
+
+// Compares snapshots and plans three-way merges. Snapshot diffs pair the
+// sorted entries of both sides in one pass and skip directories whose hash
+// matches, so they cost in proportion to what changed. A merge diffs the
+// merge base against each side and takes every change only one side made;
+// a path both sides changed to different content is a conflict, as is a
+// file on one side where the other changed something under that name.
+class MergeManager {
+private:
+    CommitLog& commitLog;
+    CommitGraph& commitGraph;
+    TreeManager& treeManager;
+
+    // An empty id stands for the empty snapshot
+    std::shared_ptr<const CommitInfo> readCommit(const std::string& commitId);
+
+public:
+    MergeManager(CommitLog& log, CommitGraph& graph, TreeManager& tm)
+        : commitLog(log)
+        , commitGraph(graph)
+        , treeManager(tm)
+    {}
+
+    // Both throw on failure.
+    // Files that differ from one commit's snapshot to another's; commits
+    // from before snapshots are refused, as is merging them
+    std::vector<FileChange> diff(const std::string& fromCommit, const std::string& toCommit);
+    // How to merge theirs into a branch whose head is ours, which may be
+    // empty for a branch without commits; nothing is written
+    MergeResult merge(const std::string& ours, const std::string& theirs);
+};
+
+#endif // MERGE_MANAGER_HPP
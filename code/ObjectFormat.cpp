@@ -0,0 +1,138 @@
+#include "ObjectFormat.hpp"
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+const char MAGIC[6] = {'\0', 'V', 'A', 'U', 'L', 'T'};
+const uint8_t FORMAT_VERSION = 1;
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+} // namespace
+
+void ObjectHeader::encode(char* out) const {
+    std::memset(out, 0, ENCODED_SIZE);
+    std::memcpy(out, MAGIC, sizeof(MAGIC));
+    out[6] = static_cast<char>(FORMAT_VERSION);
+    out[7] = static_cast<char>(type);
+    out[8] = static_cast<char>(codec);
+    putUint64(out + 16, originalSize);
+}
+
+bool ObjectHeader::decode(const char* data, size_t length, ObjectHeader& header) {
+    if (length < ENCODED_SIZE || !hasMagic(data, length)) {
+        return false;
+    }
+    if (static_cast<uint8_t>(data[6]) != FORMAT_VERSION) {
+        return false;
+    }
+
+    header.type = static_cast<ObjectType>(data[7]);
+    header.codec = static_cast<uint8_t>(data[8]);
+    header.originalSize = getUint64(data + 16);
+    return true;
+}
+
+bool ObjectHeader::hasMagic(const char* data, size_t length) {
+    return length >= sizeof(MAGIC) && std::memcmp(data, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+void putUint32(char* out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+}
+
+void putUint64(char* out, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        out[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+}
+
+uint32_t getUint32(const char* data) {
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; i--) {
+        value = (value << 8) | static_cast<unsigned char>(data[i]);
+    }
+    return value;
+}
+
+uint64_t getUint64(const char* data) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) {
+        value = (value << 8) | static_cast<unsigned char>(data[i]);
+    }
+    return value;
+}
+
+std::string bytesToHex(const unsigned char* data, size_t length) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex(length * 2, '\0');
+    for (size_t i = 0; i < length; i++) {
+        hex[i * 2] = digits[data[i] >> 4];
+        hex[i * 2 + 1] = digits[data[i] & 0x0f];
+    }
+    return hex;
+}
+
+bool hexToBytes(const std::string& hex, unsigned char* out, size_t length) {
+    if (hex.size() != length * 2) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        int high = hexValue(hex[i * 2]);
+        int low = hexValue(hex[i * 2 + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        out[i] = static_cast<unsigned char>((high << 4) | low);
+    }
+    return true;
+}
+
+bool isObjectName(const std::string& name) {
+    return name.size() == 64 && name.find_first_not_of("0123456789abcdef") == std::string::npos;
+}
+
+std::string encodeTree(const std::vector<TreeEntry>& entries) {
+    std::string payload;
+    for (const auto& entry : entries) {
+        char field[4];
+        payload.push_back(static_cast<char>(entry.kind));
+        putUint32(field, static_cast<uint32_t>(entry.name.size()));
+        payload.append(field, sizeof(field));
+        payload.append(entry.name);
+        payload.append(reinterpret_cast<const char*>(entry.hash.data()), ObjectId::SIZE);
+    }
+    return payload;
+}
+
+std::vector<TreeEntry> decodeTree(const char* data, size_t length) {
+    std::vector<TreeEntry> entries;
+    size_t offset = 0;
+    while (offset < length) {
+        if (length - offset < 5) {
+            throw std::runtime_error("Corrupt tree: truncated entry");
+        }
+        TreeEntry entry;
+        entry.kind = static_cast<TreeEntryKind>(data[offset]);
+        uint32_t nameLength = getUint32(data + offset + 1);
+        offset += 5;
+        if (length - offset < static_cast<uint64_t>(nameLength) + ObjectId::SIZE ||
+            (entry.kind != TreeEntryKind::File && entry.kind != TreeEntryKind::Tree)) {
+            throw std::runtime_error("Corrupt tree: bad entry");
+        }
+        entry.name.assign(data + offset, nameLength);
+        offset += nameLength;
+        entry.hash = ObjectId(reinterpret_cast<const unsigned char*>(data + offset));
+        offset += ObjectId::SIZE;
+        entries.push_back(std::move(entry));
+    }
+    return entries;
+}
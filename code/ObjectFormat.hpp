@@ -0,0 +1,72 @@
+#ifndef OBJECT_FORMAT_HPP
+#define OBJECT_FORMAT_HPP
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <vector>
+#include "ObjectId.hpp"
+
+// Objects written by older versions are the raw file contents. Anything
+// else starts with this fixed-size header; raw content that happens to begin
+// with the magic is stored as an encoded blob so the two never collide.
+enum class ObjectType : uint8_t {
+    Blob = 1,
+    ChunkManifest = 2,
+    Delta = 3,
+    Tree = 4
+};
+
+// Receives object content in order, one buffer at a time
+using ObjectSink = std::function<void(const char* data, size_t length)>;
+
+struct ObjectHeader {
+    static constexpr size_t ENCODED_SIZE = 24;
+
+    ObjectType type;
+    uint8_t codec;
+    uint64_t originalSize;
+
+    ObjectHeader() : type(ObjectType::Blob), codec(0), originalSize(0) {}
+    ObjectHeader(ObjectType t, uint64_t size) : type(t), codec(0), originalSize(size) {}
+
+    void encode(char* out) const;
+    // Returns false when the bytes are not an encoded header, i.e. the
+    // object is stored raw
+    static bool decode(const char* data, size_t length, ObjectHeader& header);
+    static bool hasMagic(const char* data, size_t length);
+};
+
+// One name in a directory snapshot
+enum class TreeEntryKind : uint8_t {
+    File = 1,
+    Tree = 2
+};
+
+struct TreeEntry {
+    std::string name;
+    TreeEntryKind kind;
+    ObjectId hash;
+};
+
+// Tree object payload: entries sorted by name, each a u8 kind, u32 name
+// length, the name and a 32-byte digest. The object is named by the digest
+// of this payload, so equal directories share one tree.
+std::string encodeTree(const std::vector<TreeEntry>& entries);
+// Throws if the payload is malformed
+std::vector<TreeEntry> decodeTree(const char* data, size_t length);
+
+// Little-endian integer encoding shared by the on-disk formats
+void putUint32(char* out, uint32_t value);
+void putUint64(char* out, uint64_t value);
+uint32_t getUint32(const char* data);
+uint64_t getUint64(const char* data);
+
+std::string bytesToHex(const unsigned char* data, size_t length);
+// Returns false if hex is not exactly 2 * length hex digits
+bool hexToBytes(const std::string& hex, unsigned char* out, size_t length);
+// True for the file name of an object: a 32-byte digest in lowercase hex
+bool isObjectName(const std::string& name);
+
+#endif // OBJECT_FORMAT_HPP
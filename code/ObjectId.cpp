@@ -0,0 +1,24 @@
+#include "ObjectId.hpp"
+#include "ObjectFormat.hpp"
+#include <stdexcept>
+
+bool ObjectId::parse(const std::string& hex, ObjectId& id) {
+    unsigned char digest[SIZE];
+    if (!hexToBytes(hex, digest, SIZE)) {
+        return false;
+    }
+    id = ObjectId(digest);
+    return true;
+}
+
+ObjectId ObjectId::fromHex(const std::string& hex) {
+    ObjectId id;
+    if (!parse(hex, id)) {
+        throw std::runtime_error("Not an object name: " + hex);
+    }
+    return id;
+}
+
+std::string ObjectId::toHex() const {
+    return bytesToHex(bytes.data(), SIZE);
+}
@@ -0,0 +1,55 @@
+#ifndef OBJECT_ID_HPP
+#define OBJECT_ID_HPP
+
+#include <array>
+#include <string>
+#include <cstring>
+#include <cstddef>
+#include <functional>
+
+// Name of a stored object: the 32-byte content digest, held inline. Maps
+// with millions of snapshot entries keep 32 bytes per hash instead of a
+// heap-allocated 64-character string, and compare with one memcmp. Hex is
+// only produced where a name leaves the process: object file names, JSON
+// and messages. The all-zero id means "no object".
+class ObjectId {
+public:
+    static constexpr size_t SIZE = 32;
+
+private:
+    std::array<unsigned char, SIZE> bytes;
+
+public:
+    ObjectId() : bytes{} {}
+    explicit ObjectId(const unsigned char* digest) { std::memcpy(bytes.data(), digest, SIZE); }
+
+    // False, leaving id untouched, unless hex is 64 hex digits
+    static bool parse(const std::string& hex, ObjectId& id);
+    // Throws on anything parse rejects
+    static ObjectId fromHex(const std::string& hex);
+    std::string toHex() const;
+
+    bool isNull() const { return *this == ObjectId(); }
+    const unsigned char* data() const { return bytes.data(); }
+
+    bool operator==(const ObjectId& other) const { return std::memcmp(bytes.data(), other.bytes.data(), SIZE) == 0; }
+    bool operator!=(const ObjectId& other) const { return !(*this == other); }
+    bool operator<(const ObjectId& other) const { return std::memcmp(bytes.data(), other.bytes.data(), SIZE) < 0; }
+
+    // Digest bytes are already uniformly distributed, so any 8 of them
+    // make a good hash
+    size_t hashValue() const {
+        size_t value;
+        std::memcpy(&value, bytes.data(), sizeof(value));
+        return value;
+    }
+};
+
+namespace std {
+template <>
+struct hash<ObjectId> {
+    size_t operator()(const ObjectId& id) const { return id.hashValue(); }
+};
+} // namespace std
+
+#endif // OBJECT_ID_HPP
@@ -0,0 +1,96 @@
+#include "ObjectRoots.hpp"
+#include "StagingIndex.hpp"
+#include "BranchManager.hpp"
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Hashes a branch state names, from its snapshot and journal
+void readStateHashes(ObjectRoot& root) {
+    try {
+        for (const auto& [path, hash] : BranchManager::readStateFiles(fs::path(root.source).parent_path())) {
+            root.hashes.push_back(hash);
+        }
+    }
+    catch (const std::exception& e) {
+        root.error = e.what();
+    }
+}
+
+void readCommitHashes(CommitLog& commitLog, ObjectRoot& root, const std::string& commitId) {
+    try {
+        auto commit = commitLog.read(commitId);
+        if (!commit) {
+            root.error = "Commit vanished from the log: " + commitId;
+            return;
+        }
+        // The tree reaches the rest of the snapshot
+        if (!commit->tree.isNull()) {
+            root.hashes.push_back(commit->tree);
+        }
+        for (const auto& [path, hash] : commit->fileHashes) {
+            root.hashes.push_back(hash);
+        }
+    }
+    catch (const std::exception& e) {
+        root.error = e.what();
+    }
+}
+
+// Staged files are stored before any commit names them
+void readStagedHashes(ObjectRoot& root) {
+    try {
+        for (const auto& file : StagingIndex::readFile(root.source)) {
+            root.hashes.push_back(file.hash);
+        }
+    }
+    catch (const std::exception& e) {
+        root.error = e.what();
+    }
+}
+
+} // namespace
+
+std::vector<ObjectRoot> readObjectRoots(CommitLog& commitLog,
+                                        const std::string& vaultPath,
+                                        const std::string& branchesDir,
+                                        const std::string& stagingIndexFile,
+                                        ThreadPool& pool) {
+    std::vector<std::string> commitIds = commitLog.listCommits();
+    std::vector<ObjectRoot> roots;
+    for (const auto& commitId : commitIds) {
+        roots.push_back({"commit " + commitId, {}, ""});
+    }
+
+    // Branch names with '/' keep their state in nested directories
+    fs::path branchesPath = fs::path(vaultPath) / branchesDir;
+    if (fs::exists(branchesPath)) {
+        for (const auto& entry : fs::recursive_directory_iterator(branchesPath)) {
+            fs::path path = entry.path() / BranchManager::STATE_FILE;
+            if (entry.is_directory() && (fs::exists(path) || fs::exists(entry.path() / BranchManager::JOURNAL_FILE))) {
+                roots.push_back({path.string(), {}, ""});
+            }
+        }
+    }
+
+    size_t stateCount = roots.size() - commitIds.size();
+    fs::path indexPath = fs::path(vaultPath) / stagingIndexFile;
+    if (fs::exists(indexPath)) {
+        roots.push_back({indexPath.string(), {}, ""});
+    }
+
+    pool.parallelFor(roots.size(), [&](size_t i) {
+        if (i < commitIds.size()) {
+            readCommitHashes(commitLog, roots[i], commitIds[i]);
+        }
+        else if (i < commitIds.size() + stateCount) {
+            readStateHashes(roots[i]);
+        }
+        else {
+            readStagedHashes(roots[i]);
+        }
+    });
+    return roots;
+}
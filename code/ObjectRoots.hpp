@@ -0,0 +1,27 @@
+#ifndef OBJECT_ROOTS_HPP
+#define OBJECT_ROOTS_HPP
+
+#include <string>
+#include <vector>
+#include "ThreadPool.hpp"
+#include "CommitLog.hpp"
+
+// A commit, branch state or the staging index and the object hashes it
+// names. error is set, and hashes left empty, when the root could not be
+// read.
+struct ObjectRoot {
+    std::string source;
+    std::vector<ObjectId> hashes;
+    std::string error;
+};
+
+// Reads every commit in the log, every branch state under vaultPath and
+// the staging index, spread across pool. Objects these name, and the
+// objects those need in turn, are the ones the vault must keep.
+std::vector<ObjectRoot> readObjectRoots(CommitLog& commitLog,
+                                        const std::string& vaultPath,
+                                        const std::string& branchesDir,
+                                        const std::string& stagingIndexFile,
+                                        ThreadPool& pool);
+
+#endif // OBJECT_ROOTS_HPP
@@ -0,0 +1,421 @@
+#include "PackManager.hpp"
+#include "ObjectFormat.hpp"
+#include "RecordFile.hpp"
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <openssl/evp.h>
+
+namespace {
+
+// Pack data file: 8-byte magic/version, u32 object count, u32 reserved,
+// then the stored bytes of every object back to back
+const char PACK_MAGIC[8] = {'V', 'A', 'U', 'L', 'T', 'P', 'K', 1};
+constexpr size_t PACK_HEADER_SIZE = 16;
+
+// Pack index: 8-byte magic/version, u32 object count, u32 reserved, a
+// fan-out table whose entry b counts the objects whose first digest byte is
+// at most b, then (digest, u64 offset, u64 length) entries sorted by digest
+const char INDEX_MAGIC[8] = {'V', 'A', 'U', 'L', 'T', 'I', 'X', 1};
+constexpr size_t INDEX_HEADER_SIZE = 16;
+constexpr size_t FANOUT_SIZE = 256 * 4;
+constexpr size_t INDEX_ENTRY_SIZE = PackManager::DIGEST_SIZE + 16;
+
+constexpr size_t COPY_BUFFER_SIZE = 1 << 20;
+
+// A directory modified this close to a scan may change again within the
+// same timestamp tick on filesystems with coarse timestamps
+constexpr int64_t RACY_WINDOW_NS = 2000000000;
+
+int64_t nowNanoseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+void syncAndClose(int fd, const std::string& path) {
+    bool ok = fsync(fd) == 0;
+    ok = ::close(fd) == 0 && ok;
+    if (!ok) {
+        throw std::runtime_error("Failed to flush file: " + path);
+    }
+}
+
+// Appends a whole loose object file and returns its length
+uint64_t copyFromFile(const std::string& objectPath, int dataFd, std::vector<char>& buffer,
+                      const std::string& dataPath) {
+    int objectFd = ::open(objectPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (objectFd < 0) {
+        throw std::runtime_error("Cannot open object: " + objectPath);
+    }
+    uint64_t length = 0;
+    ssize_t count;
+    while ((count = ::read(objectFd, buffer.data(), buffer.size())) != 0) {
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            ::close(objectFd);
+            throw std::runtime_error("Failed to read object: " + objectPath);
+        }
+        recordfile::writeFully(dataFd, buffer.data(), count, dataPath);
+        length += count;
+    }
+    ::close(objectFd);
+    return length;
+}
+
+// Appends an object stored in another pack and returns its length
+uint64_t copyFromPack(const PackedObject& object, int dataFd, std::vector<char>& buffer,
+                      const std::string& dataPath) {
+    uint64_t offset = object.offset;
+    uint64_t remaining = object.length;
+    while (remaining > 0) {
+        ssize_t count = pread(object.pack->getDataFd(), buffer.data(),
+                              std::min<uint64_t>(remaining, buffer.size()), offset);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Failed to read pack: " + object.pack->getName());
+        }
+        if (count == 0) {
+            throw std::runtime_error("Pack is truncated: " + object.pack->getName());
+        }
+        recordfile::writeFully(dataFd, buffer.data(), count, dataPath);
+        offset += count;
+        remaining -= count;
+    }
+    return object.length;
+}
+
+std::string randomSuffix() {
+    std::random_device rd;
+    std::stringstream ss;
+    ss << std::hex << ((static_cast<uint64_t>(rd()) << 32) | rd());
+    return ss.str();
+}
+
+} // namespace
+
+PackFile::PackFile(const std::string& packName, int fd, const char* mappedIndex, size_t mappedSize)
+    : name(packName), dataFd(fd), index(mappedIndex), indexSize(mappedSize),
+      objectCount(getUint32(mappedIndex + 8)) {}
+
+PackFile::~PackFile() {
+    munmap(const_cast<char*>(index), indexSize);
+    ::close(dataFd);
+}
+
+bool PackFile::find(const unsigned char* digest, uint64_t& offset, uint64_t& length) const {
+    // The fan-out table narrows the search to digests sharing the first byte
+    const char* fanout = index + INDEX_HEADER_SIZE;
+    uint32_t low = digest[0] == 0 ? 0 : getUint32(fanout + 4 * (digest[0] - 1));
+    uint32_t high = getUint32(fanout + 4 * digest[0]);
+    const char* entries = fanout + FANOUT_SIZE;
+
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        const char* entry = entries + static_cast<size_t>(middle) * INDEX_ENTRY_SIZE;
+        int order = std::memcmp(entry, digest, PackManager::DIGEST_SIZE);
+        if (order == 0) {
+            offset = getUint64(entry + PackManager::DIGEST_SIZE);
+            length = getUint64(entry + PackManager::DIGEST_SIZE + 8);
+            return true;
+        }
+        if (order < 0) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return false;
+}
+
+std::vector<PackEntry> PackFile::listEntries() const {
+    std::vector<PackEntry> result;
+    result.reserve(objectCount);
+    const char* entries = index + INDEX_HEADER_SIZE + FANOUT_SIZE;
+    for (uint32_t i = 0; i < objectCount; i++) {
+        const char* entry = entries + static_cast<size_t>(i) * INDEX_ENTRY_SIZE;
+        result.push_back({ObjectId(reinterpret_cast<const unsigned char*>(entry)),
+                          getUint64(entry + PackManager::DIGEST_SIZE),
+                          getUint64(entry + PackManager::DIGEST_SIZE + 8)});
+    }
+    return result;
+}
+
+const std::string& PackFile::getName() const {
+    return name;
+}
+
+int PackFile::getDataFd() const {
+    return dataFd;
+}
+
+uint32_t PackFile::getObjectCount() const {
+    return objectCount;
+}
+
+PackManager::PackManager(const std::string& packDirectory)
+    : packPath(packDirectory), loadedRacy(false), loaded(false) {}
+
+void PackManager::loadPacks() {
+    std::error_code ec;
+    loadedStamp = recordfile::fileStamp(packPath);
+    // Until the directory is older than a timestamp tick, an unchanged
+    // stamp does not prove that no pack was added since
+    loadedRacy = loadedStamp.mtimeNs + RACY_WINDOW_NS >= nowNanoseconds();
+    loaded = true;
+
+    // Packs are immutable, so ones already mapped are kept as they are
+    std::map<std::string, std::shared_ptr<const PackFile>> previous;
+    for (const auto& pack : packs) {
+        previous[pack->getName()] = pack;
+    }
+    packs.clear();
+
+    if (loadedStamp.inode == 0) {
+        return;
+    }
+
+    for (const auto& entry : fs::directory_iterator(packPath, ec)) {
+        fs::path indexPath = entry.path();
+        if (indexPath.extension() != ".idx") continue;
+
+        // Packs still being written use a tmp- name
+        std::string name = indexPath.stem().string();
+        if (name.rfind("pack-", 0) != 0) continue;
+
+        auto existing = previous.find(name);
+        if (existing != previous.end()) {
+            packs.push_back(existing->second);
+            continue;
+        }
+
+        std::string dataPath = getDataPath(name);
+        int dataFd = ::open(dataPath.c_str(), O_RDONLY | O_CLOEXEC);
+        int indexFd = ::open(indexPath.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat info;
+        char header[PACK_HEADER_SIZE];
+
+        bool valid = dataFd >= 0 && indexFd >= 0 && fstat(indexFd, &info) == 0 &&
+                     static_cast<size_t>(info.st_size) >= INDEX_HEADER_SIZE + FANOUT_SIZE &&
+                     pread(dataFd, header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header)) &&
+                     std::memcmp(header, PACK_MAGIC, sizeof(PACK_MAGIC)) == 0;
+
+        void* mapped = MAP_FAILED;
+        if (valid) {
+            mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, indexFd, 0);
+            valid = mapped != MAP_FAILED;
+        }
+        if (indexFd >= 0) {
+            ::close(indexFd);
+        }
+
+        if (valid) {
+            const char* index = static_cast<const char*>(mapped);
+            uint32_t count = getUint32(index + 8);
+            valid = std::memcmp(index, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 &&
+                    getUint32(header + 8) == count &&
+                    getUint32(index + INDEX_HEADER_SIZE + FANOUT_SIZE - 4) == count &&
+                    static_cast<size_t>(info.st_size) ==
+                        INDEX_HEADER_SIZE + FANOUT_SIZE + static_cast<size_t>(count) * INDEX_ENTRY_SIZE;
+        }
+
+        if (!valid) {
+            std::cerr << "Skipping unreadable pack: " << name << std::endl;
+            if (mapped != MAP_FAILED) munmap(mapped, info.st_size);
+            if (dataFd >= 0) ::close(dataFd);
+            continue;
+        }
+
+        madvise(mapped, info.st_size, MADV_RANDOM);
+        packs.push_back(std::make_shared<PackFile>(name, dataFd, static_cast<const char*>(mapped), info.st_size));
+    }
+}
+
+bool PackManager::findLoaded(const unsigned char* digest, PackedObject& object) const {
+    for (const auto& pack : packs) {
+        if (pack->find(digest, object.offset, object.length)) {
+            object.pack = pack;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PackManager::find(const ObjectId& hash, PackedObject& object) {
+    {
+        std::shared_lock<std::shared_mutex> lock(packsMutex);
+        if (loaded && findLoaded(hash.data(), object)) {
+            return true;
+        }
+    }
+
+    // A miss is only final if no pack appeared since the last scan
+    recordfile::FileStamp stamp = recordfile::fileStamp(packPath);
+    std::unique_lock<std::shared_mutex> lock(packsMutex);
+    if (!loaded || loadedRacy || stamp != loadedStamp) {
+        loadPacks();
+    }
+    return findLoaded(hash.data(), object);
+}
+
+bool PackManager::contains(const ObjectId& hash) {
+    PackedObject object;
+    return find(hash, object);
+}
+
+std::string PackManager::getDataPath(const std::string& name) const {
+    return (fs::path(packPath) / (name + ".pack")).string();
+}
+
+std::string PackManager::getIndexPath(const std::string& name) const {
+    return (fs::path(packPath) / (name + ".idx")).string();
+}
+
+void PackManager::removePack(const std::string& name) {
+    // The index goes first so no reader discovers a pack without its data
+    fs::remove(getIndexPath(name));
+    fs::remove(getDataPath(name));
+    reload();
+}
+
+bool PackManager::freshen(const ObjectId& hash) {
+    PackedObject object;
+    if (!find(hash, object)) {
+        return false;
+    }
+    utimensat(AT_FDCWD, getDataPath(object.pack->getName()).c_str(), nullptr, 0);
+    return true;
+}
+
+std::vector<std::shared_ptr<const PackFile>> PackManager::getPacks() {
+    std::unique_lock<std::shared_mutex> lock(packsMutex);
+    loadPacks();
+    return packs;
+}
+
+void PackManager::reload() {
+    std::unique_lock<std::shared_mutex> lock(packsMutex);
+    loadPacks();
+}
+
+std::string PackManager::writePack(const std::vector<PackInput>& objects) {
+    std::vector<PackInput> sorted(objects);
+    std::sort(sorted.begin(), sorted.end(),
+              [](const PackInput& a, const PackInput& b) { return a.hash < b.hash; });
+    sorted.erase(std::unique(sorted.begin(), sorted.end(),
+                             [](const PackInput& a, const PackInput& b) { return a.hash == b.hash; }),
+                 sorted.end());
+    if (sorted.empty()) {
+        throw std::runtime_error("No objects to pack");
+    }
+
+    fs::create_directories(packPath);
+    std::string suffix = randomSuffix();
+    std::string tempData = (fs::path(packPath) / ("tmp-" + suffix + ".pack")).string();
+    std::string tempIndex = (fs::path(packPath) / ("tmp-" + suffix + ".idx")).string();
+
+    try {
+        int dataFd = ::open(tempData.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (dataFd < 0) {
+            throw std::runtime_error("Cannot create pack file: " + tempData);
+        }
+
+        std::string index(INDEX_HEADER_SIZE + FANOUT_SIZE, '\0');
+        index.reserve(index.size() + sorted.size() * INDEX_ENTRY_SIZE);
+        uint32_t fanout[256] = {};
+
+        // The pack is named after the digests it holds, so packing the same
+        // set of objects twice yields the same name
+        EVP_MD_CTX* nameCtx = EVP_MD_CTX_new();
+        EVP_DigestInit_ex(nameCtx, EVP_sha256(), nullptr);
+
+        try {
+            char header[PACK_HEADER_SIZE] = {};
+            std::memcpy(header, PACK_MAGIC, sizeof(PACK_MAGIC));
+            putUint32(header + 8, static_cast<uint32_t>(sorted.size()));
+            recordfile::writeFully(dataFd, header, sizeof(header), tempData);
+
+            std::vector<char> buffer(COPY_BUFFER_SIZE);
+            uint64_t offset = PACK_HEADER_SIZE;
+            for (const auto& object : sorted) {
+                char entry[INDEX_ENTRY_SIZE];
+                std::memcpy(entry, object.hash.data(), DIGEST_SIZE);
+
+                uint64_t length = object.loosePath.empty()
+                    ? copyFromPack(object.packed, dataFd, buffer, tempData)
+                    : copyFromFile(object.loosePath, dataFd, buffer, tempData);
+
+                putUint64(entry + DIGEST_SIZE, offset);
+                putUint64(entry + DIGEST_SIZE + 8, length);
+                index.append(entry, sizeof(entry));
+                EVP_DigestUpdate(nameCtx, entry, DIGEST_SIZE);
+                fanout[static_cast<unsigned char>(entry[0])]++;
+                offset += length;
+            }
+        }
+        catch (...) {
+            ::close(dataFd);
+            EVP_MD_CTX_free(nameCtx);
+            throw;
+        }
+        syncAndClose(dataFd, tempData);
+
+        unsigned char nameDigest[EVP_MAX_MD_SIZE];
+        unsigned int nameLength = 0;
+        EVP_DigestFinal_ex(nameCtx, nameDigest, &nameLength);
+        EVP_MD_CTX_free(nameCtx);
+        std::string name = "pack-" + bytesToHex(nameDigest, nameLength);
+
+        std::memcpy(&index[0], INDEX_MAGIC, sizeof(INDEX_MAGIC));
+        putUint32(&index[8], static_cast<uint32_t>(sorted.size()));
+        uint32_t cumulative = 0;
+        for (int b = 0; b < 256; b++) {
+            cumulative += fanout[b];
+            putUint32(&index[INDEX_HEADER_SIZE + 4 * b], cumulative);
+        }
+
+        int indexFd = ::open(tempIndex.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (indexFd < 0) {
+            throw std::runtime_error("Cannot create pack index: " + tempIndex);
+        }
+        try {
+            recordfile::writeFully(indexFd, index.data(), index.size(), tempIndex);
+        }
+        catch (...) {
+            ::close(indexFd);
+            throw;
+        }
+        syncAndClose(indexFd, tempIndex);
+
+        // Readers discover packs by their index, so the data file has to be
+        // in place before the index appears
+        fs::rename(tempData, getDataPath(name));
+        fs::rename(tempIndex, getIndexPath(name));
+
+        int dirFd = ::open(packPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd >= 0) {
+            fsync(dirFd);
+            ::close(dirFd);
+        }
+
+        reload();
+        return name;
+    }
+    catch (...) {
+        std::error_code ec;
+        fs::remove(tempData, ec);
+        fs::remove(tempIndex, ec);
+        throw;
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef PACK_MANAGER_HPP
+#define PACK_MANAGER_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <shared_mutex>
+#include <filesystem>
+#include <cstdint>
+#include "RecordFile.hpp"
+#include "ObjectId.hpp"
+
+namespace fs = std::filesystem;
+
+// One object inside a pack
+struct PackEntry {
+    ObjectId hash;
+    uint64_t offset;
+    uint64_t length;
+};
+
+// One pack: a data file holding many objects back to back, plus an index of
+// (digest, offset, length) sorted by digest with a 256-entry fan-out table.
+// The index is memory-mapped and binary-searched; object bytes are read from
+// the data file with pread. Packs are immutable once written.
+class PackFile {
+private:
+    std::string name;
+    int dataFd;
+    const char* index;
+    size_t indexSize;
+    uint32_t objectCount;
+
+public:
+    PackFile(const std::string& packName, int fd, const char* mappedIndex, size_t mappedSize);
+    ~PackFile();
+
+    PackFile(const PackFile&) = delete;
+    PackFile& operator=(const PackFile&) = delete;
+
+    bool find(const unsigned char* digest, uint64_t& offset, uint64_t& length) const;
+    std::vector<PackEntry> listEntries() const;
+    const std::string& getName() const;
+    int getDataFd() const;
+    uint32_t getObjectCount() const;
+};
+
+// Where a packed object's bytes live; holding it keeps the pack open even
+// if the pack is replaced concurrently
+struct PackedObject {
+    std::shared_ptr<const PackFile> pack;
+    uint64_t offset;
+    uint64_t length;
+};
+
+// An object to write into a new pack, taken from a loose file or, when
+// loosePath is empty, from an existing pack
+struct PackInput {
+    ObjectId hash;
+    std::string loosePath;
+    PackedObject packed;
+};
+
+class PackManager {
+private:
+    std::string packPath;
+    std::vector<std::shared_ptr<const PackFile>> packs;
+    recordfile::FileStamp loadedStamp;
+    // The directory changed too recently for its stamp to be trusted
+    bool loadedRacy;
+    bool loaded;
+    mutable std::shared_mutex packsMutex;
+
+    void loadPacks();
+    bool findLoaded(const unsigned char* digest, PackedObject& object) const;
+
+public:
+    explicit PackManager(const std::string& packDirectory);
+
+    // Looks the object up in every pack, rescanning the pack directory if it
+    // changed since the last scan
+    bool find(const ObjectId& hash, PackedObject& object);
+    bool contains(const ObjectId& hash);
+
+    // Writes the given objects into a new pack and returns its name. The
+    // sources are left in place; the caller removes them once the pack is
+    // visible.
+    std::string writePack(const std::vector<PackInput>& objects);
+    // Deletes a pack; readers that already hold it keep reading it
+    void removePack(const std::string& name);
+    // Marks the pack holding the object as recently used, so garbage
+    // collection's grace period applies to it; false if it is not packed
+    bool freshen(const ObjectId& hash);
+
+    std::string getDataPath(const std::string& name) const;
+    std::string getIndexPath(const std::string& name) const;
+    std::vector<std::shared_ptr<const PackFile>> getPacks();
+    void reload();
+
+    static constexpr size_t DIGEST_SIZE = ObjectId::SIZE;
+};
+
+#endif // PACK_MANAGER_HPP
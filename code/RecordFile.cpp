@@ -0,0 +1,163 @@
+#include "RecordFile.hpp"
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+namespace recordfile {
+
+FileDescriptor::~FileDescriptor() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+FileLock::FileLock(int descriptor) : fd(descriptor) {
+    while (flock(fd, LOCK_EX) != 0) {
+        if (errno != EINTR) {
+            throw std::runtime_error(std::string("Cannot lock file: ") + std::strerror(errno));
+        }
+    }
+}
+
+FileLock::~FileLock() {
+    flock(fd, LOCK_UN);
+}
+
+namespace {
+
+int openLockFile(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+    }
+    return fd;
+}
+
+} // namespace
+
+LockFile::LockFile(const std::string& path) : file(openLockFile(path)), lock(file.get()) {}
+
+int openRecordFile(const std::string& path, const char* magic) {
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+    }
+
+    try {
+        // Under the lock, so two processes creating the file write the
+        // magic only once
+        FileLock lock(fd);
+        if (fileSize(fd, path) == 0) {
+            writeAt(fd, std::string(magic, RECORD_MAGIC_SIZE), 0, path);
+        }
+        else {
+            char header[RECORD_MAGIC_SIZE];
+            if (pread(fd, header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)) ||
+                std::memcmp(header, magic, RECORD_MAGIC_SIZE) != 0) {
+                throw std::runtime_error("Unrecognised format: " + path);
+            }
+        }
+    }
+    catch (...) {
+        ::close(fd);
+        throw;
+    }
+    return fd;
+}
+
+FileStamp fileStamp(const std::string& path) {
+    FileStamp stamp;
+    struct stat info;
+    if (stat(path.c_str(), &info) == 0) {
+        stamp.mtimeNs = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+        stamp.size = static_cast<uint64_t>(info.st_size);
+        stamp.inode = static_cast<uint64_t>(info.st_ino);
+    }
+    return stamp;
+}
+
+void writeFully(int fd, const char* data, size_t length, const std::string& path) {
+    while (length > 0) {
+        ssize_t count = ::write(fd, data, length);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Failed to write file: " + path + ": " + std::strerror(errno));
+        }
+        data += count;
+        length -= static_cast<size_t>(count);
+    }
+}
+
+void writeAt(int fd, const std::string& data, uint64_t offset, const std::string& path) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t count = pwrite(fd, data.data() + written, data.size() - written, offset + written);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Failed to write " + path + ": " + std::strerror(errno));
+        }
+        written += static_cast<size_t>(count);
+    }
+    if (fdatasync(fd) != 0) {
+        throw std::runtime_error("Failed to flush " + path);
+    }
+}
+
+void replaceFile(const std::string& path, const std::string& contents) {
+    // Unique per writer, so two replacing the same file cannot take each
+    // other's temporary file away
+    std::string tempPath = path + TEMP_FILE_SUFFIX;
+    int fd = mkostemp(&tempPath[0], O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot create " + tempPath + ": " + std::strerror(errno));
+    }
+    try {
+        if (fchmod(fd, 0644) != 0) {
+            throw std::runtime_error("Cannot set mode of " + tempPath + ": " + std::strerror(errno));
+        }
+        writeAt(fd, contents, 0, tempPath);
+    }
+    catch (...) {
+        ::close(fd);
+        ::unlink(tempPath.c_str());
+        throw;
+    }
+    ::close(fd);
+
+    if (std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        ::unlink(tempPath.c_str());
+        throw std::runtime_error("Cannot replace " + path + ": " + std::strerror(errno));
+    }
+
+    // The rename is only durable once the directory is flushed
+    size_t slash = path.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "." : path.substr(0, std::max<size_t>(slash, 1));
+    int dirFd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd >= 0) {
+        fsync(dirFd);
+        ::close(dirFd);
+    }
+}
+
+uint64_t fileSize(int fd, const std::string& path) {
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        throw std::runtime_error("Cannot stat " + path);
+    }
+    return static_cast<uint64_t>(info.st_size);
+}
+
+uint32_t recordChecksum(const char* data, size_t length) {
+    uLong crc = crc32(0L, Z_NULL, 0);
+    return static_cast<uint32_t>(crc32(crc, reinterpret_cast<const Bytef*>(data), static_cast<uInt>(length)));
+}
+
+} // namespace recordfile
@@ -0,0 +1,97 @@
+#ifndef RECORD_FILE_HPP
+#define RECORD_FILE_HPP
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Helpers shared by the append-only files under .vault: each starts with an
+// 8-byte magic/version and holds checksummed records that are only ever
+// added at the end, under an exclusive lock.
+
+namespace recordfile {
+
+constexpr size_t RECORD_MAGIC_SIZE = 8;
+
+// Closes a descriptor on every exit path; negative means none
+class FileDescriptor {
+private:
+    int fd;
+
+public:
+    explicit FileDescriptor(int descriptor) : fd(descriptor) {}
+    ~FileDescriptor();
+
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+    int get() const { return fd; }
+    // Hands the descriptor to the caller, e.g. to check close's result
+    int release() {
+        int descriptor = fd;
+        fd = -1;
+        return descriptor;
+    }
+};
+
+// Exclusive flock on a file for as long as it lives. Serialises writers
+// across processes; readers do not take it.
+class FileLock {
+private:
+    int fd;
+
+public:
+    explicit FileLock(int descriptor);
+    ~FileLock();
+
+    FileLock(const FileLock&) = delete;
+    FileLock& operator=(const FileLock&) = delete;
+};
+
+// Exclusive flock on a lock file of its own, created if missing, for state
+// that is replaced by renames and so cannot be locked itself
+class LockFile {
+private:
+    // Declared first so the lock is released before the file is closed
+    FileDescriptor file;
+    FileLock lock;
+
+public:
+    explicit LockFile(const std::string& path);
+};
+
+// Opens path for reading and writing, creating it with magic if it is new,
+// and returns the descriptor; throws if an existing file has another magic
+int openRecordFile(const std::string& path, const char* magic);
+
+// Stat data of a file or directory, to tell whether it changed since it
+// was last read; all zero for a missing path
+struct FileStamp {
+    int64_t mtimeNs = 0;
+    uint64_t size = 0;
+    uint64_t inode = 0;
+
+    bool operator==(const FileStamp& other) const {
+        return mtimeNs == other.mtimeNs && size == other.size && inode == other.inode;
+    }
+    bool operator!=(const FileStamp& other) const { return !(*this == other); }
+};
+FileStamp fileStamp(const std::string& path);
+
+// Writes the whole buffer at the file position; throws on failure
+void writeFully(int fd, const char* data, size_t length, const std::string& path);
+// Writes data at offset and flushes it to disk; throws on failure
+void writeAt(int fd, const std::string& data, uint64_t offset, const std::string& path);
+// Replaces path with contents through a flushed temporary file and a
+// rename, so readers and crashes see either the old file or the new one;
+// throws on failure. The temporary file is path plus TEMP_FILE_SUFFIX with
+// the Xs made unique.
+constexpr const char* TEMP_FILE_SUFFIX = ".tmp.XXXXXX";
+void replaceFile(const std::string& path, const std::string& contents);
+// Throws if the size cannot be read
+uint64_t fileSize(int fd, const std::string& path);
+uint32_t recordChecksum(const char* data, size_t length);
+
+} // namespace recordfile
+
+#endif // RECORD_FILE_HPP
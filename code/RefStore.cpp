@@ -0,0 +1,288 @@
+#include "RefStore.hpp"
+#include "ObjectFormat.hpp"
+#include "RecordFile.hpp"
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const char PACKED_MAGIC[8] = {'V', 'A', 'U', 'L', 'T', 'P', 'R', 1};
+constexpr size_t PACKED_HEADER_SIZE = recordfile::RECORD_MAGIC_SIZE + 4;
+constexpr const char* LOCK_SUFFIX = ".lock";
+
+void appendString(std::string& out, const std::string& value) {
+    char length[4];
+    putUint32(length, static_cast<uint32_t>(value.size()));
+    out.append(length, sizeof(length));
+    out.append(value);
+}
+
+// Loose ref file names keep letters, digits, '-' and '_' and write every
+// other byte as %XX, so names with '/' stay one flat file and no name can
+// look like a temporary file, which always has a '.'
+bool isPlainRefByte(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_';
+}
+
+bool isHexDigit(char c) {
+    return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'F');
+}
+
+std::string encodeRefName(const std::string& name) {
+    static const char HEX[] = "0123456789ABCDEF";
+    std::string encoded;
+    for (unsigned char c : name) {
+        if (isPlainRefByte(c)) {
+            encoded += static_cast<char>(c);
+        }
+        else {
+            encoded += '%';
+            encoded += HEX[c >> 4];
+            encoded += HEX[c & 0xf];
+        }
+    }
+    return encoded;
+}
+
+// False for a file name encodeRefName cannot have produced
+bool decodeRefName(const std::string& encoded, std::string& name) {
+    name.clear();
+    for (size_t i = 0; i < encoded.size(); i++) {
+        unsigned char c = static_cast<unsigned char>(encoded[i]);
+        if (isPlainRefByte(c)) {
+            name += static_cast<char>(c);
+            continue;
+        }
+        if (c != '%' || encoded.size() - i < 3 || !isHexDigit(encoded[i + 1]) || !isHexDigit(encoded[i + 2])) {
+            return false;
+        }
+        name += static_cast<char>(std::stoi(encoded.substr(i + 1, 2), nullptr, 16));
+        i += 2;
+    }
+    return !name.empty();
+}
+
+std::string readLooseRef(const fs::path& path) {
+    std::ifstream file(path);
+    std::string head;
+    file >> head;
+    return head;
+}
+
+} // namespace
+
+RefStore::RefStore(const std::string& refsDirPath, const std::string& packedRefsPath)
+    : refsDir(refsDirPath), packedPath(packedRefsPath), lockPath(packedRefsPath + LOCK_SUFFIX), mapped(nullptr),
+      mappedSize(0), packedCount(0), loaded(false) {}
+
+RefStore::~RefStore() {
+    unmap();
+}
+
+void RefStore::unmap() {
+    if (mapped) {
+        munmap(const_cast<char*>(mapped), mappedSize);
+        mapped = nullptr;
+        mappedSize = 0;
+    }
+    packedCount = 0;
+}
+
+void RefStore::refresh() {
+    // Two stats tell whether anything was written since the last load
+    recordfile::FileStamp packed = recordfile::fileStamp(packedPath);
+    recordfile::FileStamp refs = recordfile::fileStamp(refsDir);
+    if (loaded && packed == packedStamp && refs == refsStamp) {
+        return;
+    }
+    loaded = false;
+    unmap();
+    loose.clear();
+
+    if (packed.inode != 0) {
+        int fd = ::open(packedPath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open " + packedPath);
+        }
+        size_t size = static_cast<size_t>(recordfile::fileSize(fd, packedPath));
+        void* region = size == 0 ? MAP_FAILED : mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (region == MAP_FAILED) {
+            throw std::runtime_error("Cannot map " + packedPath);
+        }
+        mapped = static_cast<const char*>(region);
+        mappedSize = size;
+
+        if (size < PACKED_HEADER_SIZE || std::memcmp(mapped, PACKED_MAGIC, recordfile::RECORD_MAGIC_SIZE) != 0) {
+            unmap();
+            throw std::runtime_error("Unrecognised format: " + packedPath);
+        }
+        uint32_t count = getUint32(mapped + recordfile::RECORD_MAGIC_SIZE);
+        if ((size - PACKED_HEADER_SIZE) / 4 < count) {
+            unmap();
+            throw std::runtime_error("Packed refs are truncated: " + packedPath);
+        }
+        packedCount = count;
+    }
+
+    // Packing empties the loose directory, so this stays small
+    if (refs.inode != 0) {
+        for (const auto& entry : fs::directory_iterator(refsDir)) {
+            std::string name;
+            if (entry.is_regular_file() && decodeRefName(entry.path().filename().string(), name)) {
+                loose[name] = readLooseRef(entry.path());
+            }
+        }
+    }
+
+    packedStamp = packed;
+    refsStamp = refs;
+    loaded = true;
+}
+
+std::string RefStore::packedName(uint32_t index) const {
+    uint64_t offset = getUint32(mapped + PACKED_HEADER_SIZE + 4 * static_cast<uint64_t>(index));
+    if (offset > mappedSize || mappedSize - offset < 4 || getUint32(mapped + offset) > mappedSize - offset - 4) {
+        throw std::runtime_error("Packed refs are corrupt: " + packedPath);
+    }
+    return std::string(mapped + offset + 4, getUint32(mapped + offset));
+}
+
+std::string RefStore::packedHead(uint32_t index) const {
+    uint64_t offset = getUint32(mapped + PACKED_HEADER_SIZE + 4 * static_cast<uint64_t>(index));
+    offset += 4 + static_cast<uint64_t>(getUint32(mapped + offset));
+    if (offset > mappedSize || mappedSize - offset < 4 || getUint32(mapped + offset) > mappedSize - offset - 4) {
+        throw std::runtime_error("Packed refs are corrupt: " + packedPath);
+    }
+    return std::string(mapped + offset + 4, getUint32(mapped + offset));
+}
+
+bool RefStore::findPacked(const std::string& name, std::string& head) const {
+    uint32_t low = 0;
+    uint32_t high = packedCount;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        int order = packedName(middle).compare(name);
+        if (order == 0) {
+            head = packedHead(middle);
+            return true;
+        }
+        if (order < 0) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return false;
+}
+
+bool RefStore::lookup(const std::string& name, std::string& head) {
+    std::lock_guard<std::mutex> lock(mutex);
+    refresh();
+    auto found = loose.find(name);
+    if (found != loose.end()) {
+        head = found->second;
+        return true;
+    }
+    return findPacked(name, head);
+}
+
+std::vector<std::string> RefStore::list() {
+    std::lock_guard<std::mutex> lock(mutex);
+    refresh();
+
+    // Both sources are sorted, so one pass merges them
+    std::vector<std::string> names;
+    names.reserve(packedCount + loose.size());
+    auto next = loose.begin();
+    for (uint32_t i = 0; i < packedCount; i++) {
+        std::string name = packedName(i);
+        for (; next != loose.end() && next->first <= name; ++next) {
+            if (next->first != name) {
+                names.push_back(next->first);
+            }
+        }
+        names.push_back(std::move(name));
+    }
+    for (; next != loose.end(); ++next) {
+        names.push_back(next->first);
+    }
+    return names;
+}
+
+void RefStore::update(const std::string& name, const std::string& head) {
+    std::lock_guard<std::mutex> lock(mutex);
+    recordfile::LockFile packLock(lockPath);
+    refresh();
+
+    fs::create_directories(refsDir);
+    recordfile::replaceFile((fs::path(refsDir) / encodeRefName(name)).string(), head + "\n");
+    loose[name] = head;
+    refsStamp = recordfile::fileStamp(refsDir);
+
+    if (loose.size() > PACK_THRESHOLD) {
+        packLocked({});
+    }
+}
+
+void RefStore::packLocked(const std::map<std::string, std::string>& added) {
+    // Another process may have written or packed refs within the same
+    // timestamp tick, so the stamps cannot be trusted here
+    loaded = false;
+    refresh();
+
+    std::map<std::string, std::string> refs;
+    for (uint32_t i = 0; i < packedCount; i++) {
+        refs[packedName(i)] = packedHead(i);
+    }
+    for (const auto& [name, head] : loose) {
+        refs[name] = head;
+    }
+    for (const auto& [name, head] : added) {
+        refs.emplace(name, head);
+    }
+
+    std::string header(PACKED_MAGIC, recordfile::RECORD_MAGIC_SIZE);
+    header.resize(PACKED_HEADER_SIZE + 4 * refs.size());
+    putUint32(&header[recordfile::RECORD_MAGIC_SIZE], static_cast<uint32_t>(refs.size()));
+    std::string entries;
+    size_t index = 0;
+    for (const auto& [name, head] : refs) {
+        putUint32(&header[PACKED_HEADER_SIZE + 4 * index++], static_cast<uint32_t>(header.size() + entries.size()));
+        appendString(entries, name);
+        appendString(entries, head);
+    }
+    recordfile::replaceFile(packedPath, header + entries);
+
+    // No loose ref can be rewritten while the lock is held
+    for (const auto& [name, head] : loose) {
+        fs::remove(fs::path(refsDir) / encodeRefName(name));
+    }
+    loaded = false;
+    refresh();
+}
+
+void RefStore::pack() {
+    std::lock_guard<std::mutex> lock(mutex);
+    recordfile::LockFile packLock(lockPath);
+    packLocked({});
+}
+
+void RefStore::import(const std::map<std::string, std::string>& refs) {
+    std::lock_guard<std::mutex> lock(mutex);
+    recordfile::LockFile packLock(lockPath);
+    packLocked(refs);
+}
+
+bool RefStore::hasRefs() const {
+    return fs::exists(refsDir) || fs::exists(packedPath);
+}
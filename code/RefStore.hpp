@@ -0,0 +1,73 @@
+#ifndef REF_STORE_HPP
+#define REF_STORE_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <cstdint>
+#include "RecordFile.hpp"
+
+// Branch name -> head commit, for any number of branches. Most refs live in
+// one packed file, sorted by name and memory-mapped, so a lookup is a binary
+// search and listing is a walk over it. An update writes one small loose
+// ref file instead, which overrides the packed entry; once there are more
+// than PACK_THRESHOLD loose refs they are folded into a new packed file.
+// Loose ref files are named by the ref with bytes other than letters,
+// digits, '-' and '_' written as %XX.
+// Both kinds of file are replaced by rename, so readers never see half an
+// update. Writers in any process hold an flock on packed-refs.lock while
+// they write a loose ref or pack, so a pack never drops a ref written
+// meanwhile nor removes its loose file. The loose refs and the mapping are loaded once and only reloaded
+// when the packed file or the loose directory changes on disk.
+//   packed: 8-byte magic, u32 count, u32 offset of each entry in name
+//   order, then entries of (u32 length, name, u32 length, head)
+class RefStore {
+private:
+    std::string refsDir;
+    std::string packedPath;
+    std::string lockPath;
+    std::mutex mutex;
+    const char* mapped;
+    size_t mappedSize;
+    uint32_t packedCount;
+    std::map<std::string, std::string> loose;
+    recordfile::FileStamp packedStamp;
+    recordfile::FileStamp refsStamp;
+    bool loaded;
+
+    // Callers hold mutex
+    void refresh();
+    void unmap();
+    // Callers also hold the pack lock. Reloads the refs from disk first; refs in
+    // added are packed too unless the store already has them.
+    void packLocked(const std::map<std::string, std::string>& added);
+    std::string packedName(uint32_t index) const;
+    std::string packedHead(uint32_t index) const;
+    bool findPacked(const std::string& name, std::string& head) const;
+
+public:
+    static constexpr size_t PACK_THRESHOLD = 64;
+
+    RefStore(const std::string& refsDirPath, const std::string& packedRefsPath);
+    ~RefStore();
+
+    RefStore(const RefStore&) = delete;
+    RefStore& operator=(const RefStore&) = delete;
+
+    // All of these throw on failure.
+    // False if there is no such ref; head is empty for a branch without
+    // commits
+    bool lookup(const std::string& name, std::string& head);
+    // Every ref name, sorted
+    std::vector<std::string> list();
+    void update(const std::string& name, const std::string& head);
+    // Folds every loose ref into the packed file
+    void pack();
+    // Adds refs that are not in the store yet, packed
+    void import(const std::map<std::string, std::string>& refs);
+    // False until the first ref is written
+    bool hasRefs() const;
+};
+
+#endif // REF_STORE_HPP
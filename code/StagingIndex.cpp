@@ -0,0 +1,297 @@
+#include "StagingIndex.hpp"
+#include "ObjectFormat.hpp"
+#include "RecordFile.hpp"
+#include <algorithm>
+#include <set>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+const char INDEX_MAGIC[8] = {'V', 'A', 'U', 'L', 'T', 'S', 'I', 1};
+constexpr size_t RECORD_HEADER_SIZE = 8;
+
+void appendString(std::string& out, const std::string& value) {
+    char length[4];
+    putUint32(length, static_cast<uint32_t>(value.size()));
+    out.append(length, sizeof(length));
+    out.append(value);
+}
+
+std::string encodeRecord(const std::vector<StagedFile>& files) {
+    std::string payload(4, '\0');
+    putUint32(&payload[0], static_cast<uint32_t>(files.size()));
+    for (const auto& file : files) {
+        appendString(payload, file.path);
+        appendString(payload, file.sourcePath);
+        payload.append(reinterpret_cast<const char*>(file.hash.data()), ObjectId::SIZE);
+    }
+
+    char header[RECORD_HEADER_SIZE];
+    putUint32(header, static_cast<uint32_t>(payload.size()));
+    putUint32(header + 4, recordfile::recordChecksum(payload.data(), payload.size()));
+    return std::string(header, sizeof(header)) + payload;
+}
+
+std::vector<StagedFile> decodeRecord(const char* data, size_t length) {
+    size_t offset = 0;
+    auto need = [&](size_t count) {
+        if (length - offset < count) {
+            throw std::runtime_error("Staging index record is truncated");
+        }
+    };
+    auto readString = [&]() {
+        need(4);
+        uint32_t count = getUint32(data + offset);
+        offset += 4;
+        need(count);
+        std::string value(data + offset, count);
+        offset += count;
+        return value;
+    };
+
+    need(4);
+    uint32_t count = getUint32(data);
+    offset += 4;
+    std::vector<StagedFile> files(count);
+    for (auto& file : files) {
+        file.path = readString();
+        file.sourcePath = readString();
+        need(ObjectId::SIZE);
+        file.hash = ObjectId(reinterpret_cast<const unsigned char*>(data + offset));
+        offset += ObjectId::SIZE;
+    }
+    return files;
+}
+
+// Appends with one write so records from concurrent stagers never
+// interleave, then flushes
+void appendRecord(int fd, const std::string& record, const std::string& path) {
+    ssize_t count;
+    do {
+        count = ::write(fd, record.data(), record.size());
+    } while (count < 0 && errno == EINTR);
+    if (count != static_cast<ssize_t>(record.size())) {
+        throw std::runtime_error("Failed to write " + path);
+    }
+    if (fdatasync(fd) != 0) {
+        throw std::runtime_error("Failed to flush " + path);
+    }
+}
+
+std::string readWhole(int fd, const std::string& path) {
+    uint64_t size = recordfile::fileSize(fd, path);
+    std::string data(size, '\0');
+    size_t done = 0;
+    while (done < size) {
+        ssize_t count = pread(fd, &data[done], size - done, done);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) {
+            throw std::runtime_error("Failed to read " + path);
+        }
+        done += static_cast<size_t>(count);
+    }
+    return data;
+}
+
+// Replays the records in order, so the last staging of a path wins, and
+// returns where the intact ones end
+uint64_t replayRecords(const std::string& data, std::unordered_map<std::string, StagedFile>& files) {
+    uint64_t size = data.size();
+    uint64_t offset = recordfile::RECORD_MAGIC_SIZE;
+    while (size - offset >= RECORD_HEADER_SIZE) {
+        uint32_t length = getUint32(&data[offset]);
+        uint32_t checksum = getUint32(&data[offset + 4]);
+        const char* payload = &data[offset + RECORD_HEADER_SIZE];
+        if (size - offset - RECORD_HEADER_SIZE < length || recordfile::recordChecksum(payload, length) != checksum) {
+            break;
+        }
+        for (auto& file : decodeRecord(payload, length)) {
+            std::string key = file.path;
+            files[key] = std::move(file);
+        }
+        offset += RECORD_HEADER_SIZE + length;
+    }
+    return offset;
+}
+
+int openForAppend(const std::string& path) {
+    int fd = recordfile::openRecordFile(path, INDEX_MAGIC);
+    if (fcntl(fd, F_SETFL, O_APPEND) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot open " + path + " for appending");
+    }
+    return fd;
+}
+
+} // namespace
+
+StagingIndex::StagingIndex(const std::string& path)
+    : indexPath(path), indexFd(-1), loaded(false) {}
+
+StagingIndex::~StagingIndex() {
+    if (indexFd >= 0) ::close(indexFd);
+}
+
+size_t StagingIndex::shardIndex(const std::string& path) {
+    return std::hash<std::string>()(path) % SHARD_COUNT;
+}
+
+StagingIndex::Shard& StagingIndex::shardFor(const std::string& path) {
+    return shards[shardIndex(path)];
+}
+
+void StagingIndex::load() {
+    if (loaded.load(std::memory_order_acquire)) {
+        return;
+    }
+    std::unique_lock<std::shared_mutex> lock(fileMutex);
+    if (loaded.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    int fd = openForAppend(indexPath);
+    try {
+        recordfile::FileLock fileLock(fd);
+        std::string data = readWhole(fd, indexPath);
+        std::unordered_map<std::string, StagedFile> files;
+        uint64_t offset = replayRecords(data, files);
+        for (auto& [path, file] : files) {
+            shardFor(path).files[path] = std::move(file);
+        }
+
+        // A record cut short by a crash would hide everything appended
+        // after it
+        if (offset < data.size() && ftruncate(fd, offset) != 0) {
+            throw std::runtime_error("Failed to truncate " + indexPath);
+        }
+    }
+    catch (...) {
+        ::close(fd);
+        throw;
+    }
+    indexFd = fd;
+    loaded.store(true, std::memory_order_release);
+}
+
+void StagingIndex::rewrite() {
+    std::vector<StagedFile> remaining;
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (const auto& [path, file] : shard.files) {
+            remaining.push_back(file);
+        }
+    }
+
+    std::string contents(INDEX_MAGIC, recordfile::RECORD_MAGIC_SIZE);
+    if (!remaining.empty()) {
+        contents += encodeRecord(remaining);
+    }
+    recordfile::replaceFile(indexPath, contents);
+    int replacement = openForAppend(indexPath);
+    ::close(indexFd);
+    indexFd = replacement;
+}
+
+void StagingIndex::stage(const std::vector<StagedFile>& files) {
+    if (files.empty()) {
+        return;
+    }
+    load();
+    std::string record = encodeRecord(files);
+
+    // Only a rewrite excludes stagers; they share the file, whose appends
+    // the kernel keeps whole
+    std::shared_lock<std::shared_mutex> lock(fileMutex);
+
+    // The shards of these paths stay locked from the append until memory
+    // is updated, so two stagings of one path land in the file and in
+    // memory in the same order and a restart keeps the same winner. Taken
+    // in index order so overlapping stagers cannot deadlock.
+    std::set<size_t> touched;
+    for (const auto& file : files) {
+        touched.insert(shardIndex(file.path));
+    }
+    std::vector<std::unique_lock<std::mutex>> shardLocks;
+    for (size_t index : touched) {
+        shardLocks.emplace_back(shards[index].mutex);
+    }
+
+    appendRecord(indexFd, record, indexPath);
+    for (const auto& file : files) {
+        shards[shardIndex(file.path)].files[file.path] = file;
+    }
+}
+
+std::vector<StagedFile> StagingIndex::list() {
+    load();
+    std::vector<StagedFile> files;
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (const auto& [path, file] : shard.files) {
+            files.push_back(file);
+        }
+    }
+    std::sort(files.begin(), files.end(),
+              [](const StagedFile& a, const StagedFile& b) { return a.path < b.path; });
+    return files;
+}
+
+void StagingIndex::unstage(const std::vector<StagedFile>& files) {
+    load();
+    std::unique_lock<std::shared_mutex> lock(fileMutex);
+    for (const auto& file : files) {
+        Shard& shard = shardFor(file.path);
+        std::lock_guard<std::mutex> shardLock(shard.mutex);
+        auto found = shard.files.find(file.path);
+        if (found != shard.files.end() && found->second.hash == file.hash) {
+            shard.files.erase(found);
+        }
+    }
+    rewrite();
+}
+
+std::vector<StagedFile> StagingIndex::readFile(const std::string& path) {
+    recordfile::FileDescriptor fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd.get() < 0) {
+        if (errno == ENOENT) {
+            return {};
+        }
+        throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+    }
+    std::string data = readWhole(fd.get(), path);
+
+    // A file another process has only just created has no magic yet
+    if (data.empty()) {
+        return {};
+    }
+    if (data.size() < recordfile::RECORD_MAGIC_SIZE ||
+        std::memcmp(data.data(), INDEX_MAGIC, recordfile::RECORD_MAGIC_SIZE) != 0) {
+        throw std::runtime_error("Unrecognised format: " + path);
+    }
+
+    // A torn record at the end is skipped, not cut off
+    std::unordered_map<std::string, StagedFile> staged;
+    replayRecords(data, staged);
+    std::vector<StagedFile> files;
+    files.reserve(staged.size());
+    for (auto& [name, file] : staged) {
+        files.push_back(std::move(file));
+    }
+    std::sort(files.begin(), files.end(),
+              [](const StagedFile& a, const StagedFile& b) { return a.path < b.path; });
+    return files;
+}
+
+size_t StagingIndex::size() {
+    load();
+    size_t count = 0;
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        count += shard.files.size();
+    }
+    return count;
+}
@@ -0,0 +1,74 @@
+#ifndef STAGING_INDEX_HPP
+#define STAGING_INDEX_HPP
+
+#include <string>
+#include <vector>
+#include <array>
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include "ObjectId.hpp"
+
+// One file staged for the next commit: its vault path, the path it was
+// staged from and the object its content was stored as when staged
+struct StagedFile {
+    std::string path;
+    std::string sourcePath;
+    ObjectId hash;
+};
+
+// Files staged for the next commit, keyed by vault path so restaging a
+// path replaces its entry. Entries are spread over shards by path, so
+// threads staging different files only meet on the shards they hash to.
+// Every call to stage is also appended to the index file as one
+// checksummed record with a single flush, so staged files survive a
+// restart; unstaging rewrites the file with what is left.
+//   record: u32 payload length, u32 CRC-32, payload
+//   payload: u32 count, then (path, source path, 32-byte digest) per file;
+//   strings are u32 length + bytes
+class StagingIndex {
+private:
+    static constexpr size_t SHARD_COUNT = 16;
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, StagedFile> files;
+    };
+
+    std::string indexPath;
+    std::array<Shard, SHARD_COUNT> shards;
+    int indexFd;
+    std::atomic<bool> loaded;
+    // Staging holds it shared; a rewrite of the file holds it exclusively
+    std::shared_mutex fileMutex;
+
+    static size_t shardIndex(const std::string& path);
+    Shard& shardFor(const std::string& path);
+    void load();
+    void rewrite();
+
+public:
+    explicit StagingIndex(const std::string& path);
+    ~StagingIndex();
+
+    StagingIndex(const StagingIndex&) = delete;
+    StagingIndex& operator=(const StagingIndex&) = delete;
+
+    // All of these throw on failure.
+    // Safe to call from many threads at once
+    void stage(const std::vector<StagedFile>& files);
+    // Every staged file, sorted by path
+    std::vector<StagedFile> list();
+    // Drops the entries that are still staged with the same object, so a
+    // file restaged since files was listed stays staged
+    void unstage(const std::vector<StagedFile>& files);
+    size_t size();
+
+    // Every file staged in the index file at path, sorted by path, for
+    // readers outside the index such as garbage collection. Never creates,
+    // truncates or locks the file; empty if there is none.
+    static std::vector<StagedFile> readFile(const std::string& path);
+};
+
+#endif // STAGING_INDEX_HPP
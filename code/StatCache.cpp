@@ -0,0 +1,264 @@
+#include "StatCache.hpp"
+#include "ObjectFormat.hpp"
+#include "RecordFile.hpp"
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const char CACHE_MAGIC[8] = {'V', 'A', 'U', 'L', 'T', 'S', 'C', 1};
+
+int64_t toNanoseconds(const struct timespec& time) {
+    return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+void appendString(std::string& out, const std::string& value) {
+    char length[4];
+    putUint32(length, static_cast<uint32_t>(value.size()));
+    out.append(length, sizeof(length));
+    out.append(value);
+}
+
+void appendUint64(std::string& out, uint64_t value) {
+    char encoded[8];
+    putUint64(encoded, value);
+    out.append(encoded, sizeof(encoded));
+}
+
+// Bounds-checked reader over the loaded cache file
+class Reader {
+private:
+    const std::string& data;
+    size_t offset;
+
+    void need(size_t length) {
+        if (data.size() - offset < length) {
+            throw std::runtime_error("Stat cache is truncated");
+        }
+    }
+
+public:
+    Reader(const std::string& buffer, size_t start) : data(buffer), offset(start) {}
+
+    uint32_t readUint32() {
+        need(4);
+        uint32_t value = getUint32(data.data() + offset);
+        offset += 4;
+        return value;
+    }
+
+    uint64_t readUint64() {
+        need(8);
+        uint64_t value = getUint64(data.data() + offset);
+        offset += 8;
+        return value;
+    }
+
+    std::string readString() {
+        uint32_t length = readUint32();
+        need(length);
+        std::string value = data.substr(offset, length);
+        offset += length;
+        return value;
+    }
+};
+
+} // namespace
+
+StatCache::StatCache(const std::string& path)
+    : cachePath(path), savedAtNs(0), loaded(false), dirty(false) {}
+
+std::string StatCache::key(const std::string& filePath) {
+    return fs::absolute(filePath).lexically_normal().string();
+}
+
+void StatCache::load() {
+    loaded = true;
+    entries.clear();
+    savedAtNs = 0;
+
+    struct stat info;
+    if (stat(cachePath.c_str(), &info) != 0) {
+        return;
+    }
+
+    std::ifstream file(cachePath, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    try {
+        if (data.size() < sizeof(CACHE_MAGIC) || std::memcmp(data.data(), CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0) {
+            throw std::runtime_error("Unrecognised stat cache format");
+        }
+
+        Reader reader(data, sizeof(CACHE_MAGIC));
+        std::string storedAlgorithm = reader.readString();
+        uint32_t count = reader.readUint32();
+        if (!algorithm.empty() && storedAlgorithm != algorithm) {
+            return;
+        }
+        algorithm = storedAlgorithm;
+
+        entries.reserve(count);
+        for (uint32_t i = 0; i < count; i++) {
+            std::string path = reader.readString();
+            StatCacheEntry entry;
+            entry.size = reader.readUint64();
+            entry.mtimeNs = static_cast<int64_t>(reader.readUint64());
+            entry.ctimeNs = static_cast<int64_t>(reader.readUint64());
+            entry.inode = reader.readUint64();
+            entry.device = reader.readUint64();
+            entry.hash = reader.readString();
+            entries.emplace(std::move(path), std::move(entry));
+        }
+        savedAtNs = toNanoseconds(info.st_mtim);
+    }
+    catch (const std::exception& e) {
+        // The cache only saves work; a damaged one is simply rebuilt
+        std::cerr << "Ignoring stat cache: " << e.what() << std::endl;
+        entries.clear();
+    }
+}
+
+void StatCache::setAlgorithm(const std::string& algorithmName) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (!loaded) {
+        algorithm = algorithmName;
+        load();
+        return;
+    }
+    if (algorithm != algorithmName) {
+        algorithm = algorithmName;
+        entries.clear();
+        dirty = true;
+    }
+}
+
+bool StatCache::lookup(const std::string& filePath, const struct stat& info, std::string& hash) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (!loaded) {
+        load();
+    }
+
+    auto found = entries.find(key(filePath));
+    if (found == entries.end()) {
+        return false;
+    }
+
+    const StatCacheEntry& entry = found->second;
+    int64_t mtimeNs = toNanoseconds(info.st_mtim);
+    int64_t ctimeNs = toNanoseconds(info.st_ctim);
+    if (entry.size != static_cast<uint64_t>(info.st_size) || entry.mtimeNs != mtimeNs ||
+        entry.ctimeNs != ctimeNs || entry.inode != static_cast<uint64_t>(info.st_ino) ||
+        entry.device != static_cast<uint64_t>(info.st_dev)) {
+        return false;
+    }
+
+    // A file changed in the same tick the cache was written would still
+    // match, so such entries have to be hashed again
+    if (std::max(mtimeNs, ctimeNs) >= savedAtNs) {
+        return false;
+    }
+
+    hash = entry.hash;
+    return true;
+}
+
+void StatCache::store(const std::string& filePath, const struct stat& info, const std::string& hash) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (!loaded) {
+        load();
+    }
+
+    StatCacheEntry& entry = entries[key(filePath)];
+    entry.size = static_cast<uint64_t>(info.st_size);
+    entry.mtimeNs = toNanoseconds(info.st_mtim);
+    entry.ctimeNs = toNanoseconds(info.st_ctim);
+    entry.inode = static_cast<uint64_t>(info.st_ino);
+    entry.device = static_cast<uint64_t>(info.st_dev);
+    entry.hash = hash;
+    dirty = true;
+}
+
+void StatCache::remove(const std::string& filePath) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (!loaded) {
+        load();
+    }
+    if (entries.erase(key(filePath)) > 0) {
+        dirty = true;
+    }
+}
+
+void StatCache::clear() {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    loaded = true;
+    entries.clear();
+    dirty = true;
+}
+
+bool StatCache::save() {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (!dirty) {
+        return true;
+    }
+
+    try {
+        // Files deleted since they were hashed would otherwise stay forever
+        for (auto it = entries.begin(); it != entries.end();) {
+            struct stat info;
+            if (stat(it->first.c_str(), &info) != 0 && errno == ENOENT) {
+                it = entries.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+
+        std::string data(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        appendString(data, algorithm);
+        char count[4];
+        putUint32(count, static_cast<uint32_t>(entries.size()));
+        data.append(count, sizeof(count));
+
+        for (const auto& [path, entry] : entries) {
+            appendString(data, path);
+            appendUint64(data, entry.size);
+            appendUint64(data, static_cast<uint64_t>(entry.mtimeNs));
+            appendUint64(data, static_cast<uint64_t>(entry.ctimeNs));
+            appendUint64(data, entry.inode);
+            appendUint64(data, entry.device);
+            appendString(data, entry.hash);
+        }
+
+        // Replace the cache atomically so a crash never leaves half of it
+        recordfile::replaceFile(cachePath, data);
+
+        // Racy entries are judged against the cache file's own timestamp,
+        // which comes from the same clock as the files' mtimes
+        struct stat info;
+        if (stat(cachePath.c_str(), &info) == 0) {
+            savedAtNs = toNanoseconds(info.st_mtim);
+        }
+        dirty = false;
+        return true;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error saving stat cache: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+size_t StatCache::size() {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (!loaded) {
+        load();
+    }
+    return entries.size();
+}
@@ -0,0 +1,56 @@
+#ifndef STAT_CACHE_HPP
+#define STAT_CACHE_HPP
+
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+#include <sys/stat.h>
+
+// What a file looked like when it was last hashed
+struct StatCacheEntry {
+    uint64_t size;
+    int64_t mtimeNs;
+    int64_t ctimeNs;
+    uint64_t inode;
+    uint64_t device;
+    std::string hash;
+};
+
+// Persistent map from file path to the stat data and change hash it had
+// when last hashed, so unchanged files are recognised from a stat call
+// alone. Like git's index, an entry whose mtime is not older than the cache
+// file itself is "racy": the file could have changed again within the same
+// timestamp tick, so it is rehashed rather than trusted.
+class StatCache {
+private:
+    std::string cachePath;
+    std::string algorithm;
+    std::unordered_map<std::string, StatCacheEntry> entries;
+    int64_t savedAtNs;
+    bool loaded;
+    bool dirty;
+    mutable std::mutex cacheMutex;
+
+    void load();
+    static std::string key(const std::string& filePath);
+
+public:
+    explicit StatCache(const std::string& path);
+
+    // Entries recorded with a different change-detection algorithm are
+    // discarded
+    void setAlgorithm(const std::string& algorithmName);
+
+    // Returns true and fills hash if info matches the cached entry
+    bool lookup(const std::string& filePath, const struct stat& info, std::string& hash);
+    void store(const std::string& filePath, const struct stat& info, const std::string& hash);
+    void remove(const std::string& filePath);
+    void clear();
+
+    // Writes the cache if anything changed since it was loaded
+    bool save();
+    size_t size();
+};
+
+#endif // STAT_CACHE_HPP
@@ -1,27 +1,59 @@
 #include "SyncManager.hpp"
+#include "FileTransfer.hpp"
 #include <iostream>
 #include <algorithm>
 
 FileStatus SyncManager::getFileStatus(const std::string& filePath) {
-    FileStatus status;
-    status.path = filePath;
-    status.exists = fs::exists(filePath);
-    
-    if (status.exists) {
-        status.lastModified = fs::last_write_time(filePath).time_since_epoch().count();
-        status.hash = fileManager.calculateFileHash(filePath);
-    } else {
+    return getFileStatuses({filePath}).front();
+}
+
+std::vector<FileStatus> SyncManager::getFileStatuses(const std::vector<std::string>& filePaths) {
+    std::vector<FileStatus> statuses(filePaths.size());
+    std::vector<std::string> toHash;
+    std::vector<size_t> toHashIndex;
+    std::vector<struct stat> toHashInfo;
+
+    statCache.setAlgorithm(hashAlgorithmName(fileManager.getChangeDetectionAlgorithm()));
+
+    // One stat per file; only files whose stat data no longer matches the
+    // cache are read and hashed
+    for (size_t i = 0; i < filePaths.size(); i++) {
+        FileStatus& status = statuses[i];
+        status.path = filePaths[i];
         status.lastModified = 0;
-        status.hash = "";
+
+        struct stat info;
+        status.exists = stat(filePaths[i].c_str(), &info) == 0;
+        if (!status.exists) {
+            statCache.remove(filePaths[i]);
+            continue;
+        }
+
+        status.lastModified = info.st_mtim.tv_sec;
+        if (!statCache.lookup(filePaths[i], info, status.hash)) {
+            toHash.push_back(filePaths[i]);
+            toHashIndex.push_back(i);
+            toHashInfo.push_back(info);
+        }
     }
-    
-    return status;
+
+    // Hash the remaining files in one batch instead of one call per file
+    auto hashes = fileManager.calculateChangeHashes(toHash);
+    for (size_t i = 0; i < toHash.size(); i++) {
+        statuses[toHashIndex[i]].hash = hashes[i];
+        // The stat taken before hashing is recorded, so a file modified
+        // while being read no longer matches next time
+        statCache.store(toHash[i], toHashInfo[i], hashes[i]);
+    }
+
+    statCache.save();
+    return statuses;
 }
 
 bool SyncManager::copyFile(const std::string& source, const std::string& dest) {
     try {
         fs::create_directories(fs::path(dest).parent_path());
-        fs::copy_file(source, dest, fs::copy_options::overwrite_existing);
+        FileTransfer::copyFile(source, dest);
         return true;
     } catch (const std::exception& e) {
         std::cerr << "Error copying file: " << e.what() << std::endl;
@@ -43,9 +75,9 @@ bool SyncManager::deleteFile(const std::string& path) {
 }
 
 bool SyncManager::wasFileInSource(const std::string& relativePath) {
-    // Get file history
-    auto history = commitManager.getFileHistory(relativePath);
-    return !history.empty();
+    // History is recorded under the source file's path in the vault
+    std::string sourceFull = (fs::path(sourcePath) / relativePath).string();
+    return commitManager.hasFileHistory(commitManager.toVaultPath(sourceFull));
 }
 
 std::vector<std::string> SyncManager::scanDirectory(const std::string& path) {
@@ -104,6 +136,7 @@ bool SyncManager::synchronize() {
     bool success = true;
 
     // First handle files that are only in destination
+    std::vector<std::string> toSynchronize;
     for (const auto& file : destFiles) {
         if (sourceSet.find(file) == sourceSet.end()) {
             // If file was previously in source but now isn't, delete it
@@ -114,16 +147,25 @@ bool SyncManager::synchronize() {
                 }
             } else {
                 // New file in destination, synchronize it
-                if (!synchronizeFile(file)) {
-                    success = false;
-                }
+                toSynchronize.push_back(file);
             }
         }
     }
 
     // Then handle files from source
-    for (const auto& file : sourceFiles) {
-        if (!synchronizeFile(file)) {
+    toSynchronize.insert(toSynchronize.end(), sourceFiles.begin(), sourceFiles.end());
+
+    // Each file is only ever changed by its own synchronization, so every
+    // status can be computed up front in one batch
+    std::vector<std::string> fullPaths;
+    for (const auto& file : toSynchronize) {
+        fullPaths.push_back((fs::path(sourcePath) / file).string());
+        fullPaths.push_back((fs::path(destPath) / file).string());
+    }
+    auto statuses = getFileStatuses(fullPaths);
+
+    for (size_t i = 0; i < toSynchronize.size(); i++) {
+        if (!synchronizeFile(toSynchronize[i], statuses[i * 2], statuses[i * 2 + 1])) {
             success = false;
         }
     }
@@ -134,9 +176,15 @@ bool SyncManager::synchronize() {
 bool SyncManager::synchronizeFile(const std::string& relativePath) {
     std::string sourceFull = (fs::path(sourcePath) / relativePath).string();
     std::string destFull = (fs::path(destPath) / relativePath).string();
-    
-    auto sourceStatus = getFileStatus(sourceFull);
-    auto destStatus = getFileStatus(destFull);
+
+    return synchronizeFile(relativePath, getFileStatus(sourceFull), getFileStatus(destFull));
+}
+
+bool SyncManager::synchronizeFile(const std::string& relativePath,
+                                  const FileStatus& sourceStatus,
+                                  const FileStatus& destStatus) {
+    std::string sourceFull = (fs::path(sourcePath) / relativePath).string();
+    std::string destFull = (fs::path(destPath) / relativePath).string();
     
     bool fileChanged = false;
     std::string fileToStage;
@@ -187,9 +235,17 @@ std::vector<std::string> SyncManager::getModifiedFiles() {
     allFiles.insert(sourceFiles.begin(), sourceFiles.end());
     allFiles.insert(destFiles.begin(), destFiles.end());
     
+    std::vector<std::string> fullPaths;
+    for (const auto& file : allFiles) {
+        fullPaths.push_back((fs::path(sourcePath) / file).string());
+        fullPaths.push_back((fs::path(destPath) / file).string());
+    }
+    auto statuses = getFileStatuses(fullPaths);
+
+    size_t i = 0;
     for (const auto& file : allFiles) {
-        auto sourceStatus = getFileStatus((fs::path(sourcePath) / file).string());
-        auto destStatus = getFileStatus((fs::path(destPath) / file).string());
+        const auto& sourceStatus = statuses[i++];
+        const auto& destStatus = statuses[i++];
         
         if (sourceStatus.hash != destStatus.hash) {
             modified.push_back(file);
@@ -203,15 +259,22 @@ std::vector<std::string> SyncManager::getConflictingFiles() {
     std::vector<std::string> conflicts;
     auto sourceFiles = scanDirectory(sourcePath);
     auto destFiles = scanDirectory(destPath);
+    std::set<std::string> destSet(destFiles.begin(), destFiles.end());
     
+    std::vector<std::string> common;
+    std::vector<std::string> fullPaths;
     for (const auto& file : sourceFiles) {
-        if (std::find(destFiles.begin(), destFiles.end(), file) != destFiles.end()) {
-            auto sourceStatus = getFileStatus((fs::path(sourcePath) / file).string());
-            auto destStatus = getFileStatus((fs::path(destPath) / file).string());
-            
-            if (sourceStatus.hash != destStatus.hash) {
-                conflicts.push_back(file);
-            }
+        if (destSet.find(file) != destSet.end()) {
+            common.push_back(file);
+            fullPaths.push_back((fs::path(sourcePath) / file).string());
+            fullPaths.push_back((fs::path(destPath) / file).string());
+        }
+    }
+    auto statuses = getFileStatuses(fullPaths);
+
+    for (size_t i = 0; i < common.size(); i++) {
+        if (statuses[i * 2].hash != statuses[i * 2 + 1].hash) {
+            conflicts.push_back(common[i]);
         }
     }
     
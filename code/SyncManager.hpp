@@ -8,6 +8,7 @@
 #include <filesystem>
 #include "FileManager.hpp"
 #include "CommitManager.hpp"
+#include "StatCache.hpp"
 
 namespace fs = std::filesystem;
 
@@ -22,19 +23,24 @@ class SyncManager {
 private:
     FileManager& fileManager;
     CommitManager& commitManager;
+    StatCache& statCache;
     std::string sourcePath;
     std::string destPath;
     
     FileStatus getFileStatus(const std::string& filePath);
+    std::vector<FileStatus> getFileStatuses(const std::vector<std::string>& filePaths);
     bool copyFile(const std::string& source, const std::string& dest);
     std::vector<std::string> scanDirectory(const std::string& path);
     bool synchronizeFile(const std::string& relativePath);
+    bool synchronizeFile(const std::string& relativePath,
+                         const FileStatus& sourceStatus,
+                         const FileStatus& destStatus);
     bool wasFileInSource(const std::string& relativePath);
     bool deleteFile(const std::string& path);
 
 public:
-    SyncManager(FileManager& fm, CommitManager& cm)
-        : fileManager(fm), commitManager(cm) {}
+    SyncManager(FileManager& fm, CommitManager& cm, StatCache& sc)
+        : fileManager(fm), commitManager(cm), statCache(sc) {}
 
     bool initializeSync(const std::string& source, const std::string& dest);
     bool synchronize();
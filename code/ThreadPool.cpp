@@ -0,0 +1,138 @@
+#include "ThreadPool.hpp"
+#include <atomic>
+#include <algorithm>
+#include <iostream>
+
+ThreadPool::ThreadPool(size_t threadCount, size_t capacity)
+    : queueCapacity(capacity), activeTasks(0), stopping(false) {
+    if (threadCount == 0) {
+        threadCount = 1;
+    }
+    if (queueCapacity == 0) {
+        queueCapacity = threadCount * 4;
+    }
+
+    workers.reserve(threadCount);
+    for (size_t i = 0; i < threadCount; i++) {
+        workers.emplace_back([this]() { workerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    taskAvailable.notify_all();
+    for (auto& worker : workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+}
+
+void ThreadPool::workerLoop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            taskAvailable.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            if (tasks.empty()) {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop();
+            activeTasks++;
+        }
+        spaceAvailable.notify_one();
+
+        try {
+            task();
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Error in worker task: " << e.what() << std::endl;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            activeTasks--;
+            if (tasks.empty() && activeTasks == 0) {
+                allDone.notify_all();
+            }
+        }
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        spaceAvailable.wait(lock, [this]() { return tasks.size() < queueCapacity; });
+        tasks.push(std::move(task));
+    }
+    taskAvailable.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(queueMutex);
+    allDone.wait(lock, [this]() { return tasks.empty() && activeTasks == 0; });
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& body) {
+    if (count == 0) {
+        return;
+    }
+
+    // Nothing to gain from handing a single item (or a single worker) off
+    if (count == 1 || workers.size() == 1) {
+        for (size_t i = 0; i < count; i++) {
+            body(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> nextIndex(0);
+    std::atomic<bool> failed(false);
+    std::exception_ptr firstError;
+    std::mutex doneMutex;
+    std::condition_variable doneCondition;
+    size_t runners = std::min(count, workers.size());
+    size_t finishedRunners = 0;
+
+    for (size_t r = 0; r < runners; r++) {
+        submit([&]() {
+            while (!failed) {
+                size_t i = nextIndex++;
+                if (i >= count) break;
+                try {
+                    body(i);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(doneMutex);
+                    if (!firstError) {
+                        firstError = std::current_exception();
+                    }
+                    failed = true;
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(doneMutex);
+            finishedRunners++;
+            doneCondition.notify_one();
+        });
+    }
+
+    std::unique_lock<std::mutex> lock(doneMutex);
+    doneCondition.wait(lock, [&]() { return finishedRunners == runners; });
+    if (firstError) {
+        std::rethrow_exception(firstError);
+    }
+}
+
+size_t ThreadPool::getThreadCount() const {
+    return workers.size();
+}
+
+size_t ThreadPool::defaultThreadCount() {
+    unsigned int count = std::thread::hardware_concurrency();
+    return count == 0 ? 1 : count;
+}
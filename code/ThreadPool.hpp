@@ -0,0 +1,46 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+// Fixed-size worker pool with a bounded task queue. submit() blocks while the
+// queue is full so producers cannot run arbitrarily far ahead of the workers.
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex queueMutex;
+    std::condition_variable taskAvailable;
+    std::condition_variable spaceAvailable;
+    std::condition_variable allDone;
+    size_t queueCapacity;
+    size_t activeTasks;
+    bool stopping;
+
+    void workerLoop();
+
+public:
+    explicit ThreadPool(size_t threadCount, size_t capacity = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task);
+    void wait();
+
+    // Runs body(i) for every i in [0, count) across the pool and rethrows the
+    // first exception raised by any invocation once all of them have finished.
+    void parallelFor(size_t count, const std::function<void(size_t)>& body);
+
+    size_t getThreadCount() const;
+    static size_t defaultThreadCount();
+};
+
+#endif // THREAD_POOL_HPP
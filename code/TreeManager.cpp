@@ -0,0 +1,284 @@
+#include "TreeManager.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+ObjectId TreeManager::writeSubtree(const ObjectId& base,
+                                   std::map<std::string, ObjectId>::const_iterator begin,
+                                   std::map<std::string, ObjectId>::const_iterator end,
+                                   size_t prefixLength) {
+    std::map<std::string, TreeEntry> entries;
+    if (!base.isNull()) {
+        for (auto& entry : fileManager.readTree(base)) {
+            std::string name = entry.name;
+            entries.emplace(std::move(name), std::move(entry));
+        }
+    }
+
+    auto change = begin;
+    while (change != end) {
+        const std::string& path = change->first;
+        size_t slash = path.find('/', prefixLength);
+        std::string name = path.substr(prefixLength, slash == std::string::npos ? std::string::npos
+                                                                                : slash - prefixLength);
+        if (name.empty()) {
+            throw std::runtime_error("Invalid path in snapshot: " + path);
+        }
+
+        if (slash == std::string::npos) {
+            if (change->second.isNull()) {
+                entries.erase(name);
+            }
+            else {
+                entries[name] = TreeEntry{name, TreeEntryKind::File, change->second};
+            }
+            ++change;
+            continue;
+        }
+
+        // Paths under one directory sort next to each other, so the whole
+        // directory is handled by one recursive call
+        std::string childPrefix = path.substr(0, slash + 1);
+        auto groupEnd = change;
+        while (groupEnd != end && groupEnd->first.compare(0, childPrefix.size(), childPrefix) == 0) {
+            ++groupEnd;
+        }
+
+        auto existing = entries.find(name);
+        ObjectId childBase;
+        if (existing != entries.end() && existing->second.kind == TreeEntryKind::Tree) {
+            childBase = existing->second.hash;
+        }
+
+        ObjectId child = writeSubtree(childBase, change, groupEnd, childPrefix.size());
+        if (child.isNull()) {
+            // A file that replaced the directory in this same change set
+            // sorts first and is already in place
+            if (existing != entries.end() && existing->second.kind == TreeEntryKind::Tree) {
+                entries.erase(existing);
+            }
+        }
+        else {
+            entries[name] = TreeEntry{name, TreeEntryKind::Tree, child};
+        }
+        change = groupEnd;
+    }
+
+    if (entries.empty()) {
+        return ObjectId();
+    }
+
+    std::vector<TreeEntry> sorted;
+    sorted.reserve(entries.size());
+    for (auto& [name, entry] : entries) {
+        sorted.push_back(std::move(entry));
+    }
+    return fileManager.storeTree(sorted);
+}
+
+ObjectId TreeManager::writeTree(const ObjectId& baseTree, const std::map<std::string, ObjectId>& changes) {
+    ObjectId root = writeSubtree(baseTree, changes.begin(), changes.end(), 0);
+    // The root is stored even when empty so every snapshot has a tree
+    return root.isNull() ? fileManager.storeTree({}) : root;
+}
+
+bool TreeManager::findEntry(const ObjectId& tree, const std::string& path, TreeEntry& found) {
+    ObjectId current = tree;
+    size_t start = 0;
+    while (true) {
+        size_t slash = path.find('/', start);
+        std::string name = path.substr(start, slash == std::string::npos ? std::string::npos : slash - start);
+
+        // Entries are sorted by name
+        auto entries = fileManager.readTree(current);
+        auto entry = std::lower_bound(entries.begin(), entries.end(), name,
+                                      [](const TreeEntry& item, const std::string& key) { return item.name < key; });
+        if (entry == entries.end() || entry->name != name) {
+            return false;
+        }
+        if (slash == std::string::npos) {
+            found = *entry;
+            return true;
+        }
+        if (entry->kind != TreeEntryKind::Tree) {
+            return false;
+        }
+        current = entry->hash;
+        start = slash + 1;
+    }
+}
+
+bool TreeManager::lookup(const ObjectId& tree, const std::string& path, ObjectId& hash) {
+    TreeEntry entry;
+    if (!findEntry(tree, path, entry) || entry.kind != TreeEntryKind::File) {
+        return false;
+    }
+    hash = entry.hash;
+    return true;
+}
+
+void TreeManager::lookupInto(const ObjectId& tree,
+                             std::vector<std::pair<std::string, size_t>>::const_iterator begin,
+                             std::vector<std::pair<std::string, size_t>>::const_iterator end,
+                             size_t prefixLength, std::vector<ObjectId>& hashes) {
+    // Entries are sorted by name
+    auto entries = fileManager.readTree(tree);
+    auto wanted = begin;
+    while (wanted != end) {
+        const std::string& path = wanted->first;
+        size_t slash = path.find('/', prefixLength);
+        std::string name = path.substr(prefixLength, slash == std::string::npos ? std::string::npos
+                                                                                : slash - prefixLength);
+        auto entry = std::lower_bound(entries.begin(), entries.end(), name,
+                                      [](const TreeEntry& item, const std::string& key) { return item.name < key; });
+        bool found = entry != entries.end() && entry->name == name;
+
+        if (slash == std::string::npos) {
+            if (found && entry->kind == TreeEntryKind::File) {
+                hashes[wanted->second] = entry->hash;
+            }
+            ++wanted;
+            continue;
+        }
+
+        // Paths under one directory sort next to each other, so the
+        // directory is read once for all of them
+        std::string childPrefix = path.substr(0, slash + 1);
+        auto groupEnd = wanted;
+        while (groupEnd != end && groupEnd->first.compare(0, childPrefix.size(), childPrefix) == 0) {
+            ++groupEnd;
+        }
+        if (found && entry->kind == TreeEntryKind::Tree) {
+            lookupInto(entry->hash, wanted, groupEnd, childPrefix.size(), hashes);
+        }
+        wanted = groupEnd;
+    }
+}
+
+std::vector<ObjectId> TreeManager::lookup(const ObjectId& tree, const std::vector<std::string>& paths) {
+    std::vector<std::pair<std::string, size_t>> sorted;
+    sorted.reserve(paths.size());
+    for (size_t i = 0; i < paths.size(); i++) {
+        sorted.emplace_back(paths[i], i);
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    std::vector<ObjectId> hashes(paths.size());
+    if (!sorted.empty()) {
+        lookupInto(tree, sorted.begin(), sorted.end(), 0, hashes);
+    }
+    return hashes;
+}
+
+void TreeManager::flattenInto(const ObjectId& tree, const std::string& prefix,
+                              std::map<std::string, ObjectId>& files) {
+    for (const auto& entry : fileManager.readTree(tree)) {
+        if (entry.kind == TreeEntryKind::Tree) {
+            flattenInto(entry.hash, prefix + entry.name + "/", files);
+        }
+        else {
+            files[prefix + entry.name] = entry.hash;
+        }
+    }
+}
+
+std::map<std::string, ObjectId> TreeManager::flatten(const ObjectId& tree) {
+    std::map<std::string, ObjectId> files;
+    flattenInto(tree, "", files);
+    return files;
+}
+
+std::map<std::string, ObjectId> TreeManager::flatten(const ObjectId& tree, const std::string& path) {
+    if (path.empty()) {
+        return flatten(tree);
+    }
+
+    std::map<std::string, ObjectId> files;
+    TreeEntry entry;
+    if (findEntry(tree, path, entry)) {
+        if (entry.kind == TreeEntryKind::Tree) {
+            flattenInto(entry.hash, path + "/", files);
+        }
+        else {
+            files[path] = entry.hash;
+        }
+    }
+    return files;
+}
+
+void TreeManager::diffInto(const ObjectId& fromTree, const ObjectId& toTree, const std::string& prefix,
+                           std::vector<FileChange>& changes) {
+    if (fromTree == toTree) {
+        return;
+    }
+    std::vector<TreeEntry> from = fromTree.isNull() ? std::vector<TreeEntry>() : fileManager.readTree(fromTree);
+    std::vector<TreeEntry> to = toTree.isNull() ? std::vector<TreeEntry>() : fileManager.readTree(toTree);
+
+    // A side's entry is reported as a file or walked as a directory, with
+    // the other side's entry of the same kind, if any
+    auto compare = [&](const TreeEntry* a, const TreeEntry* b) {
+        const TreeEntry& entry = a ? *a : *b;
+        if (entry.kind == TreeEntryKind::Tree) {
+            diffInto(a ? a->hash : ObjectId(), b ? b->hash : ObjectId(), prefix + entry.name + "/", changes);
+        }
+        else if (!a || !b || a->hash != b->hash) {
+            changes.push_back({prefix + entry.name, a ? a->hash : ObjectId(), b ? b->hash : ObjectId()});
+        }
+    };
+
+    // Entries are sorted by name, so one pass pairs them up
+    size_t i = 0;
+    size_t j = 0;
+    while (i < from.size() || j < to.size()) {
+        if (j == to.size() || (i < from.size() && from[i].name < to[j].name)) {
+            compare(&from[i++], nullptr);
+        }
+        else if (i == from.size() || to[j].name < from[i].name) {
+            compare(nullptr, &to[j++]);
+        }
+        else if (from[i].kind == to[j].kind) {
+            compare(&from[i++], &to[j++]);
+        }
+        else {
+            // A file replaced by a directory or the other way round
+            compare(&from[i++], nullptr);
+            compare(nullptr, &to[j++]);
+        }
+    }
+}
+
+std::vector<FileChange> TreeManager::diff(const ObjectId& fromTree, const ObjectId& toTree) {
+    std::vector<FileChange> changes;
+    diffInto(fromTree, toTree, "", changes);
+    // Tree order puts "a/" where "a" sorts, not where "a/" does, which
+    // only matters when a sibling's name continues past "a"
+    auto byPath = [](const FileChange& a, const FileChange& b) { return a.path < b.path; };
+    if (!std::is_sorted(changes.begin(), changes.end(), byPath)) {
+        std::sort(changes.begin(), changes.end(), byPath);
+    }
+    return changes;
+}
+
+std::vector<FileChange> TreeManager::diff(const std::map<std::string, ObjectId>& from,
+                                          const std::map<std::string, ObjectId>& to) {
+    std::vector<FileChange> changes;
+    auto a = from.begin();
+    auto b = to.begin();
+    while (a != from.end() || b != to.end()) {
+        if (b == to.end() || (a != from.end() && a->first < b->first)) {
+            changes.push_back({a->first, a->second, ObjectId()});
+            ++a;
+        }
+        else if (a == from.end() || b->first < a->first) {
+            changes.push_back({b->first, ObjectId(), b->second});
+            ++b;
+        }
+        else {
+            if (a->second != b->second) {
+                changes.push_back({a->first, a->second, b->second});
+            }
+            ++a;
+            ++b;
+        }
+    }
+    return changes;
+}
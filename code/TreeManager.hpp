@@ -0,0 +1,72 @@
+#ifndef TREE_MANAGER_HPP
+#define TREE_MANAGER_HPP
+
+#include <string>
+#include <map>
+#include <vector>
+#include "FileManager.hpp"
+
+// A path whose object differs between two snapshots; a null id means that
+// side does not have the path
+struct FileChange {
+    std::string path;
+    ObjectId from;
+    ObjectId to;
+};
+
+// Snapshots of the whole vault as a Merkle tree: one tree object per
+// directory listing its files and subdirectories by hash. A new snapshot
+// is written from the previous one plus the paths that changed, so only
+// the trees along those paths are rewritten; every other directory is
+// shared with the previous snapshot by hash.
+// Paths are relative to the vault with '/' separators.
+class TreeManager {
+private:
+    FileManager& fileManager;
+
+    // Returns the new hash of base with changes applied, or a null id
+    // when nothing is left in it
+    ObjectId writeSubtree(const ObjectId& base,
+                          std::map<std::string, ObjectId>::const_iterator begin,
+                          std::map<std::string, ObjectId>::const_iterator end,
+                          size_t prefixLength);
+    // Fills hashes for the sorted (path, position) pairs in [begin, end),
+    // which all lie under the directory tree stands for
+    void lookupInto(const ObjectId& tree,
+                    std::vector<std::pair<std::string, size_t>>::const_iterator begin,
+                    std::vector<std::pair<std::string, size_t>>::const_iterator end,
+                    size_t prefixLength, std::vector<ObjectId>& hashes);
+    // Walks to the entry at path; false if any part of it is missing
+    bool findEntry(const ObjectId& tree, const std::string& path, TreeEntry& found);
+    void flattenInto(const ObjectId& tree, const std::string& prefix,
+                     std::map<std::string, ObjectId>& files);
+    void diffInto(const ObjectId& fromTree, const ObjectId& toTree, const std::string& prefix,
+                  std::vector<FileChange>& changes);
+
+public:
+    explicit TreeManager(FileManager& fm) : fileManager(fm) {}
+
+    // All of these throw on failure.
+    // Applies changes (path -> object hash, or a null id to remove the
+    // path) to baseTree, which may be null, and returns the new root.
+    ObjectId writeTree(const ObjectId& baseTree, const std::map<std::string, ObjectId>& changes);
+    // Finds the object stored at path; false if there is none
+    bool lookup(const ObjectId& tree, const std::string& path, ObjectId& hash);
+    // The object stored at each path, or a null id; every directory on the
+    // way to any of them is read once
+    std::vector<ObjectId> lookup(const ObjectId& tree, const std::vector<std::string>& paths);
+    // Every file in the snapshot, path -> object hash
+    std::map<std::string, ObjectId> flatten(const ObjectId& tree);
+    // Only the file at path, or every file below it if it is a directory;
+    // trees off the way to path are not read
+    std::map<std::string, ObjectId> flatten(const ObjectId& tree, const std::string& path);
+    // Files that differ between two snapshots, sorted by path; either tree
+    // may be null. Directories with the same hash on both sides are not
+    // read, so the cost follows the size of the difference.
+    std::vector<FileChange> diff(const ObjectId& fromTree, const ObjectId& toTree);
+    // The same for two flattened snapshots, in one pass over both
+    static std::vector<FileChange> diff(const std::map<std::string, ObjectId>& from,
+                                        const std::map<std::string, ObjectId>& to);
+};
+
+#endif // TREE_MANAGER_HPP
@@ -1,5 +1,6 @@
 #include "VaultManager.hpp"
 #include <iostream>
+#include <iomanip>
 #include <jsoncpp/json/json.h>
 
 VaultManager::VaultManager(const std::string& basePath) : vaultPath(basePath) {
@@ -14,17 +15,85 @@ VaultManager::VaultManager(const std::string& basePath) : vaultPath(basePath) {
         *fileManager
     );
     
+    commitLog = std::make_unique<CommitLog>(
+        (fs::path(basePath) / VAULT_DIR / COMMITS_DIR).string()
+    );
+
+    commitGraph = std::make_unique<CommitGraph>(
+        (fs::path(basePath) / VAULT_DIR / COMMITS_DIR / COMMIT_GRAPH_FILE).string(),
+        *commitLog
+    );
+
+    historyIndex = std::make_unique<HistoryIndex>(
+        (fs::path(basePath) / VAULT_DIR / COMMITS_DIR / HISTORY_INDEX_FILE).string(),
+        *commitLog
+    );
+
+    treeManager = std::make_unique<TreeManager>(*fileManager);
+
+    stagingIndex = std::make_unique<StagingIndex>(
+        (fs::path(basePath) / VAULT_DIR / STAGING_INDEX_FILE).string()
+    );
+
     commitManager = std::make_unique<CommitManager>(
-        fs::path(basePath) / VAULT_DIR,
-        COMMITS_DIR,
+        *commitLog,
+        *historyIndex,
         *fileManager,
-        *branchManager
+        *branchManager,
+        *treeManager,
+        *stagingIndex,
+        basePath
+    );
+
+    statCache = std::make_unique<StatCache>(
+        (fs::path(basePath) / VAULT_DIR / STAT_CACHE_FILE).string()
     );
 
     syncManager = std::make_unique<SyncManager>(
         *fileManager,
-        *commitManager
+        *commitManager,
+        *statCache
+    );
+
+    garbageCollector = std::make_unique<GarbageCollector>(
+        fs::path(basePath) / VAULT_DIR,
+        *commitLog,
+        BRANCHES_DIR,
+        STAGING_INDEX_FILE,
+        *fileManager
+    );
+
+    integrityChecker = std::make_unique<IntegrityChecker>(
+        fs::path(basePath) / VAULT_DIR,
+        *commitLog,
+        BRANCHES_DIR,
+        STAGING_INDEX_FILE,
+        *fileManager
+    );
+
+    workTreeCache = std::make_unique<StatCache>(
+        (fs::path(basePath) / VAULT_DIR / WORK_TREE_CACHE_FILE).string()
+    );
+
+    checkoutManager = std::make_unique<CheckoutManager>(
+        basePath,
+        *commitLog,
+        *branchManager,
+        *treeManager,
+        *fileManager,
+        *workTreeCache
+    );
+
+    mergeManager = std::make_unique<MergeManager>(
+        *commitLog,
+        *commitGraph,
+        *treeManager
     );
+
+    if (isVaultInitialized()) {
+        loadConfigFile();
+        importLegacyData();
+    }
 }
 
 bool VaultManager::createVaultDirectory() {
@@ -49,20 +118,110 @@ bool VaultManager::createVaultDirectory() {
 }
 
 bool VaultManager::createConfigFile() {
+    createdAt = std::to_string(std::time(nullptr));
+    return saveConfigFile();
+}
+
+bool VaultManager::saveConfigFile() {
     try {
         fs::path configPath = fs::path(vaultPath) / VAULT_DIR / CONFIG_FILE;
         std::ofstream configFile(configPath);
-        if (configFile.is_open()) {
-            configFile << "{\n";
-            configFile << "  \"created_at\": \"" << std::time(nullptr) << "\",\n";
-            configFile << "  \"version\": \"1.0\"\n";
-            configFile << "}\n";
-            return true;
+        if (!configFile.is_open()) {
+            return false;
         }
+
+        Json::Value root;
+        root["created_at"] = createdAt;
+        root["version"] = "1.0";
+        root["hash_algorithm"] = hashAlgorithmName(fileManager->getHashAlgorithm());
+        root["change_detection"] = hashAlgorithmName(fileManager->getChangeDetectionAlgorithm());
+        root["chunking"] = fileManager->isChunkingEnabled();
+        root["chunking_threshold"] = Json::Value::UInt64(fileManager->getChunkingThreshold());
+        root["compression"] = compressionCodecName(fileManager->getCompressionCodec());
+        root["compression_level"] = fileManager->getCompressionLevel();
+        root["delta_storage"] = fileManager->isDeltaStorageEnabled();
+
+        Json::StreamWriterBuilder writer;
+        writer["indentation"] = "  ";
+        configFile << Json::writeString(writer, root) << "\n";
+        return true;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error writing config file: " << e.what() << std::endl;
         return false;
     }
+}
+
+bool VaultManager::importLegacyData() {
+    try {
+        size_t imported = commitLog->importLegacyCommits();
+        if (imported > 0) {
+            std::cout << "Moved " << imported << " commits into the commit log" << std::endl;
+        }
+        size_t branches = branchManager->importLegacyRefs();
+        if (branches > 0) {
+            std::cout << "Moved " << branches << " branch heads into the ref store" << std::endl;
+        }
+        return true;
+    }
     catch (const std::exception& e) {
-        std::cerr << "Error creating config file: " << e.what() << std::endl;
+        std::cerr << "Error importing legacy data: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool VaultManager::loadConfigFile() {
+    try {
+        fs::path configPath = fs::path(vaultPath) / VAULT_DIR / CONFIG_FILE;
+        std::ifstream configFile(configPath);
+        if (!configFile.is_open()) {
+            return false;
+        }
+
+        Json::Value root;
+        Json::CharReaderBuilder reader;
+        JSONCPP_STRING errs;
+        if (!Json::parseFromStream(reader, configFile, &root, &errs)) {
+            throw std::runtime_error("Failed to parse config: " + errs);
+        }
+
+        createdAt = root.get("created_at", "").asString();
+
+        // Vaults created before the setting existed were always SHA-256
+        HashAlgorithm algorithm;
+        std::string contentName = root.get("hash_algorithm", "sha256").asString();
+        if (!parseHashAlgorithm(contentName, algorithm) || !fileManager->setHashAlgorithm(algorithm)) {
+            throw std::runtime_error("Unsupported hash algorithm in config: " + contentName);
+        }
+
+        // A change detection hash that this build lacks only costs speed,
+        // so fall back to the content hash rather than refusing to open
+        std::string changeName = root.get("change_detection", contentName).asString();
+        if (!parseHashAlgorithm(changeName, algorithm) || !fileManager->setChangeDetectionAlgorithm(algorithm)) {
+            std::cerr << "Falling back to " << contentName << " for change detection" << std::endl;
+            fileManager->setChangeDetectionAlgorithm(fileManager->getHashAlgorithm());
+        }
+
+        fileManager->setChunking(
+            root.get("chunking", false).asBool(),
+            root.get("chunking_threshold", Json::Value::UInt64(FileManager::DEFAULT_CHUNKING_THRESHOLD)).asUInt64());
+
+        // Objects already written stay readable whatever is configured here;
+        // an unknown or unavailable codec only disables compression of new ones
+        CompressionCodec codec;
+        std::string codecName = root.get("compression", "none").asString();
+        if (!parseCompressionCodec(codecName, codec) ||
+            !fileManager->setCompression(codec, root.get("compression_level", 0).asInt())) {
+            std::cerr << "Storing new objects uncompressed" << std::endl;
+            fileManager->setCompression(CompressionCodec::None, 0);
+        }
+
+        fileManager->setDeltaStorage(root.get("delta_storage", true).asBool());
+
+        return true;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error loading config file: " << e.what() << std::endl;
         return false;
     }
 }
@@ -106,16 +265,59 @@ bool VaultManager::addFile(const std::string& filePath) {
     return commitManager->stageFile(filePath);
 }
 
+bool VaultManager::addFiles(const std::vector<std::string>& filePaths) {
+    return commitManager->stageFiles(filePaths);
+}
+
+std::vector<std::string> VaultManager::getStagedFiles() const {
+    return commitManager->getStagedFiles();
+}
+
 bool VaultManager::commit(const std::string& message) {
-    return commitManager->commit(message);
+    if (!commitManager->commit(message)) {
+        return false;
+    }
+
+    // The graph is derived from the log, so if extending it fails here the
+    // next ancestry query simply catches up
+    try {
+        commitGraph->update();
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error updating commit graph: " << e.what() << std::endl;
+    }
+    return true;
 }
 
 bool VaultManager::createBranch(const std::string& branchName) {
     return branchManager->createBranch(branchName);
 }
 
-bool VaultManager::switchBranch(const std::string& branchName) {
-    return branchManager->switchBranch(branchName, "");
+bool VaultManager::switchBranch(const std::string& branchName, CheckoutStats* stats) {
+    try {
+        std::string current = branchManager->getCurrentBranch();
+        CheckoutStats result = checkoutManager->switchBranch(current, branchName);
+        for (const auto& problem : result.problems) {
+            std::cerr << problem << std::endl;
+        }
+        if (stats) {
+            *stats = result;
+        }
+        if (result.filesModified > 0) {
+            throw std::runtime_error("Commit or discard local changes first");
+        }
+
+        std::cout << std::fixed << std::setprecision(1)
+                  << "Switching to " << branchName << ": wrote " << result.filesWritten << " and deleted "
+                  << result.filesDeleted << " files in " << result.seconds << "s, "
+                  << result.filesUnchanged << " unchanged, " << result.filesFailed << " failed"
+                  << std::defaultfloat << std::endl;
+        return branchManager->switchBranch(branchName, "") && result.filesFailed == 0;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error switching branch: " << e.what() << std::endl;
+        return false;
+    }
 }
 
 std::vector<std::string> VaultManager::listBranches() const {
@@ -126,6 +328,144 @@ std::vector<FileVersion> VaultManager::getFileHistory(const std::string& filePat
     return commitManager->getFileHistory(filePath);
 }
 
+std::vector<FileVersion> VaultManager::getFileHistory(const std::string& filePath, size_t skip, size_t limit) {
+    return commitManager->getFileHistory(filePath, skip, limit);
+}
+
+bool VaultManager::checkout(const std::string& target, const std::vector<std::string>& paths,
+                            CheckoutStats* stats) {
+    try {
+        if (!isVaultInitialized()) {
+            throw std::runtime_error("Vault is not initialized");
+        }
+
+        CheckoutStats result = checkoutManager->checkout(target, paths);
+        for (const auto& problem : result.problems) {
+            std::cerr << problem << std::endl;
+        }
+        std::cout << std::fixed << std::setprecision(1)
+                  << "Checked out " << target << ": wrote " << result.filesWritten << " of "
+                  << result.filesSelected << " files (" << result.bytesWritten << " bytes) in "
+                  << result.seconds << "s, " << result.filesUnchanged << " unchanged, "
+                  << result.filesFailed << " failed" << std::defaultfloat << std::endl;
+
+        if (stats) {
+            *stats = result;
+        }
+        return result.filesFailed == 0;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error checking out " << target << ": " << e.what() << std::endl;
+        return false;
+    }
+}
+
+std::string VaultManager::getBranchHead(const std::string& branchName) const {
+    return branchManager->getBranchHead(branchName);
+}
+
+bool VaultManager::isAncestor(const std::string& ancestor, const std::string& descendant) {
+    try {
+        return commitGraph->isAncestor(ancestor, descendant);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error checking ancestry: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+std::string VaultManager::getMergeBase(const std::string& first, const std::string& second) {
+    try {
+        return commitGraph->mergeBase(first, second);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error finding merge base: " << e.what() << std::endl;
+        return "";
+    }
+}
+
+std::vector<std::string> VaultManager::getCommitsSince(const std::string& since, const std::string& head) {
+    try {
+        return commitGraph->commitsSince(since, head);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error listing commits: " << e.what() << std::endl;
+        return {};
+    }
+}
+
+std::vector<FileChange> VaultManager::diff(const std::string& from, const std::string& to) {
+    try {
+        return mergeManager->diff(checkoutManager->resolveCommit(from), checkoutManager->resolveCommit(to));
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error comparing " << from << " and " << to << ": " << e.what() << std::endl;
+        return {};
+    }
+}
+
+bool VaultManager::merge(const std::string& source, MergeResult* result) {
+    try {
+        std::string current = branchManager->getCurrentBranch();
+        std::string theirs = checkoutManager->resolveCommit(source);
+        MergeResult plan = mergeManager->merge(branchManager->getBranchHead(current), theirs);
+        if (result) {
+            *result = plan;
+        }
+        if (plan.upToDate) {
+            std::cout << current << " is already up to date with " << source << std::endl;
+            return true;
+        }
+        if (!plan.conflicts.empty()) {
+            for (const auto& path : plan.conflicts) {
+                std::cerr << "Conflict: " << path << std::endl;
+            }
+            throw std::runtime_error(std::to_string(plan.conflicts.size()) + " paths changed on both sides");
+        }
+
+        // Checked up front, but written after the branch moves: a failure
+        // part way through leaves the work tree behind the branch rather
+        // than holding a merge that was never committed
+        CheckoutStats check = checkoutManager->checkWorkTree(plan.changes);
+        for (const auto& problem : check.problems) {
+            std::cerr << problem << std::endl;
+        }
+        if (check.filesModified > 0) {
+            throw std::runtime_error("Commit or discard local changes first");
+        }
+
+        if (plan.fastForward) {
+            std::map<std::string, ObjectId> changes;
+            for (const auto& change : plan.changes) {
+                changes[change.path] = change.to;
+            }
+            if (!branchManager->updateBranchState(current, changes) ||
+                !branchManager->switchBranch(current, theirs)) {
+                throw std::runtime_error("Failed to move " + current + " to " + theirs);
+            }
+        }
+        else {
+            if (!commitManager->commitMerge(theirs, plan.changes, "Merge " + source + " into " + current)) {
+                throw std::runtime_error("Failed to commit the merge");
+            }
+            commitGraph->update();
+        }
+
+        CheckoutStats stats = checkoutManager->updateWorkTree(plan.changes);
+        for (const auto& problem : stats.problems) {
+            std::cerr << problem << std::endl;
+        }
+
+        std::cout << "Merged " << source << " into " << current << (plan.fastForward ? " (fast-forward)" : "")
+                  << ": " << plan.changes.size() << " files changed" << std::endl;
+        return stats.filesModified == 0 && stats.filesFailed == 0;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error merging " << source << ": " << e.what() << std::endl;
+        return false;
+    }
+}
+
 std::string VaultManager::getCurrentBranch() const {
     return branchManager->getCurrentBranch();
 }
@@ -134,6 +474,159 @@ bool VaultManager::checkoutFile(const std::string& filePath, const std::string&
     return commitManager->checkoutFile(filePath, commitId);
 }
 
+bool VaultManager::setHashAlgorithm(const std::string& algorithmName) {
+    // Changing the algorithm of an existing vault would stop new objects
+    // from deduplicating against everything stored so far
+    if (isVaultInitialized()) {
+        std::cerr << "Hash algorithm can only be chosen before the vault is initialized" << std::endl;
+        return false;
+    }
+
+    HashAlgorithm algorithm;
+    if (!parseHashAlgorithm(algorithmName, algorithm)) {
+        std::cerr << "Unknown hash algorithm: " << algorithmName << std::endl;
+        return false;
+    }
+    return fileManager->setHashAlgorithm(algorithm);
+}
+
+bool VaultManager::setChangeDetectionAlgorithm(const std::string& algorithmName) {
+    if (isVaultInitialized()) {
+        std::cerr << "Change detection is configured in " << CONFIG_FILE << " once the vault exists" << std::endl;
+        return false;
+    }
+
+    HashAlgorithm algorithm;
+    if (!parseHashAlgorithm(algorithmName, algorithm)) {
+        std::cerr << "Unknown hash algorithm: " << algorithmName << std::endl;
+        return false;
+    }
+    return fileManager->setChangeDetectionAlgorithm(algorithm);
+}
+
+bool VaultManager::setChunking(bool enabled, uint64_t threshold) {
+    fileManager->setChunking(enabled, threshold);
+
+    // Both object layouts stay readable, so this can change at any time
+    return !isVaultInitialized() || saveConfigFile();
+}
+
+bool VaultManager::setCompression(const std::string& codecName, int level) {
+    CompressionCodec codec;
+    if (!parseCompressionCodec(codecName, codec)) {
+        std::cerr << "Unknown compression codec: " << codecName << std::endl;
+        return false;
+    }
+    if (!fileManager->setCompression(codec, level)) {
+        return false;
+    }
+
+    return !isVaultInitialized() || saveConfigFile();
+}
+
+bool VaultManager::repack() {
+    try {
+        if (!isVaultInitialized()) {
+            throw std::runtime_error("Vault is not initialized");
+        }
+
+        size_t packed = fileManager->repackObjects();
+        std::cout << "Packed " << packed << " loose objects" << std::endl;
+        return true;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error repacking objects: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool VaultManager::gc(uint64_t graceSeconds, GcStats* stats) {
+    try {
+        if (!isVaultInitialized()) {
+            throw std::runtime_error("Vault is not initialized");
+        }
+
+        GcStats result = garbageCollector->collect(graceSeconds);
+        std::cout << "Garbage collection kept " << result.reachableObjects << " objects, removed "
+                  << result.removedObjects << " and reclaimed " << result.reclaimedBytes << " bytes";
+        if (result.rewrittenPacks > 0) {
+            std::cout << " (" << result.rewrittenPacks << " packs rewritten)";
+        }
+        std::cout << std::endl;
+        if (result.missingObjects > 0) {
+            std::cerr << result.missingObjects << " referenced objects are missing" << std::endl;
+        }
+
+        if (stats) {
+            *stats = result;
+        }
+        return true;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error collecting garbage: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool VaultManager::verify(VerifyStats* stats) {
+    try {
+        if (!isVaultInitialized()) {
+            throw std::runtime_error("Vault is not initialized");
+        }
+
+        VerifyStats result = integrityChecker->verify();
+        for (const auto& problem : result.problems) {
+            std::cerr << problem << std::endl;
+        }
+        std::cout << std::fixed << std::setprecision(1)
+                  << "Verified " << result.objectsChecked << " objects from " << result.rootsChecked
+                  << " commits and branches in " << result.seconds << "s ("
+                  << result.megabytesPerSecond() << " MB/s, " << result.objectsPerSecond()
+                  << " objects/s): " << result.corruptObjects << " corrupt, " << result.missingObjects
+                  << " missing" << std::defaultfloat << std::endl;
+
+        if (stats) {
+            *stats = result;
+        }
+        return result.isClean();
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error verifying vault: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+TransferStats VaultManager::getTransferStats() const {
+    return FileTransfer::getStats();
+}
+
+MetadataCacheStats VaultManager::getMetadataCacheStats() const {
+    MetadataCacheStats stats;
+    stats.commits = commitLog->getCacheStats();
+    stats.branchStates = branchManager->getStateCacheStats();
+    return stats;
+}
+
+void VaultManager::setMetadataCacheSize(size_t commitBytes, size_t branchStateBytes) {
+    commitLog->setCacheCapacity(commitBytes);
+    branchManager->setStateCacheCapacity(branchStateBytes);
+}
+
+void VaultManager::setStateCompactionThreshold(uint64_t bytes) {
+    branchManager->setCompactionThreshold(bytes);
+}
+
+bool VaultManager::setDeltaStorage(bool enabled) {
+    fileManager->setDeltaStorage(enabled);
+
+    // Existing deltas stay readable either way
+    return !isVaultInitialized() || saveConfigFile();
+}
+
+void VaultManager::setIngestThreads(size_t threadCount) {
+    commitManager->setIngestThreads(threadCount);
+}
+
 // Synchronization operations
 bool VaultManager::initializeSync(const std::string& source, const std::string& dest) {
     return syncManager->initializeSync(source, dest);
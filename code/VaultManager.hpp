@@ -5,8 +5,20 @@
 #include "BranchManager.hpp"
 #include "CommitManager.hpp"
 #include "SyncManager.hpp"
+#include "FileTransfer.hpp"
+#include "GarbageCollector.hpp"
+#include "IntegrityChecker.hpp"
+#include "CommitGraph.hpp"
+#include "CheckoutManager.hpp"
+#include "MergeManager.hpp"
 #include <memory>
 
+// Hit and miss counts of the in-memory metadata caches
+struct MetadataCacheStats {
+    CacheStats commits;
+    CacheStats branchStates;
+};
+
 class VaultManager {
 private:
     std::string vaultPath;
@@ -15,14 +27,34 @@ private:
     const std::string OBJECTS_DIR = "objects";
     const std::string COMMITS_DIR = "commits";
     const std::string BRANCHES_DIR = "branches";
+    const std::string STAT_CACHE_FILE = "statcache";
+    const std::string COMMIT_GRAPH_FILE = "graph";
+    const std::string HISTORY_INDEX_FILE = "history";
+    const std::string WORK_TREE_CACHE_FILE = "worktree";
+    const std::string STAGING_INDEX_FILE = "index";
+    std::string createdAt;
 
     std::unique_ptr<FileManager> fileManager;
     std::unique_ptr<BranchManager> branchManager;
+    std::unique_ptr<CommitLog> commitLog;
+    std::unique_ptr<CommitGraph> commitGraph;
+    std::unique_ptr<HistoryIndex> historyIndex;
+    std::unique_ptr<TreeManager> treeManager;
+    std::unique_ptr<StagingIndex> stagingIndex;
     std::unique_ptr<CommitManager> commitManager;
+    std::unique_ptr<StatCache> statCache;
+    std::unique_ptr<StatCache> workTreeCache;
     std::unique_ptr<SyncManager> syncManager;
+    std::unique_ptr<GarbageCollector> garbageCollector;
+    std::unique_ptr<IntegrityChecker> integrityChecker;
+    std::unique_ptr<CheckoutManager> checkoutManager;
+    std::unique_ptr<MergeManager> mergeManager;
 
     bool createVaultDirectory();
     bool createConfigFile();
+    bool loadConfigFile();
+    bool saveConfigFile();
+    bool importLegacyData();
 
 public:
     VaultManager(const std::string& basePath);
@@ -39,13 +71,71 @@ public:
 
     // Delegated operations
     bool addFile(const std::string& filePath);
+    // Stages several files at once, hashing them in parallel
+    bool addFiles(const std::vector<std::string>& filePaths);
+    // Paths of the files staged for the next commit
+    std::vector<std::string> getStagedFiles() const;
     bool commit(const std::string& message);
     bool createBranch(const std::string& branchName);
-    bool switchBranch(const std::string& branchName);
+    // Makes branchName current and brings the work tree to its files,
+    // touching only files that differ between the two branches. Refuses,
+    // changing nothing, if any of those has local changes. Fills stats if
+    // given.
+    bool switchBranch(const std::string& branchName, CheckoutStats* stats = nullptr);
     std::vector<std::string> listBranches() const;
     std::vector<FileVersion> getFileHistory(const std::string& filePath);
+    // One page of the history, newest first, for paths with many versions
+    std::vector<FileVersion> getFileHistory(const std::string& filePath, size_t skip, size_t limit);
     std::string getCurrentBranch() const;
     bool checkoutFile(const std::string& filePath, const std::string& commitId);
+    // Writes the snapshot of a branch head or commit into the work tree,
+    // skipping files that already match; paths limit it to those files and
+    // directories. True if every selected file was restored; fills stats if
+    // given.
+    bool checkout(const std::string& target, const std::vector<std::string>& paths = {},
+                  CheckoutStats* stats = nullptr);
+    std::string getBranchHead(const std::string& branchName) const;
+
+    // Ancestry queries over the commit graph; on error they report it and
+    // return false or an empty result
+    bool isAncestor(const std::string& ancestor, const std::string& descendant);
+    std::string getMergeBase(const std::string& first, const std::string& second);
+    // Commits in head's history that are not in since's, newest first
+    std::vector<std::string> getCommitsSince(const std::string& since, const std::string& head);
+    // Files that differ between two branches or commits, sorted by path
+    std::vector<FileChange> diff(const std::string& from, const std::string& to);
+    // Merges a branch or commit into the current branch: changes only the
+    // other side made since the merge base are applied to the work tree and
+    // committed with both heads as parents. Nothing is changed if a path was
+    // changed differently on both sides or has local changes. Fills result
+    // if given.
+    bool merge(const std::string& source, MergeResult* result = nullptr);
+    void setIngestThreads(size_t threadCount);
+
+    // Hash selection, recorded in config.json when the vault is initialized
+    bool setHashAlgorithm(const std::string& algorithmName);
+    bool setChangeDetectionAlgorithm(const std::string& algorithmName);
+    bool setChunking(bool enabled, uint64_t threshold = FileManager::DEFAULT_CHUNKING_THRESHOLD);
+    bool setCompression(const std::string& codecName, int level = 0);
+    bool setDeltaStorage(bool enabled);
+
+    // Folds small loose objects into a pack file
+    bool repack();
+    // Deletes objects no commit or branch needs that are older than the
+    // grace period; fills stats if given
+    bool gc(uint64_t graceSeconds = GarbageCollector::DEFAULT_GRACE_SECONDS, GcStats* stats = nullptr);
+    // Rehashes every object and checks that everything commits and branches
+    // name is present; true when nothing is wrong. Fills stats if given.
+    bool verify(VerifyStats* stats = nullptr);
+    // How file copies were carried out, per transfer strategy
+    TransferStats getTransferStats() const;
+    // Decoded commits and branch states are kept in memory up to these
+    // estimated sizes, least recently used first out
+    MetadataCacheStats getMetadataCacheStats() const;
+    void setMetadataCacheSize(size_t commitBytes, size_t branchStateBytes);
+    // Commits append their changes to a per-branch journal, which is folded
+    // into the branch's state.json in the background past this size
+    void setStateCompactionThreshold(uint64_t bytes);
 
     // Synchronization operations
     bool initializeSync(const std::string& source, const std::string& dest);
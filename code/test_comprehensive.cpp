@@ -3,6 +3,10 @@
 #include <filesystem>
 #include <chrono>
 #include <thread>
+#include <random>
+#include <algorithm>
+#include <unordered_set>
+#include <atomic>
 #include "FileMonitor.hpp"
 #include "VaultManager.hpp"
 
@@ -30,6 +34,11 @@ bool compare_files(const std::string& path1, const std::string& path2) {
     return str1 == str2;
 }
 
+std::string read_file(const std::string& path) {
+    std::ifstream file(path);
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
 // Milestone 1 Tests
 void test_vault_initialization() {
     print_separator("Milestone 1 - Vault Initialization Tests");
@@ -40,6 +49,12 @@ void test_vault_initialization() {
     if (!vault.initializeVault()) throw std::runtime_error("Failed to initialize vault");
     if (!fs::exists("test_vault/.vault")) throw std::runtime_error("Vault directory not created");
     if (!fs::exists("test_vault/.vault/config.json")) throw std::runtime_error("Config file not created");
+    {
+        std::ifstream config("test_vault/.vault/config.json");
+        std::string content((std::istreambuf_iterator<char>(config)), std::istreambuf_iterator<char>());
+        if (content.find("\"hash_algorithm\"") == std::string::npos)
+            throw std::runtime_error("Hash algorithm not recorded in config");
+    }
     
     // Test double initialization
     if (vault.initializeVault()) throw std::runtime_error("Double initialization not prevented");
@@ -107,13 +122,48 @@ void test_sync_operations() {
         throw std::runtime_error("Nested directory sync failed");
     if (!fs::exists("test_vault/source/file2.txt")) 
         throw std::runtime_error("Reverse sync failed");
+    if (!compare_files("test_vault/source/file2.txt", "test_vault/dest/file2.txt"))
+        throw std::runtime_error("Reverse sync copied different content");
+
+    // Every copy is carried out by one of the transfer strategies
+    TransferStats stats = vault.getTransferStats();
+    uint64_t transfers = 0;
+    for (size_t i = 0; i < TRANSFER_STRATEGY_COUNT; i++) transfers += stats.transfers[i];
+    if (transfers < 2) throw std::runtime_error("Transfer statistics not recorded");
     
     // Test conflict handling
     create_test_file("test_vault/source/conflict.txt", "Source version");
     create_test_file("test_vault/dest/conflict.txt", "Dest version");
     auto conflicts = vault.getConflictingFiles();
     if (conflicts.empty()) throw std::runtime_error("Conflict detection failed");
-    
+
+    // Unchanged files are answered from the stat cache, but a rewrite that
+    // keeps size and mtime is still caught through its ctime
+    create_test_file("test_vault/source/cached.txt", "Same");
+    create_test_file("test_vault/dest/cached.txt", "Same");
+    auto modified = vault.getModifiedFiles();
+    if (!fs::exists("test_vault/.vault/statcache")) throw std::runtime_error("Stat cache not written");
+    if (std::find(modified.begin(), modified.end(), "cached.txt") != modified.end())
+        throw std::runtime_error("Identical files reported as modified");
+    auto mtime = fs::last_write_time("test_vault/dest/cached.txt");
+    create_test_file("test_vault/dest/cached.txt", "Diff");
+    fs::last_write_time("test_vault/dest/cached.txt", mtime);
+    modified = vault.getModifiedFiles();
+    if (std::find(modified.begin(), modified.end(), "cached.txt") == modified.end())
+        throw std::runtime_error("Stat cache hid a modified file");
+
+    // Entries of deleted files are dropped when the cache is saved
+    {
+        StatCache cache("test_vault/.vault/statcache");
+        size_t before = cache.size();
+        fs::remove("test_vault/source/cached.txt");
+        struct stat info;
+        stat("test_vault/dest/cached.txt", &info);
+        cache.store("test_vault/dest/cached.txt", info, "changed");
+        if (!cache.save() || StatCache("test_vault/.vault/statcache").size() != before - 1)
+            throw std::runtime_error("Stat cache kept a deleted file");
+    }
+
     std::cout << "✓ Synchronization tests passed" << std::endl;
 }
 
@@ -161,6 +211,1128 @@ void test_file_monitoring() {
     std::cout << "✓ File monitoring tests passed" << std::endl;
 }
 
+// Parallel ingest: many staged files hashed and stored across workers
+void test_parallel_commit() {
+    print_separator("Parallel Ingest Tests");
+
+    VaultManager vault("test_vault");
+    if (!vault.isVaultInitialized()) vault.initializeVault();
+    vault.setIngestThreads(4);
+
+    const int fileCount = 32;
+    fs::create_directories("test_vault/bulk");
+    for (int i = 0; i < fileCount; i++) {
+        std::string path = "test_vault/bulk/file" + std::to_string(i) + ".txt";
+        std::ofstream file(path);
+        file << "Bulk content " << i;
+        file.close();
+        if (!vault.addFile(path)) throw std::runtime_error("Failed to stage " + path);
+    }
+    // Staging the same file twice must not produce a second object
+    if (!vault.addFile("test_vault/bulk/file0.txt")) throw std::runtime_error("Failed to restage file");
+
+    if (!vault.commit("Bulk commit")) throw std::runtime_error("Parallel commit failed");
+
+    auto history = vault.getFileHistory("bulk/file7.txt");
+    if (history.size() != 1) throw std::runtime_error("Committed file missing from history");
+
+    std::cout << "✓ Parallel ingest tests passed" << std::endl;
+}
+
+std::string read_head(const std::string& branch) {
+    return VaultManager("test_vault").getBranchHead(branch);
+}
+
+uint64_t directory_size(const std::string& path) {
+    uint64_t total = 0;
+    for (const auto& entry : fs::recursive_directory_iterator(path)) {
+        if (entry.is_regular_file()) total += entry.file_size();
+    }
+    return total;
+}
+
+// Chunked storage: a small edit to a large file only stores the changed chunks
+void test_chunked_storage() {
+    print_separator("Chunked Storage Tests");
+
+    VaultManager vault("test_vault");
+    if (!vault.isVaultInitialized()) vault.initializeVault();
+    if (!vault.setChunking(true, 1024 * 1024)) throw std::runtime_error("Failed to enable chunking");
+
+    std::string content;
+    std::mt19937_64 gen(7);
+    for (int i = 0; i < 4 * 1024 * 1024 / 8; i++) {
+        uint64_t word = gen();
+        content.append(reinterpret_cast<const char*>(&word), sizeof(word));
+    }
+    create_test_file("test_vault/large.bin", content);
+    if (!vault.addFile("test_vault/large.bin") || !vault.commit("Large file"))
+        throw std::runtime_error("Failed to commit large file");
+    std::string firstCommit = read_head("master");
+
+    uint64_t before = directory_size("test_vault/.vault/objects");
+    content[content.size() / 2] ^= 0x5a;
+    create_test_file("test_vault/large.bin", content);
+    if (!vault.addFile("test_vault/large.bin") || !vault.commit("Edit large file"))
+        throw std::runtime_error("Failed to commit edited large file");
+    uint64_t growth = directory_size("test_vault/.vault/objects") - before;
+    if (growth >= content.size() / 2)
+        throw std::runtime_error("Edited large file was not deduplicated");
+
+    // Restoring the first version reassembles it from its chunks
+    std::string original = content;
+    original[original.size() / 2] ^= 0x5a;
+    create_test_file("test_vault/original.bin", original);
+    if (!vault.checkoutFile("large.bin", firstCommit)) throw std::runtime_error("Chunked checkout failed");
+    bool restored = compare_files("large.bin", "test_vault/original.bin");
+    fs::remove("large.bin");
+    if (!restored) throw std::runtime_error("Chunked checkout produced different content");
+
+    vault.setChunking(false);
+    std::cout << "✓ Chunked storage tests passed" << std::endl;
+}
+
+// Compressed storage: text objects shrink on disk and restore unchanged
+void test_compressed_storage() {
+    print_separator("Compressed Storage Tests");
+
+    VaultManager vault("test_vault");
+    if (!vault.isVaultInitialized()) vault.initializeVault();
+    if (!vault.setCompression("zlib")) throw std::runtime_error("Failed to enable compression");
+
+    std::string content;
+    for (int i = 0; i < 20000; i++) content += "setting_" + std::to_string(i % 50) + " = enabled\n";
+    create_test_file("test_vault/settings.conf", content);
+
+    uint64_t before = directory_size("test_vault/.vault/objects");
+    if (!vault.addFile("test_vault/settings.conf") || !vault.commit("Compressible file"))
+        throw std::runtime_error("Failed to commit compressible file");
+    if (directory_size("test_vault/.vault/objects") - before >= content.size() / 2)
+        throw std::runtime_error("Object was not compressed");
+
+    std::string commitId = read_head("master");
+    if (!vault.checkoutFile("settings.conf", commitId)) throw std::runtime_error("Compressed checkout failed");
+    bool restored = compare_files("settings.conf", "test_vault/settings.conf");
+    fs::remove("settings.conf");
+    if (!restored) throw std::runtime_error("Compressed checkout produced different content");
+
+    vault.setCompression("none");
+    std::cout << "✓ Compressed storage tests passed" << std::endl;
+}
+
+// Packed objects: small loose objects fold into a pack and stay readable
+void test_packed_objects() {
+    print_separator("Packed Object Tests");
+
+    VaultManager vault("test_vault");
+    if (!vault.isVaultInitialized()) vault.initializeVault();
+    if (!vault.repack()) throw std::runtime_error("Repack failed");
+
+    size_t looseObjects = 0;
+    for (const auto& entry : fs::directory_iterator("test_vault/.vault/objects")) {
+        if (entry.is_regular_file() && entry.file_size() <= FileManager::PACK_OBJECT_LIMIT) looseObjects++;
+    }
+    if (looseObjects != 0) throw std::runtime_error("Small objects left loose after repack");
+
+    size_t indexes = 0;
+    for (const auto& entry : fs::directory_iterator("test_vault/.vault/objects/pack")) {
+        if (entry.path().extension() == ".idx") indexes++;
+    }
+    if (indexes != 1) throw std::runtime_error("Pack index not written");
+
+    // Compressed objects are decoded straight out of the pack
+    std::string commitId = read_head("master");
+    if (!vault.checkoutFile("settings.conf", commitId)) throw std::runtime_error("Packed checkout failed");
+    bool restored = compare_files("settings.conf", "test_vault/settings.conf");
+    fs::remove("settings.conf");
+    if (!restored) throw std::runtime_error("Packed checkout produced different content");
+
+    // Committing content that is already packed must not store it again
+    if (!vault.addFile("test_vault/settings.conf") || !vault.commit("Unchanged settings"))
+        throw std::runtime_error("Failed to recommit packed file");
+    for (const auto& entry : fs::directory_iterator("test_vault/.vault/objects")) {
+        if (entry.is_regular_file()) throw std::runtime_error("Packed object was stored again");
+    }
+
+    std::cout << "✓ Packed object tests passed" << std::endl;
+}
+
+// Delta storage: a small edit to a tracked file is stored as a delta
+void test_delta_storage() {
+    print_separator("Delta Storage Tests");
+
+    VaultManager vault("test_vault");
+    if (!vault.isVaultInitialized()) vault.initializeVault();
+
+    std::string content;
+    std::mt19937_64 gen(11);
+    for (int i = 0; i < 4000; i++) content += "key_" + std::to_string(gen() % 100000) + " = value\n";
+    create_test_file("test_vault/app.conf", content);
+    if (!vault.addFile("test_vault/app.conf") || !vault.commit("Add config"))
+        throw std::runtime_error("Failed to commit config");
+    std::string firstCommit = read_head("master");
+
+    uint64_t before = directory_size("test_vault/.vault/objects");
+    std::string edited = content;
+    edited.replace(edited.size() / 2, 5, "EDITED");
+    create_test_file("test_vault/app.conf", edited);
+    if (!vault.addFile("test_vault/app.conf") || !vault.commit("Edit config"))
+        throw std::runtime_error("Failed to commit edited config");
+    if (directory_size("test_vault/.vault/objects") - before >= content.size() / 10)
+        throw std::runtime_error("Edited config was not stored as a delta");
+
+    // Both versions reconstruct, the new one by applying the delta
+    std::string secondCommit = read_head("master");
+    if (!vault.checkoutFile("app.conf", secondCommit)) throw std::runtime_error("Delta checkout failed");
+    bool restored = compare_files("app.conf", "test_vault/app.conf");
+    create_test_file("test_vault/app.orig", content);
+    if (!vault.checkoutFile("app.conf", firstCommit)) throw std::runtime_error("Base checkout failed");
+    restored = restored && compare_files("app.conf", "test_vault/app.orig");
+    fs::remove("app.conf");
+    if (!restored) throw std::runtime_error("Delta checkout produced different content");
+
+    // Each later edit is a delta on the one before; every level rebuilds
+    std::vector<std::pair<std::string, std::string>> versions;
+    std::string chained = content;
+    for (int i = 0; i < 5; i++) {
+        chained.replace(chained.size() / 3 + i * 100, 5, "LEVEL" + std::to_string(i));
+        create_test_file("test_vault/chain.conf", chained);
+        if (!vault.addFile("test_vault/chain.conf") || !vault.commit("Edit chained config"))
+            throw std::runtime_error("Failed to commit chained edit");
+        versions.push_back({read_head("master"), chained});
+    }
+    for (const auto& [commitId, expected] : versions) {
+        create_test_file("test_vault/chain.orig", expected);
+        if (!vault.checkoutFile("chain.conf", commitId)) throw std::runtime_error("Chained delta checkout failed");
+        bool same = compare_files("chain.conf", "test_vault/chain.orig");
+        fs::remove("chain.conf");
+        if (!same) throw std::runtime_error("Chained delta checkout produced different content");
+    }
+
+    // Files staged together in several directories all find their bases
+    std::vector<std::string> nested = {"test_vault/conf/a/one.conf", "test_vault/conf/b/two.conf",
+                                       "test_vault/conf/three.conf", "test_vault/conf.d/four.conf"};
+    for (const auto& path : nested) {
+        fs::create_directories(fs::path(path).parent_path());
+        create_test_file(path, path + "\n" + content);
+    }
+    if (!vault.addFiles(nested) || !vault.commit("Add nested configs"))
+        throw std::runtime_error("Failed to commit nested configs");
+    before = directory_size("test_vault/.vault/objects");
+    for (const auto& path : nested) create_test_file(path, path + "\nEDITED\n" + content);
+    if (!vault.addFiles(nested) || !vault.commit("Edit nested configs"))
+        throw std::runtime_error("Failed to commit edited nested configs");
+    if (directory_size("test_vault/.vault/objects") - before >= content.size() / 5)
+        throw std::runtime_error("Nested configs were not stored as deltas");
+
+    std::cout << "✓ Delta storage tests passed" << std::endl;
+}
+
+// Garbage collection: unreferenced objects go once past the grace period
+void test_garbage_collection() {
+    print_separator("Garbage Collection Tests");
+
+    VaultManager vault("test_vault");
+    if (!vault.isVaultInitialized()) vault.initializeVault();
+
+    auto old = fs::file_time_type::clock::now() - std::chrono::hours(48);
+    std::string stray = "test_vault/.vault/objects/" + std::string(64, 'a');
+    std::string recent = "test_vault/.vault/objects/" + std::string(64, 'b');
+    create_test_file(stray, "unreferenced");
+    create_test_file(recent, "unreferenced but new");
+    fs::last_write_time(stray, old);
+
+    GcStats stats;
+    if (!vault.gc(GarbageCollector::DEFAULT_GRACE_SECONDS, &stats)) throw std::runtime_error("gc failed");
+    if (fs::exists(stray)) throw std::runtime_error("Unreferenced object was not collected");
+    if (!fs::exists(recent)) throw std::runtime_error("Object inside the grace period was collected");
+    if (stats.removedObjects != 1 || stats.missingObjects != 0 || stats.reclaimedBytes == 0)
+        throw std::runtime_error("Unexpected gc statistics");
+
+    // Dead objects inside an old pack are dropped by rewriting the pack
+    if (!vault.repack()) throw std::runtime_error("Repack failed");
+    for (const auto& entry : fs::directory_iterator("test_vault/.vault/objects/pack")) {
+        fs::last_write_time(entry.path(), old);
+    }
+    if (!vault.gc(GarbageCollector::DEFAULT_GRACE_SECONDS, &stats)) throw std::runtime_error("gc failed");
+    if (stats.rewrittenPacks == 0 || stats.removedObjects != 1)
+        throw std::runtime_error("Packed garbage was not collected");
+
+    // Everything still referenced reads back, including delta chains
+    if (!vault.checkoutFile("app.conf", read_head("master"))) throw std::runtime_error("Checkout after gc failed");
+    bool restored = compare_files("app.conf", "test_vault/app.conf");
+    fs::remove("app.conf");
+    if (!restored) throw std::runtime_error("Checkout after gc produced different content");
+
+    std::cout << "✓ Garbage collection tests passed" << std::endl;
+}
+
+// Integrity verification: damaged and missing objects are reported
+void test_integrity_check() {
+    print_separator("Integrity Verification Tests");
+
+    VaultManager vault("test_vault");
+    if (!vault.isVaultInitialized()) vault.initializeVault();
+
+    create_test_file("test_vault/verify.txt", "Content that must survive unchanged");
+    if (!vault.addFile("test_vault/verify.txt")) throw std::runtime_error("Failed to add file");
+    if (!vault.commit("File to verify")) throw std::runtime_error("Commit failed");
+
+    VerifyStats stats;
+    if (!vault.verify(&stats)) throw std::runtime_error("Healthy vault failed verification");
+    if (stats.objectsChecked == 0 || stats.bytesChecked == 0 || stats.rootsChecked == 0)
+        throw std::runtime_error("Verification checked nothing");
+
+    FileManager objects("test_vault/.vault", "objects");
+    std::string objectPath = objects.getObjectPath(ObjectId::fromHex(objects.calculateFileHash("test_vault/verify.txt")));
+    if (!fs::exists(objectPath)) throw std::runtime_error("Expected a loose object for the new file");
+
+    // A flipped byte is caught by rehashing
+    fs::permissions(objectPath, fs::perms::owner_write, fs::perm_options::add);
+    create_test_file(objectPath, "Content that must survive unchanged!");
+    if (vault.verify(&stats)) throw std::runtime_error("Corrupt object passed verification");
+    if (stats.corruptObjects != 1 || stats.missingObjects != 0)
+        throw std::runtime_error("Corrupt object was not reported");
+
+    // A commit naming an object that is gone is caught too
+    fs::remove(objectPath);
+    if (vault.verify(&stats)) throw std::runtime_error("Missing object passed verification");
+    if (stats.missingObjects == 0 || stats.corruptObjects != 0)
+        throw std::runtime_error("Missing object was not reported");
+
+    create_test_file(objectPath, "Content that must survive unchanged");
+    if (!vault.verify(&stats)) throw std::runtime_error("Restored vault failed verification");
+
+    std::cout << "✓ Integrity verification tests passed" << std::endl;
+}
+
+// Commit log: commits live in one append-only file, legacy directories are
+// imported and a torn record left by a crash is discarded
+void test_commit_log() {
+    print_separator("Commit Log Tests");
+
+    std::string commitsPath = "test_vault/.vault/commits";
+    for (const auto& entry : fs::directory_iterator(commitsPath)) {
+        if (entry.is_directory()) throw std::runtime_error("Commit stored outside the log: " + entry.path().string());
+    }
+    if (!fs::exists(commitsPath + "/log") || !fs::exists(commitsPath + "/log.idx"))
+        throw std::runtime_error("Commit log files missing");
+
+    // A commit written by an older version is moved into the log
+    std::string appHash;
+    {
+        VaultManager vault("test_vault");
+        auto history = vault.getFileHistory("app.conf");
+        if (history.size() != 2) throw std::runtime_error("Unexpected app.conf history");
+        appHash = history.front().hash;
+    }
+    fs::create_directories(commitsPath + "/5f000000-000001");
+    create_test_file(commitsPath + "/5f000000-000001/metadata.json",
+                     "{\"commit_id\": \"5f000000-000001\", \"message\": \"Legacy\", "
+                     "\"timestamp\": 1593835520, \"files\": {\"legacy.conf\": \"" + appHash + "\"}}");
+
+    VaultManager vault("test_vault");
+    if (fs::exists(commitsPath + "/5f000000-000001")) throw std::runtime_error("Legacy commit was not imported");
+    if (!vault.checkoutFile("legacy.conf", "5f000000-000001")) throw std::runtime_error("Legacy commit checkout failed");
+    bool legacyRestored = compare_files("legacy.conf", "test_vault/app.conf");
+    fs::remove("legacy.conf");
+    if (!legacyRestored) throw std::runtime_error("Legacy commit restored wrong content");
+    // Its snapshot is unknown, so it cannot be compared or merged
+    std::string legacyHead = vault.getBranchHead(vault.getCurrentBranch());
+    if (!vault.diff(legacyHead, "5f000000-000001").empty() || vault.merge("5f000000-000001") ||
+        vault.getBranchHead(vault.getCurrentBranch()) != legacyHead || fs::exists("test_vault/legacy.conf"))
+        throw std::runtime_error("Legacy commit was merged without a snapshot");
+
+    // Half a record at the end of the log is cut off by the next commit
+    {
+        std::ofstream log(commitsPath + "/log", std::ios::binary | std::ios::app);
+        log.write("\x40\x00\x00\x00\x12\x34", 6);
+    }
+    create_test_file("test_vault/after-crash.txt", "Written after a torn append");
+    if (!vault.addFile("test_vault/after-crash.txt")) throw std::runtime_error("Failed to add file");
+    if (!vault.commit("After crash")) throw std::runtime_error("Commit after torn record failed");
+
+    VaultManager reopened("test_vault");
+    if (reopened.getFileHistory("after-crash.txt").size() != 1 || reopened.getFileHistory("app.conf").size() != 2)
+        throw std::runtime_error("Commit log lost commits");
+    if (!reopened.checkoutFile("after-crash.txt", read_head("master"))) throw std::runtime_error("Checkout failed");
+    bool restored = compare_files("after-crash.txt", "test_vault/after-crash.txt");
+    fs::remove("after-crash.txt");
+    if (!restored) throw std::runtime_error("Checkout produced different content");
+
+    std::cout << "✓ Commit log tests passed" << std::endl;
+}
+
+// History index: per-path history is paged and picks up new commits
+void test_file_history() {
+    print_separator("File History Tests");
+
+    VaultManager vault("test_vault");
+    auto all = vault.getFileHistory("source/rapid.txt");
+    if (all.size() < 2) throw std::runtime_error("Expected several versions of rapid.txt");
+    for (size_t i = 1; i < all.size(); i++) {
+        if (std::stoll(all[i - 1].timestamp) < std::stoll(all[i].timestamp))
+            throw std::runtime_error("History is not newest first");
+    }
+
+    auto page = vault.getFileHistory("source/rapid.txt", 1, 1);
+    if (page.size() != 1 || page[0].commitId != all[1].commitId || page[0].hash != all[1].hash)
+        throw std::runtime_error("History page does not match the full history");
+    if (!vault.getFileHistory("source/rapid.txt", all.size(), 5).empty())
+        throw std::runtime_error("Page past the end of the history is not empty");
+
+    // A commit made through another instance shows up without reopening
+    {
+        VaultManager writer("test_vault");
+        create_test_file("test_vault/history.txt", "Recorded elsewhere");
+        if (!writer.addFile("test_vault/history.txt")) throw std::runtime_error("Failed to add file");
+        if (!writer.commit("Commit from another instance")) throw std::runtime_error("Commit failed");
+    }
+    auto history = vault.getFileHistory("history.txt");
+    if (history.size() != 1 || history[0].message != "Commit from another instance" ||
+        history[0].commitId != read_head("master"))
+        throw std::runtime_error("History index missed a new commit");
+
+    // The index is kept on disk; another instance reads it back, and a
+    // torn record at its end is cut off and rewritten
+    const std::string indexPath = "test_vault/.vault/commits/history";
+    if (!fs::exists(indexPath)) throw std::runtime_error("History index was not saved");
+    uintmax_t indexSize = fs::file_size(indexPath);
+    {
+        std::ofstream torn(indexPath, std::ios::binary | std::ios::app);
+        torn << "\x40\x00\x00\x00partial";
+    }
+    VaultManager reopened("test_vault");
+    auto reread = reopened.getFileHistory("source/rapid.txt");
+    if (reread.size() != all.size() || reread[0].commitId != all[0].commitId || reread[0].hash != all[0].hash)
+        throw std::runtime_error("Saved history index does not match");
+    create_test_file("test_vault/history.txt", "Recorded after reopening");
+    if (!reopened.addFile("test_vault/history.txt")) throw std::runtime_error("Failed to add file");
+    if (!reopened.commit("Second history commit")) throw std::runtime_error("Commit failed");
+    if (reopened.getFileHistory("history.txt").size() != 2 || vault.getFileHistory("history.txt").size() != 2)
+        throw std::runtime_error("History index was not extended");
+    if (fs::file_size(indexPath) <= indexSize) throw std::runtime_error("History index did not grow");
+
+    std::cout << "✓ File history tests passed" << std::endl;
+}
+
+// Commit graph: parents, ancestry, merge base and commits since a point
+void test_commit_graph() {
+    print_separator("Commit Graph Tests");
+
+    std::string forkPoint, topicHead, masterHead;
+    {
+        VaultManager vault("test_vault");
+        forkPoint = vault.getBranchHead("master");
+        if (!vault.createBranch("topic")) throw std::runtime_error("Failed to create branch");
+        if (vault.getBranchHead("topic") != forkPoint) throw std::runtime_error("Branch did not fork at HEAD");
+
+        auto commitFile = [&](const std::string& content) {
+            create_test_file("test_vault/graph.txt", content);
+            if (!vault.addFile("test_vault/graph.txt")) throw std::runtime_error("Failed to add file");
+            if (!vault.commit(content)) throw std::runtime_error("Commit failed");
+        };
+
+        if (!vault.switchBranch("topic")) throw std::runtime_error("Failed to switch branch");
+        commitFile("Topic change 1");
+        commitFile("Topic change 2");
+        topicHead = vault.getBranchHead("topic");
+        if (!vault.switchBranch("master")) throw std::runtime_error("Failed to switch branch");
+        commitFile("Master change");
+        masterHead = vault.getBranchHead("master");
+    }
+
+    auto check = [&](VaultManager& vault) {
+        if (!vault.isAncestor(forkPoint, topicHead) || !vault.isAncestor(forkPoint, masterHead) ||
+            !vault.isAncestor(topicHead, topicHead))
+            throw std::runtime_error("Ancestor not recognised");
+        if (vault.isAncestor(topicHead, masterHead) || vault.isAncestor(masterHead, forkPoint))
+            throw std::runtime_error("Non-ancestor reported as ancestor");
+        if (vault.getMergeBase(topicHead, masterHead) != forkPoint)
+            throw std::runtime_error("Wrong merge base");
+
+        auto topicOnly = vault.getCommitsSince(masterHead, topicHead);
+        if (topicOnly.size() != 2 || topicOnly[0] != topicHead)
+            throw std::runtime_error("Wrong commits since the fork");
+        auto masterOnly = vault.getCommitsSince(topicHead, masterHead);
+        if (masterOnly.size() != 1 || masterOnly[0] != masterHead)
+            throw std::runtime_error("Wrong commits since the fork on master");
+    };
+
+    VaultManager reopened("test_vault");
+    check(reopened);
+
+    // The graph is derived from the log and is rebuilt if it goes missing
+    fs::remove("test_vault/.vault/commits/graph");
+    VaultManager rebuilt("test_vault");
+    check(rebuilt);
+    if (!fs::exists("test_vault/.vault/commits/graph")) throw std::runtime_error("Commit graph was not rebuilt");
+
+    std::cout << "✓ Commit graph tests passed" << std::endl;
+}
+
+// Tree snapshots: commits keep full paths and share unchanged directories
+void test_tree_snapshots() {
+    print_separator("Tree Snapshot Tests");
+
+    VaultManager vault("test_vault");
+    auto count_objects = []() {
+        size_t count = 0;
+        for (const auto& entry : fs::directory_iterator("test_vault/.vault/objects")) {
+            if (isObjectName(entry.path().filename().string())) count++;
+        }
+        return count;
+    };
+
+    fs::create_directories("test_vault/tree/left");
+    fs::create_directories("test_vault/tree/right");
+    create_test_file("test_vault/tree/left/same.txt", "Left side");
+    create_test_file("test_vault/tree/right/same.txt", "Right side");
+    if (!vault.addFile("test_vault/tree/left/same.txt") || !vault.addFile("test_vault/tree/right/same.txt") ||
+        !vault.commit("Two directories"))
+        throw std::runtime_error("Failed to commit tree files");
+
+    // Files with the same name in different directories stay apart
+    if (vault.getFileHistory("tree/left/same.txt").size() != 1 ||
+        vault.getFileHistory("tree/right/same.txt").size() != 1)
+        throw std::runtime_error("Full paths were not recorded");
+
+    // Changing one file rewrites its blob and the three trees above it;
+    // the untouched directory is shared with the previous snapshot
+    size_t before = count_objects();
+    create_test_file("test_vault/tree/left/same.txt", "Left side, edited");
+    if (!vault.addFile("test_vault/tree/left/same.txt") || !vault.commit("Edit left"))
+        throw std::runtime_error("Failed to commit edited tree file");
+    if (count_objects() - before != 4)
+        throw std::runtime_error("Unchanged directories were not shared");
+
+    // The latest snapshot still holds the file it did not change
+    if (!vault.checkoutFile("tree/right/same.txt", read_head("master")))
+        throw std::runtime_error("Unchanged file missing from snapshot");
+    bool restored = compare_files("tree/right/same.txt", "test_vault/tree/right/same.txt");
+    fs::remove_all("tree");
+    if (!restored) throw std::runtime_error("Snapshot checkout produced different content");
+
+    VerifyStats stats;
+    if (!vault.verify(&stats) || !stats.isClean())
+        throw std::runtime_error("Snapshot trees failed verification");
+
+    // A directory replaced by a file of the same name in one change set
+    FileManager objects("test_vault/.vault", "objects");
+    TreeManager trees(objects);
+    ObjectId blob = ObjectId::fromHex(objects.calculateFileHash("test_vault/tree/left/same.txt"));
+    ObjectId withDir = trees.writeTree(ObjectId(), {{"d/x", blob}, {"e", blob}});
+    ObjectId withFile = trees.writeTree(withDir, {{"d", blob}, {"d/x", ObjectId()}});
+    auto files = trees.flatten(withFile);
+    if (files.size() != 2 || files.count("d") != 1 || files.count("e") != 1)
+        throw std::runtime_error("File replacing a directory was dropped");
+    auto changes = trees.diff(withDir, withFile);
+    if (changes.size() != 2 || changes[0].path != "d" || changes[1].path != "d/x")
+        throw std::runtime_error("Directory replaced by a file diffed wrongly");
+
+    std::cout << "✓ Tree snapshot tests passed" << std::endl;
+}
+
+// Whole-tree checkout: only files that differ from the snapshot are written
+void test_tree_checkout() {
+    print_separator("Tree Checkout Tests");
+
+    VaultManager vault("test_vault");
+    const int fileCount = 12;
+    for (int i = 0; i < fileCount; i++) {
+        std::string dir = "test_vault/restore/dir" + std::to_string(i % 3);
+        fs::create_directories(dir);
+        create_test_file(dir + "/file" + std::to_string(i) + ".txt", "Restore " + std::to_string(i));
+        if (!vault.addFile(dir + "/file" + std::to_string(i) + ".txt"))
+            throw std::runtime_error("Failed to stage restore file");
+    }
+    if (!vault.commit("Restore set")) throw std::runtime_error("Failed to commit restore set");
+    std::string commitId = read_head("master");
+
+    // Losing the directory restores every file in it
+    fs::remove_all("test_vault/restore");
+    CheckoutStats stats;
+    if (!vault.checkout("master", {"restore"}, &stats) || stats.filesSelected != fileCount ||
+        stats.filesWritten != fileCount)
+        throw std::runtime_error("Checkout did not restore the lost files");
+    if (read_file("test_vault/restore/dir1/file4.txt") != "Restore 4")
+        throw std::runtime_error("Checkout restored wrong content");
+
+    // A second checkout finds everything in place
+    if (!vault.checkout(commitId, {"restore"}, &stats) || stats.filesWritten != 0 ||
+        stats.filesUnchanged != fileCount)
+        throw std::runtime_error("Unchanged files were rewritten");
+
+    // Only the edited file is written back
+    create_test_file("test_vault/restore/dir2/file5.txt", "Local edit");
+    if (!vault.checkout("master", {"restore"}, &stats) || stats.filesWritten != 1)
+        throw std::runtime_error("Edited file was not the only one written");
+    if (read_file("test_vault/restore/dir2/file5.txt") != "Restore 5")
+        throw std::runtime_error("Edited file was not restored");
+
+    // Sparse checkout touches only the requested paths
+    fs::remove_all("test_vault/restore");
+    if (!vault.checkout("master", {"restore/dir0", "restore/dir1/file1.txt"}, &stats) ||
+        stats.filesSelected != 5 || stats.filesWritten != 5)
+        throw std::runtime_error("Sparse checkout selected the wrong files");
+    if (fs::exists("test_vault/restore/dir2") || !fs::exists("test_vault/restore/dir1/file1.txt"))
+        throw std::runtime_error("Sparse checkout wrote outside its paths");
+
+    if (vault.checkout("no-such-branch", {}, &stats))
+        throw std::runtime_error("Checkout of an unknown target succeeded");
+
+    std::cout << "✓ Tree checkout tests passed" << std::endl;
+}
+
+// Metadata cache: repeated commit and branch state reads skip decoding
+void test_metadata_cache() {
+    print_separator("Metadata Cache Tests");
+
+    VaultManager vault("test_vault");
+    create_test_file("test_vault/cached.txt", "Cached once");
+    if (!vault.addFile("test_vault/cached.txt") || !vault.commit("Cache base"))
+        throw std::runtime_error("Failed to commit cached file");
+    std::string commitId = read_head("master");
+
+    // The new commit is served from memory on every checkout
+    auto before = vault.getMetadataCacheStats();
+    for (int i = 0; i < 3; i++) {
+        if (!vault.checkoutFile("cached.txt", commitId)) throw std::runtime_error("Cached checkout failed");
+    }
+    fs::remove("cached.txt");
+    auto after = vault.getMetadataCacheStats();
+    if (after.commits.hits - before.commits.hits < 3 || after.commits.misses != before.commits.misses)
+        throw std::runtime_error("Repeated commit reads were not cached");
+
+    // Saving a branch state caches it for the next commit on the branch
+    create_test_file("test_vault/cached.txt", "Cached twice");
+    if (!vault.addFile("test_vault/cached.txt") || !vault.commit("Cache edit"))
+        throw std::runtime_error("Failed to commit edited cached file");
+    if (vault.getMetadataCacheStats().branchStates.hits <= after.branchStates.hits)
+        throw std::runtime_error("Branch state was parsed again after being written");
+
+    // A state file rewritten behind the cache's back is read again
+    std::string statePath = "test_vault/.vault/branches/master/state.json";
+    std::string state = read_file(statePath);
+    std::string marker = "\"external.txt\" : \"" + std::string(64, 'a') + "\",\n";
+    state.insert(state.find('{', state.find("files")) + 1, "\n" + marker);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    create_test_file(statePath, state);
+    if (!vault.createBranch("cache-fork")) throw std::runtime_error("Failed to fork branch");
+    if (read_file("test_vault/.vault/branches/cache-fork/state.json").find("external.txt") == std::string::npos)
+        throw std::runtime_error("Stale branch state served from the cache");
+
+    // Values over the budget are not kept
+    vault.setMetadataCacheSize(1, 1);
+    if (!vault.checkoutFile("cached.txt", commitId)) throw std::runtime_error("Uncached checkout failed");
+    fs::remove("cached.txt");
+    auto bounded = vault.getMetadataCacheStats();
+    if (bounded.commits.entries != 0 || bounded.branchStates.entries != 0)
+        throw std::runtime_error("Cache grew past its budget");
+
+    std::cout << "✓ Metadata cache tests passed" << std::endl;
+}
+
+// Object ids: binary digests that convert to and from hex at the edges
+void test_object_ids() {
+    print_separator("Object Id Tests");
+
+    std::string hex = "00ff" + std::string(56, '7') + "a0b1";
+    ObjectId id = ObjectId::fromHex(hex);
+    if (id.toHex() != hex || id.isNull()) throw std::runtime_error("Object id did not round-trip");
+    if (ObjectId::fromHex("00FF" + std::string(56, '7') + "A0B1") != id)
+        throw std::runtime_error("Upper-case hex parsed differently");
+
+    ObjectId rejected;
+    if (ObjectId::parse(hex.substr(1), rejected) || ObjectId::parse(hex.substr(1) + "g", rejected) ||
+        !rejected.isNull())
+        throw std::runtime_error("Malformed object name was accepted");
+
+    // Ordering matches the hex order object files and packs are sorted in
+    ObjectId smaller = ObjectId::fromHex(std::string(63, '0') + "1");
+    if (!(smaller < id) || id < smaller || !(ObjectId() < smaller))
+        throw std::runtime_error("Object ids ordered incorrectly");
+
+    std::unordered_set<ObjectId> ids{id, smaller, ObjectId::fromHex(hex)};
+    if (ids.size() != 2 || !ids.count(smaller)) throw std::runtime_error("Object id hashing is broken");
+
+    // History hands out hex, which names the stored object
+    auto history = VaultManager("test_vault").getFileHistory("cached.txt");
+    if (history.empty() || !ObjectId::parse(history.front().hash, rejected) ||
+        rejected.toHex() != history.front().hash)
+        throw std::runtime_error("History hash is not an object name");
+
+    std::cout << "✓ Object id tests passed" << std::endl;
+}
+
+// Staging index: many threads stage at once, restaging replaces, staged files
+// survive a restart and gc, and commit uses the content hashed when staged
+void test_staging_index() {
+    print_separator("Staging Index Tests");
+
+    const int threadCount = 4;
+    const int filesPerThread = 8;
+    {
+        VaultManager vault("test_vault");
+        fs::create_directories("test_vault/staged");
+        std::atomic<int> failures{0};
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threadCount; t++) {
+            workers.emplace_back([&, t] {
+                for (int i = 0; i < filesPerThread; i++) {
+                    std::string path = "test_vault/staged/t" + std::to_string(t) + "-" + std::to_string(i) + ".txt";
+                    std::ofstream(path) << "Thread " << t << " file " << i;
+                    if (!vault.addFile(path)) failures++;
+                }
+            });
+        }
+        for (auto& worker : workers) worker.join();
+        if (failures != 0) throw std::runtime_error("Concurrent staging failed");
+
+        if (!vault.addFile("test_vault/staged/t0-0.txt")) throw std::runtime_error("Failed to restage file");
+        if (vault.getStagedFiles().size() != threadCount * filesPerThread)
+            throw std::runtime_error("Staging index lost or duplicated files");
+    }
+
+    // Edits after staging are not part of the commit
+    create_test_file("test_vault/staged/t0-0.txt", "Edited after staging");
+
+    VaultManager vault("test_vault");
+    if (vault.getStagedFiles().size() != threadCount * filesPerThread)
+        throw std::runtime_error("Staged files were lost on restart");
+
+    // Staged objects are not named by any commit yet but must survive gc
+    auto old = fs::file_time_type::clock::now() - std::chrono::hours(48);
+    for (const auto& entry : fs::directory_iterator("test_vault/.vault/objects")) {
+        if (entry.is_regular_file()) fs::last_write_time(entry.path(), old);
+    }
+    // gc and verify only read the index; a torn record a stager may still
+    // be writing is left in place
+    {
+        std::ofstream torn("test_vault/.vault/index", std::ios::binary | std::ios::app);
+        torn << "\x40\x00\x00\x00partial";
+    }
+    uintmax_t indexSize = fs::file_size("test_vault/.vault/index");
+    if (!vault.gc()) throw std::runtime_error("gc failed");
+    VerifyStats verifyStats;
+    vault.verify(&verifyStats);
+    if (fs::file_size("test_vault/.vault/index") != indexSize)
+        throw std::runtime_error("Reading the staging index modified it");
+
+    if (!vault.commit("Staged from threads")) throw std::runtime_error("Commit of staged files failed");
+    if (!vault.getStagedFiles().empty()) throw std::runtime_error("Commit left files staged");
+    if (vault.getFileHistory("staged/t3-7.txt").size() != 1)
+        throw std::runtime_error("Staged file missing from commit");
+
+    if (!vault.checkout("master", {"staged"})) throw std::runtime_error("Checkout of staged files failed");
+    if (read_file("test_vault/staged/t0-0.txt") != "Thread 0 file 0")
+        throw std::runtime_error("Commit did not use the content hashed at stage time");
+
+    std::cout << "✓ Staging index tests passed" << std::endl;
+}
+
+// Branch state journal: commits append only their changes, a torn record
+// is dropped, and compaction folds the journal into state.json
+void test_branch_state_journal() {
+    print_separator("Branch State Journal Tests");
+
+    std::string statePath = "test_vault/.vault/branches/master/state.json";
+    std::string journalPath = "test_vault/.vault/branches/master/state.journal";
+    {
+        VaultManager vault("test_vault");
+        std::string base = read_file(statePath);
+        create_test_file("test_vault/journal/first.txt", "First journaled");
+        if (!vault.addFile("test_vault/journal/first.txt") || !vault.commit("Journal first"))
+            throw std::runtime_error("Failed to commit journaled file");
+        if (read_file(statePath) != base) throw std::runtime_error("Commit rewrote the state snapshot");
+        if (!fs::exists(journalPath)) throw std::runtime_error("Commit did not write the journal");
+    }
+
+    // A record torn by a crash is ignored and overwritten by the next one
+    std::ofstream(journalPath, std::ios::binary | std::ios::app) << std::string("\x40\0\0\0torn", 8);
+    {
+        VaultManager vault("test_vault");
+        create_test_file("test_vault/journal/second.txt", "Second journaled");
+        if (!vault.addFile("test_vault/journal/second.txt") || !vault.commit("Journal second"))
+            throw std::runtime_error("Failed to commit after a torn record");
+        if (!vault.createBranch("journal-fork")) throw std::runtime_error("Failed to fork branch");
+    }
+    std::string fork = read_file("test_vault/.vault/branches/journal-fork/state.json");
+    if (fork.find("journal/first.txt") == std::string::npos || fork.find("journal/second.txt") == std::string::npos)
+        throw std::runtime_error("Journaled changes missing from the branch state");
+
+    // Past the threshold the journal is folded in before the vault closes
+    {
+        VaultManager vault("test_vault");
+        vault.setStateCompactionThreshold(1);
+        create_test_file("test_vault/journal/third.txt", "Third journaled");
+        if (!vault.addFile("test_vault/journal/third.txt") || !vault.commit("Journal third"))
+            throw std::runtime_error("Failed to commit before compaction");
+    }
+    if (fs::exists(journalPath)) throw std::runtime_error("Journal was not compacted");
+    std::string state = read_file(statePath);
+    for (const std::string path : {"journal/first.txt", "journal/second.txt", "journal/third.txt"}) {
+        if (state.find(path) == std::string::npos) throw std::runtime_error("Compaction lost " + path);
+    }
+
+    // Two vault instances committing at once, with compactions between
+    // their appends, each keep the other's changes
+    const int commitsPerVault = 10;
+    {
+        VaultManager first("test_vault");
+        VaultManager second("test_vault");
+        std::atomic<int> failures{0};
+        auto run = [&](VaultManager& vault, int id) {
+            vault.setStateCompactionThreshold(256);
+            for (int i = 0; i < commitsPerVault; i++) {
+                std::string path = "test_vault/journal/v" + std::to_string(id) + "-" + std::to_string(i) + ".txt";
+                create_test_file(path, "Vault " + std::to_string(id) + " commit " + std::to_string(i));
+                if (!vault.addFile(path) || !vault.commit("Concurrent commit")) failures++;
+            }
+        };
+        std::thread other(run, std::ref(second), 1);
+        run(first, 0);
+        other.join();
+        if (failures != 0) throw std::runtime_error("Concurrent commits failed");
+    }
+    {
+        VaultManager vault("test_vault");
+        vault.setStateCompactionThreshold(1);
+        create_test_file("test_vault/journal/last.txt", "Folds the journal");
+        if (!vault.addFile("test_vault/journal/last.txt") || !vault.commit("Journal last"))
+            throw std::runtime_error("Failed to commit after concurrent commits");
+    }
+    state = read_file(statePath);
+    for (int id = 0; id < 2; id++) {
+        for (int i = 0; i < commitsPerVault; i++) {
+            std::string path = "journal/v" + std::to_string(id) + "-" + std::to_string(i) + ".txt";
+            if (state.find(path) == std::string::npos) throw std::runtime_error("Concurrent commit lost " + path);
+        }
+    }
+
+    // A reader outside the vault never sees committed files go missing
+    // while every commit is compacted
+    {
+        std::atomic<bool> done{false};
+        std::atomic<int> failures{0};
+        std::thread committer([&]() {
+            VaultManager vault("test_vault");
+            vault.setStateCompactionThreshold(1);
+            for (int i = 0; i < commitsPerVault; i++) {
+                std::string path = "test_vault/journal/r" + std::to_string(i) + ".txt";
+                create_test_file(path, "Read during compaction " + std::to_string(i));
+                if (!vault.addFile(path) || !vault.commit("Compacted commit")) failures++;
+            }
+            done = true;
+        });
+        size_t seen = 0;
+        while (!done) {
+            try {
+                size_t count = BranchManager::readStateFiles("test_vault/.vault/branches/master").size();
+                if (count < seen) failures++;
+                seen = std::max(seen, count);
+            }
+            catch (const std::exception&) {
+                failures++;
+            }
+        }
+        committer.join();
+        if (failures != 0) throw std::runtime_error("Branch state read during compaction missed files");
+    }
+
+    std::cout << "✓ Branch state journal tests passed" << std::endl;
+}
+
+// Branch switch: only files that differ between branches are written or
+// deleted, and local changes stop the switch
+void test_branch_switch() {
+    print_separator("Branch Switch Tests");
+
+    VaultManager vault("test_vault");
+    create_test_file("test_vault/switch/shared.txt", "Shared on master");
+    create_test_file("test_vault/switch/same.txt", "Same everywhere");
+    if (!vault.addFile("test_vault/switch/shared.txt") || !vault.addFile("test_vault/switch/same.txt") ||
+        !vault.commit("Switch base"))
+        throw std::runtime_error("Failed to commit switch base");
+
+    if (!vault.createBranch("switch-a") || !vault.switchBranch("switch-a"))
+        throw std::runtime_error("Failed to switch to new branch");
+    create_test_file("test_vault/switch/shared.txt", "Shared on switch-a");
+    create_test_file("test_vault/switch/deep/only-a.txt", "Only on switch-a");
+    if (!vault.addFile("test_vault/switch/shared.txt") || !vault.addFile("test_vault/switch/deep/only-a.txt") ||
+        !vault.commit("Switch branch edit"))
+        throw std::runtime_error("Failed to commit on switch-a");
+
+    auto sameTime = fs::last_write_time("test_vault/switch/same.txt");
+    CheckoutStats stats;
+    if (!vault.switchBranch("master", &stats)) throw std::runtime_error("Failed to switch back to master");
+    if (stats.filesWritten != 1 || stats.filesDeleted != 1 || stats.filesFailed != 0)
+        throw std::runtime_error("Switch touched more than the differing files");
+    if (read_file("test_vault/switch/shared.txt") != "Shared on master" || fs::exists("test_vault/switch/deep"))
+        throw std::runtime_error("Work tree does not match master after the switch");
+    if (fs::last_write_time("test_vault/switch/same.txt") != sameTime)
+        throw std::runtime_error("File shared by both branches was rewritten");
+
+    if (!vault.switchBranch("switch-a", &stats) || stats.filesWritten != 2)
+        throw std::runtime_error("Failed to switch to switch-a again");
+    if (read_file("test_vault/switch/deep/only-a.txt") != "Only on switch-a")
+        throw std::runtime_error("Work tree does not match switch-a");
+
+    // Local edits to a file the switch would change keep the branch as is
+    create_test_file("test_vault/switch/shared.txt", "Local edit");
+    if (vault.switchBranch("master", &stats) || stats.filesModified != 1)
+        throw std::runtime_error("Switch over local changes was not refused");
+    if (vault.getCurrentBranch() != "switch-a" || read_file("test_vault/switch/shared.txt") != "Local edit")
+        throw std::runtime_error("Refused switch changed the work tree");
+
+    create_test_file("test_vault/switch/shared.txt", "Shared on switch-a");
+    if (!vault.switchBranch("master")) throw std::runtime_error("Failed to switch after undoing the edit");
+
+    // A file on one branch where the other has a directory of that name
+    if (!vault.createBranch("switch-file") || !vault.switchBranch("switch-file"))
+        throw std::runtime_error("Failed to switch to switch-file");
+    create_test_file("test_vault/switch/swap", "A file on switch-file");
+    if (!vault.addFile("test_vault/switch/swap") || !vault.commit("Swap as a file") || !vault.switchBranch("master"))
+        throw std::runtime_error("Failed to commit swap file");
+    create_test_file("test_vault/switch/swap/inner.txt", "A directory on master");
+    if (!vault.addFile("test_vault/switch/swap/inner.txt") || !vault.commit("Swap as a directory"))
+        throw std::runtime_error("Failed to commit swap directory");
+    if (!vault.switchBranch("switch-file", &stats) || stats.filesFailed != 0 ||
+        read_file("test_vault/switch/swap") != "A file on switch-file")
+        throw std::runtime_error("Directory was not replaced by a file");
+    if (!vault.switchBranch("master", &stats) || stats.filesFailed != 0 ||
+        read_file("test_vault/switch/swap/inner.txt") != "A directory on master")
+        throw std::runtime_error("File was not replaced by a directory");
+
+    std::cout << "✓ Branch switch tests passed" << std::endl;
+}
+
+// Diff and merge: snapshot differences in path order, three-way merges that
+// take one-sided changes, stop on conflicts and fast-forward when possible
+void test_diff_and_merge() {
+    print_separator("Diff and Merge Tests");
+
+    VaultManager vault("test_vault");
+    auto commitFile = [&](const std::string& path, const std::string& content) {
+        create_test_file("test_vault/" + path, content);
+        if (!vault.addFile("test_vault/" + path) || !vault.commit("Edit " + path))
+            throw std::runtime_error("Failed to commit " + path);
+    };
+
+    commitFile("merge/both.txt", "Base");
+    commitFile("merge/conflict.txt", "Base");
+    if (!vault.createBranch("merge-topic") || !vault.switchBranch("merge-topic"))
+        throw std::runtime_error("Failed to start topic branch");
+    commitFile("merge/both.txt", "Topic edit");
+    commitFile("merge/conflict.txt", "Topic conflict");
+    commitFile("merge/topic-new.txt", "Topic only");
+
+    auto changes = vault.diff("master", "merge-topic");
+    if (changes.size() != 3 || changes[0].path != "merge/both.txt" || changes[1].path != "merge/conflict.txt" ||
+        changes[2].path != "merge/topic-new.txt" || !changes[2].from.isNull() || changes[2].to.isNull())
+        throw std::runtime_error("Unexpected diff between branches");
+    if (!vault.diff("merge-topic", "merge-topic").empty()) throw std::runtime_error("Snapshot differs from itself");
+
+    if (!vault.switchBranch("master")) throw std::runtime_error("Failed to switch to master");
+    commitFile("merge/conflict.txt", "Master conflict");
+    commitFile("merge/master-new.txt", "Master only");
+
+    // A path changed differently on both sides stops the merge untouched
+    MergeResult result;
+    if (vault.merge("merge-topic", &result) || result.conflicts != std::vector<std::string>{"merge/conflict.txt"})
+        throw std::runtime_error("Conflicting merge was not refused");
+    if (read_file("test_vault/merge/both.txt") != "Base") throw std::runtime_error("Refused merge changed files");
+
+    if (!vault.switchBranch("merge-topic")) throw std::runtime_error("Failed to switch to topic");
+    commitFile("merge/conflict.txt", "Master conflict");
+    std::string topicHead = vault.getBranchHead("merge-topic");
+    if (!vault.switchBranch("master")) throw std::runtime_error("Failed to switch to master");
+
+    if (!vault.merge("merge-topic", &result) || result.fastForward || !result.conflicts.empty())
+        throw std::runtime_error("Clean merge failed");
+    if (read_file("test_vault/merge/both.txt") != "Topic edit" ||
+        read_file("test_vault/merge/topic-new.txt") != "Topic only" ||
+        read_file("test_vault/merge/master-new.txt") != "Master only")
+        throw std::runtime_error("Merged work tree is wrong");
+    std::string mergeHead = vault.getBranchHead("master");
+    if (!vault.isAncestor(topicHead, mergeHead) || vault.getMergeBase(topicHead, mergeHead) != topicHead)
+        throw std::runtime_error("Merge commit does not have both parents");
+    auto remaining = vault.diff("merge-topic", "master");
+    if (remaining.size() != 1 || remaining[0].path != "merge/master-new.txt")
+        throw std::runtime_error("Merge result differs from the topic by more than master's own change");
+
+    if (!vault.merge("merge-topic", &result) || !result.upToDate)
+        throw std::runtime_error("Repeated merge was not recognised");
+
+    // The topic branch has nothing of its own left, so it just moves
+    if (!vault.switchBranch("merge-topic") || !vault.merge("master", &result) || !result.fastForward ||
+        vault.getBranchHead("merge-topic") != mergeHead)
+        throw std::runtime_error("Fast-forward merge failed");
+    if (!vault.diff("master", "merge-topic").empty()) throw std::runtime_error("Fast-forward left a difference");
+    if (!vault.switchBranch("master")) throw std::runtime_error("Failed to switch back to master");
+
+    // A file on one side where the other added a directory of that name
+    if (!vault.createBranch("merge-shape") || !vault.switchBranch("merge-shape"))
+        throw std::runtime_error("Failed to start shape branch");
+    commitFile("merge/shape", "A file on merge-shape");
+    if (!vault.switchBranch("master")) throw std::runtime_error("Failed to switch to master");
+    commitFile("merge/shape/inner.txt", "A directory on master");
+    std::string shapeHead = vault.getBranchHead("master");
+    if (vault.merge("merge-shape", &result) || result.conflicts != std::vector<std::string>{"merge/shape"} ||
+        vault.getBranchHead("master") != shapeHead ||
+        read_file("test_vault/merge/shape/inner.txt") != "A directory on master")
+        throw std::runtime_error("File and directory of the same name were merged");
+
+    // Local changes stop the merge before anything is committed
+    if (!vault.createBranch("merge-local") || !vault.switchBranch("merge-local"))
+        throw std::runtime_error("Failed to start local branch");
+    commitFile("merge/local.txt", "Committed on merge-local");
+    if (!vault.switchBranch("master")) throw std::runtime_error("Failed to switch to master");
+    create_test_file("test_vault/merge/local.txt", "Local work");
+    if (vault.merge("merge-local", &result) || vault.getBranchHead("master") != shapeHead ||
+        read_file("test_vault/merge/local.txt") != "Local work")
+        throw std::runtime_error("Merge over local changes was not refused");
+    fs::remove("test_vault/merge/local.txt");
+    if (!vault.merge("merge-local", &result) || vault.getBranchHead("master") == shapeHead ||
+        read_file("test_vault/merge/local.txt") != "Committed on merge-local")
+        throw std::runtime_error("Merge after discarding local changes failed");
+
+    std::cout << "✓ Diff and merge tests passed" << std::endl;
+}
+
+void test_packed_refs() {
+    print_separator("Packed Refs Tests");
+
+    const size_t branchCount = 100;
+    auto branchName = [](size_t i) { return "ref-" + std::to_string(1000 + i); };
+    std::string masterHead;
+    {
+        VaultManager vault("test_vault");
+        masterHead = vault.getBranchHead("master");
+        for (size_t i = 0; i < branchCount; i++) {
+            if (!vault.createBranch(branchName(i))) throw std::runtime_error("Failed to create " + branchName(i));
+        }
+        if (vault.createBranch(branchName(0))) throw std::runtime_error("Created a branch twice");
+    }
+
+    size_t looseCount = std::distance(fs::directory_iterator("test_vault/.vault/refs"), fs::directory_iterator());
+    if (!fs::exists("test_vault/.vault/packed-refs") || looseCount > 64)
+        throw std::runtime_error("Loose refs were not packed");
+
+    auto checkBranches = [&](VaultManager& vault) {
+        auto branches = vault.listBranches();
+        if (!std::is_sorted(branches.begin(), branches.end()) ||
+            std::count(branches.begin(), branches.end(), "master") != 1)
+            throw std::runtime_error("Branch listing is wrong");
+        for (size_t i = 0; i < branchCount; i++) {
+            if (!std::binary_search(branches.begin(), branches.end(), branchName(i)))
+                throw std::runtime_error("Branch missing from listing: " + branchName(i));
+        }
+    };
+
+    std::string newHead;
+    {
+        VaultManager vault("test_vault");
+        checkBranches(vault);
+        if (vault.getBranchHead(branchName(7)) != masterHead) throw std::runtime_error("Packed ref has the wrong head");
+
+        // A later update to a packed branch overrides the packed value
+        if (!vault.switchBranch(branchName(7))) throw std::runtime_error("Failed to switch to packed branch");
+        create_test_file("test_vault/refs/packed.txt", "On a packed branch");
+        if (!vault.addFile("test_vault/refs/packed.txt") || !vault.commit("Commit on packed branch"))
+            throw std::runtime_error("Failed to commit on packed branch");
+        newHead = vault.getBranchHead(branchName(7));
+        if (newHead.empty() || newHead == masterHead) throw std::runtime_error("Branch head did not move");
+        if (!vault.switchBranch("master")) throw std::runtime_error("Failed to switch to master");
+    }
+    if (read_head(branchName(7)) != newHead || read_head(branchName(8)) != masterHead)
+        throw std::runtime_error("Ref update not seen by a new vault instance");
+
+    // Names that nest or hold a '.' are stored like any other
+    const std::vector<std::string> oddNames = {"nest", "nest/x", "group/y", "rel.tmp", "100%"};
+    {
+        VaultManager vault("test_vault");
+        for (const auto& name : oddNames) {
+            if (!vault.createBranch(name)) throw std::runtime_error("Failed to create branch " + name);
+        }
+        for (const std::string name : {"", "/lead", "trail/", "a//b", "..", "up/../out"}) {
+            if (vault.createBranch(name)) throw std::runtime_error("Accepted branch name \"" + name + "\"");
+        }
+
+        // A branch whose ref cannot be written leaves nothing behind
+        fs::create_directories("test_vault/.vault/refs/blocked");
+        bool created = vault.createBranch("blocked");
+        fs::remove("test_vault/.vault/refs/blocked");
+        if (created || fs::exists("test_vault/.vault/branches/blocked") || vault.getBranchHead("blocked") != "")
+            throw std::runtime_error("Failed branch creation left the branch behind");
+    }
+    {
+        VaultManager vault("test_vault");
+        auto branches = vault.listBranches();
+        for (const auto& name : oddNames) {
+            if (!std::binary_search(branches.begin(), branches.end(), name) || vault.getBranchHead(name) != masterHead)
+                throw std::runtime_error("Branch lost on reopening: " + name);
+        }
+        if (std::binary_search(branches.begin(), branches.end(), "group") ||
+            std::binary_search(branches.begin(), branches.end(), "blocked"))
+            throw std::runtime_error("Branch listed that was never created");
+        if (!vault.switchBranch("nest/x") || !vault.switchBranch("master"))
+            throw std::runtime_error("Failed to switch to a nested branch");
+    }
+
+    // Two vault instances creating branches at once, each packing in turn,
+    // keep every ref the other wrote
+    const size_t racedCount = 2 * RefStore::PACK_THRESHOLD;
+    {
+        VaultManager first("test_vault");
+        VaultManager second("test_vault");
+        std::atomic<int> failures{0};
+        auto run = [&](VaultManager& vault, const std::string& prefix) {
+            for (size_t i = 0; i < racedCount; i++) {
+                if (!vault.createBranch(prefix + std::to_string(i))) failures++;
+            }
+        };
+        std::thread other(run, std::ref(second), "race-b-");
+        run(first, "race-a-");
+        other.join();
+        if (failures != 0) throw std::runtime_error("Concurrent branch creation failed");
+    }
+    {
+        VaultManager vault("test_vault");
+        auto branches = vault.listBranches();
+        for (const std::string prefix : {"race-a-", "race-b-"}) {
+            for (size_t i = 0; i < racedCount; i++) {
+                if (!std::binary_search(branches.begin(), branches.end(), prefix + std::to_string(i)))
+                    throw std::runtime_error("Concurrent pack lost " + prefix + std::to_string(i));
+            }
+        }
+    }
+
+    // Vaults from before the ref store kept each head in its branch directory
+    std::vector<std::string> names;
+    {
+        VaultManager vault("test_vault");
+        names = vault.listBranches();
+        for (const auto& name : names) {
+            std::ofstream head("test_vault/.vault/branches/" + name + "/HEAD");
+            head << vault.getBranchHead(name) << std::endl;
+        }
+    }
+    fs::remove_all("test_vault/.vault/refs");
+    fs::remove("test_vault/.vault/packed-refs");
+    {
+        VaultManager vault("test_vault");
+        checkBranches(vault);
+        if (vault.listBranches() != names || vault.getBranchHead(branchName(7)) != newHead ||
+            vault.getBranchHead("master") != masterHead)
+            throw std::runtime_error("Legacy branch heads were not imported");
+        if (fs::exists("test_vault/.vault/branches/master/HEAD"))
+            throw std::runtime_error("Legacy HEAD file was left behind");
+    }
+
+    std::cout << "✓ Packed refs tests passed" << std::endl;
+}
+
 void cleanup() {
     fs::remove_all("test_vault");
 }
@@ -173,6 +1345,25 @@ int main() {
         test_version_control();
         test_sync_operations();
         test_file_monitoring();
+        test_parallel_commit();
+        test_chunked_storage();
+        test_compressed_storage();
+        test_packed_objects();
+        test_delta_storage();
+        test_garbage_collection();
+        test_integrity_check();
+        test_commit_log();
+        test_file_history();
+        test_commit_graph();
+        test_tree_snapshots();
+        test_tree_checkout();
+        test_metadata_cache();
+        test_object_ids();
+        test_staging_index();
+        test_branch_state_journal();
+        test_branch_switch();
+        test_diff_and_merge();
+        test_packed_refs();
         
         cleanup();
         std::cout << "\nAll tests completed successfully!" << std::endl;